@@ -6,7 +6,38 @@ char *SHARED_SECRET = 0;
 int RED_PIN = -1;
 int GREEN_PIN = -1;
 int BLUE_PIN = -1;
-char *OPENRGB_SERVER = 0;
-int OPENRGB_PORT = 0;
+struct openrgb_server_config OPENRGB_SERVERS[MAX_OPENRGB_SERVERS] = {{0, 6742}};
+int OPENRGB_SERVERS_COUNT = 0;
+int OPENRGB_RECONNECT_MAX = 10000;
+int OPENRGB_SPATIAL = 0;
+char *OUTPUT_BACKEND = 0;
+int SYSFS_PWM_CHIP = 0;
+int SYSFS_PWM_PERIOD = 1000000;
+char *MOCK_OUTPUT_FILE = 0;
+char *SPI_DEVICE = 0;
+char *SPI_LED_TYPE = 0;
+char *PLUGIN_DIR = 0;
+char *AUDIO_SOURCE = 0;
+int AUDIO_RATE = 44100;
+int AUDIO_CHANNELS = 2;
+char *SCENE_FILE = 0;
+char *STATE_FILE = 0;
+int PWM_RANGE = 255;
+int PWM_FREQUENCY = 0;
+double GAMMA = 1.0;
+int BRIGHTNESS = 255;
+int WHITE_BALANCE_RED = 255;
+int WHITE_BALANCE_GREEN = 255;
+int WHITE_BALANCE_BLUE = 255;
+int TRANSITION_RATE = 100;
+int DITHERING = 0;
+int DITHER_RATE = 200;
+int HARDWARE_ANIMATIONS = 0;
+struct strip_config STRIPS[MAX_STRIPS];
+int STRIPS_COUNT = 0;
+char *STRIP_GROUPS[MAX_STRIP_GROUPS];
+int STRIP_GROUPS_COUNT = 0;
+struct schedule_config SCHEDULE[MAX_SCHEDULE];
+int SCHEDULE_COUNT = 0;
 char config_file[256];
 uint8_t pi = 0;
\ No newline at end of file
@@ -5,29 +5,94 @@
 
 struct openrgb_device {
     uint32_t device_id;
+    uint32_t config_index; // number of the device in openrgb_config, device_id may differ if devices were reordered
     uint8_t *name;
 };
 
+// OpenRGB SDK server of a PC, described in OPENRGB_SERVERS list of config
+#define MAX_OPENRGB_SERVERS 8
+struct openrgb_server_config {
+    char *address;
+    int port;
+};
+
+// one LED strip (output), described in OUTPUTS list of config
+#define MAX_STRIPS 32
+#define MAX_STRIP_GROUPS 32
+#define STRIPS_ALL 0xFFFFFFFF // mask of all strips
+struct strip_config {
+    char *name;
+    int pins[4];     // RED, GREEN, BLUE and WHITE pins, WHITE is -1 for plain RGB strips
+    uint32_t groups; // bitmask of STRIP_GROUPS the strip belongs to
+    int first_pixel; // addressable strips (spi backend): pixels of the chain this output covers, no pins needed
+    int pixels;      // 0 for PWM strips
+};
+
+// daily command, described in SCHEDULE list of config
+#define MAX_SCHEDULE 64
+struct schedule_config {
+    int time;     // seconds since local midnight
+    char *action; // "color", "sunrise", "sunset" or effect name
+    int target;   // protocol target, TARGET_ALL if not given
+    int red, green, blue;
+    int ramp; // seconds of color change
+    int speed;
+    int duration;
+};
+
 extern char *PI_ADDR;
 extern char *PI_PORT;
 extern char *SHARED_SECRET;
 extern int RED_PIN;
 extern int GREEN_PIN;
 extern int BLUE_PIN;
-extern char *OPENRGB_SERVER;
-extern int OPENRGB_PORT;
+extern struct openrgb_server_config OPENRGB_SERVERS[MAX_OPENRGB_SERVERS];
+extern int OPENRGB_SERVERS_COUNT;
+extern int OPENRGB_RECONNECT_MAX;
+extern int OPENRGB_SPATIAL;
+extern char *OUTPUT_BACKEND;
+extern int SYSFS_PWM_CHIP;
+extern int SYSFS_PWM_PERIOD;
+extern char *MOCK_OUTPUT_FILE;
+extern char *SPI_DEVICE;
+extern char *SPI_LED_TYPE;
+extern char *PLUGIN_DIR;
+extern char *AUDIO_SOURCE;
+extern int AUDIO_RATE;
+extern int AUDIO_CHANNELS;
+extern char *SCENE_FILE;
+extern char *STATE_FILE;
+extern int PWM_RANGE;
+extern int PWM_FREQUENCY;
+extern double GAMMA;
+extern int BRIGHTNESS;
+extern int WHITE_BALANCE_RED;
+extern int WHITE_BALANCE_GREEN;
+extern int WHITE_BALANCE_BLUE;
+extern int TRANSITION_RATE;
+extern int DITHERING;
+extern int DITHER_RATE;
+extern int HARDWARE_ANIMATIONS;
+extern struct strip_config STRIPS[MAX_STRIPS];
+extern int STRIPS_COUNT;
+extern char *STRIP_GROUPS[MAX_STRIP_GROUPS];
+extern int STRIP_GROUPS_COUNT;
+extern struct schedule_config SCHEDULE[MAX_SCHEDULE];
+extern int SCHEDULE_COUNT;
 extern char config_file[256];
 
-extern struct openrgb_device *openrgb_devices_to_change; // defined in openrgb.c
-extern int32_t openrgb_using_devices_num;                // defined in openrgb.c
-
 extern uint8_t pi; // should be inited by main
 
-#define PILED_VERSION 4
-#define BUFFER_SIZE 55    // ver 4
-#define HEADER_SIZE 18    // ver 4
-#define PAYLOAD_SIZE 5    // ver 4
-#define PAYLOAD_OFFSET 50 // ver 4, offset to start of PAYLOAD bytes in BUFFER
+#define PILED_VERSION 5
+#define BUFFER_SIZE 56    // ver 5
+#define HEADER_SIZE 18    // ver 5
+#define PAYLOAD_SIZE 6    // ver 5
+#define PAYLOAD_OFFSET 50 // ver 5, offset to start of PAYLOAD bytes in BUFFER
+#define VERSION_OFFSET 16 // all versions, version byte follows timestamp and nonce
+
+// Targets of commands (v5)
+#define TARGET_ALL 0          // all strips, also used for older protocol versions
+#define TARGET_GROUP_BASE 128 // 1..127 is strip number in config order, 128 + N is group N
 
 // Operational Codes
 #define LED_SET_COLOR 0
@@ -36,5 +101,17 @@ extern uint8_t pi; // should be inited by main
 #define ANIM_SET_PULSE 3
 #define SYS_TOGGLE_SUSPEND 4
 #define SYS_COLOR_CHANGED 5
+#define LED_SET_OVERLAY 6
+#define ANIM_SET_BREATHING 7
+#define ANIM_SET_RAINBOW 8
+#define ANIM_SET_STROBE 9
+#define ANIM_SET_CANDLE 10
+#define ANIM_SET_COLOR_CYCLE 11
+#define ANIM_RUN_PROGRAM 12
+#define SYS_SCHEDULE 13
+#define ANIM_AUDIO 14
+#define SCENE_SAVE 15
+#define SCENE_DELETE 16
+#define SCENE_RECALL 17
 
 #endif // GLOBALS_H
\ No newline at end of file
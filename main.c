@@ -1,8 +1,16 @@
 #include "globals/globals.h"
+#include "rgb/audio.h"
 #include "parser/config.h"
-#include "pigpiod_if2.h"
+#include "rgb/color.h"
+#include "rgb/effects.h"
+#include "rgb/engine.h"
 #include "rgb/gpio.h"
 #include "rgb/openrgb.h"
+#include "rgb/output.h"
+#include "rgb/plugins.h"
+#include "rgb/scenes.h"
+#include "rgb/scheduler.h"
+#include "rgb/state.h"
 #include "server/server.h"
 #include "utils/utils.h"
 #include <pthread.h>
@@ -22,7 +30,8 @@ void handle_sigint(int sig) {
     logger(MAIN, "Stopping server!");
     stop_server = 1;
     openrgb_stop_server = 1;
-    openrgb_exit = 1;
+    openrgb_wake();
+    wake_server();
 }
 
 int main(int argc, char *argv[]) {
@@ -37,26 +46,36 @@ int main(int argc, char *argv[]) {
 
     parse_args(argc, argv);
 
-    if (OPENRGB_SERVER) {
-        logger(MAIN, "OpenRGB server IP is set, starting OpenRGB!");
-        pthread_t orgb_thread;
-        pthread_create(&orgb_thread, NULL, openrgb_init, NULL);
+    if (OPENRGB_SERVERS_COUNT > 0) {
+        logger(MAIN, "OpenRGB servers are set, starting OpenRGB!");
+        openrgb_start();
     } else {
         logger(MAIN, "Not starting OpenRGB since OpenRGB server IP not set.");
     }
 
-    pi = pigpio_start(PI_ADDR, PI_PORT);
-    if (pi < 0) {
-        logger(MAIN, "Pigpio initialization failed.\n");
+    if (output_select(OUTPUT_BACKEND) != 0 || output_init() != 0) {
+        logger(MAIN, "Output initialization failed.\n");
+        return 1;
+    }
+    color_pipeline_init();
+    effects_init();
+    plugins_load();
+    engine_init();
+    if (audio_start() != 0) {
         return 1;
     }
-    logger(MAIN, "Connected to pigpio daemon successfully!");
-
-    set_mode(pi, RED_PIN, PI_OUTPUT);
-    set_mode(pi, GREEN_PIN, PI_OUTPUT);
-    set_mode(pi, BLUE_PIN, PI_OUTPUT);
 
-    set_color(pi, (struct Color){0, 0, 0});
+    // last state is shown before anyone can connect, black if there is none.
+    // It is restored before the first frame, so outputs go straight from what they hold to the saved colors
+    state_open();
+    state_restore();
+    if (engine_start() != 0) {
+        return 1;
+    }
+    scenes_open();
+    if (scheduler_start() != 0) {
+        return 1;
+    }
 
 #ifdef libwebsockets_FOUND
     ws_server_init(pi);
@@ -72,11 +91,36 @@ int main(int argc, char *argv[]) {
     }
 
     logger(MAIN, "See you next time!");
-    pigpio_stop(pi);
+    scheduler_stop();
+    state_close();
+    engine_stop();
+    struct engine_status status;
+    engine_get_status(&status);
+    if (status.mode == ENGINE_ACTIVE) {
+        logger(MAIN, "Render engine rendered %lu ticks after %lu wakeups, was active at %u ticks per second.",
+               status.ticks, status.wakeups, status.tick_rate);
+    } else {
+        logger(MAIN, "Render engine rendered %lu ticks after %lu wakeups, was idle.", status.ticks, status.wakeups);
+    }
+    scenes_close();
+    audio_stop();
+    plugins_unload();
+    output_shutdown();
+    openrgb_sync_stop();
     openrgb_shutdown();
     free(PI_ADDR);
     free(PI_PORT);
     free(SHARED_SECRET);
-    free(OPENRGB_SERVER);
+    for (int i = 0; i < OPENRGB_SERVERS_COUNT; i++) {
+        free(OPENRGB_SERVERS[i].address);
+    }
+    free(OUTPUT_BACKEND);
+    free(MOCK_OUTPUT_FILE);
+    free(SPI_DEVICE);
+    free(SPI_LED_TYPE);
+    free(PLUGIN_DIR);
+    free(AUDIO_SOURCE);
+    free(SCENE_FILE);
+    free(STATE_FILE);
     return 0;
 }
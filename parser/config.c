@@ -1,11 +1,161 @@
 #include "config.h"
 #include "../globals/globals.h"
+#include "../rgb/openrgb.h"
 #include "../utils/utils.h"
 #include <getopt.h>
 #include <libconfig.h>
 #include <stdlib.h>
 #include <string.h>
 
+#ifndef ORGBCONFIGURATOR
+static int find_or_add_group(const char *name) {
+    for (int i = 0; i < STRIP_GROUPS_COUNT; i++) {
+        if (strcmp(STRIP_GROUPS[i], name) == 0)
+            return i;
+    }
+    if (STRIP_GROUPS_COUNT == MAX_STRIP_GROUPS) {
+        logger(PARSER, "Too many output groups, max is %d\n", MAX_STRIP_GROUPS);
+        return -1;
+    }
+    STRIP_GROUPS[STRIP_GROUPS_COUNT] = strdup(name);
+    return STRIP_GROUPS_COUNT++;
+}
+
+// color levels of the LUT stage are 0-255, anything above would drive pins past PWM_RANGE
+static int lookup_level(const config_t *cfg, const char *name) {
+    int level;
+    if (!config_lookup_int(cfg, name, &level))
+        return 255;
+    if (level < 0 || level > 255) {
+        int clamped = level < 0 ? 0 : 255;
+        logger(PARSER, "%s must be between 0 and 255, using %d\n", name, clamped);
+        return clamped;
+    }
+    return level;
+}
+
+static int parse_outputs(const config_setting_t *outputs) {
+    const char *pin_names[] = {"RED_PIN", "GREEN_PIN", "BLUE_PIN", "WHITE_PIN"};
+    int count = config_setting_length(outputs);
+    if (count < 1 || count > MAX_STRIPS) {
+        logger(PARSER, "OUTPUTS must contain from 1 to %d outputs!\n", MAX_STRIPS);
+        return -1;
+    }
+
+    for (int i = 0; i < count; i++) {
+        const config_setting_t *output = config_setting_get_elem(outputs, i);
+        struct strip_config *strip = &STRIPS[i];
+        const char *name;
+        char default_name[16];
+        if (!config_setting_lookup_string(output, "NAME", &name)) {
+            snprintf(default_name, sizeof(default_name), "output%d", i + 1);
+            name = default_name;
+        }
+        strip->name = strdup(name);
+
+        // addressable strips are described by their pixels instead of pins
+        strip->pixels = 0;
+        strip->first_pixel = 0;
+        config_setting_lookup_int(output, "PIXELS", &strip->pixels);
+        config_setting_lookup_int(output, "FIRST_PIXEL", &strip->first_pixel);
+        if (strip->pixels < 0 || strip->first_pixel < 0) {
+            logger(PARSER, "PIXELS and FIRST_PIXEL of output \"%s\" can't be negative!\n", strip->name);
+            return -1;
+        }
+
+        for (int pin = 0; pin < 4; pin++) {
+            if (!config_setting_lookup_int(output, pin_names[pin], &strip->pins[pin])) {
+                if (pin == 3 || strip->pixels) {
+                    strip->pins[pin] = -1;
+                    continue;
+                }
+                logger(PARSER, "Missing %s of output \"%s\" in config file!\n", pin_names[pin], strip->name);
+                return -1;
+            }
+        }
+
+        strip->groups = 0;
+        const config_setting_t *groups = config_setting_get_member(output, "GROUPS");
+        for (int group = 0; groups && group < config_setting_length(groups); group++) {
+            const char *group_name = config_setting_get_string(config_setting_get_elem(groups, group));
+            int index = group_name ? find_or_add_group(group_name) : -1;
+            if (index < 0)
+                return -1;
+            strip->groups |= 1u << index;
+        }
+    }
+    STRIPS_COUNT = count;
+    return 0;
+}
+
+static int parse_schedule(const config_setting_t *schedule) {
+    int count = config_setting_length(schedule);
+    if (count > MAX_SCHEDULE) {
+        logger(PARSER, "SCHEDULE can contain up to %d entries!\n", MAX_SCHEDULE);
+        return -1;
+    }
+
+    for (int i = 0; i < count; i++) {
+        const config_setting_t *setting = config_setting_get_elem(schedule, i);
+        struct schedule_config *entry = &SCHEDULE[i];
+        const char *time;
+        int hour, minute, second = 0;
+        if (!config_setting_lookup_string(setting, "TIME", &time) ||
+            sscanf(time, "%d:%d:%d", &hour, &minute, &second) < 2 || hour < 0 || hour > 23 || minute < 0 ||
+            minute > 59 || second < 0 || second > 59) {
+            logger(PARSER, "Schedule entry #%d needs TIME as \"HH:MM\" or \"HH:MM:SS\"!\n", i + 1);
+            return -1;
+        }
+        entry->time = hour * 3600 + minute * 60 + second;
+
+        const char *action = "color";
+        config_setting_lookup_string(setting, "ACTION", &action);
+        entry->action = strdup(action);
+        entry->target = TARGET_ALL;
+        config_setting_lookup_int(setting, "TARGET", &entry->target);
+
+        int *channels[] = {&entry->red, &entry->green, &entry->blue};
+        const config_setting_t *color = config_setting_get_member(setting, "COLOR");
+        for (int channel = 0; channel < 3; channel++) {
+            *channels[channel] = color ? config_setting_get_int_elem(color, channel) : 0;
+        }
+
+        entry->ramp = entry->speed = entry->duration = 0;
+        config_setting_lookup_int(setting, "RAMP", &entry->ramp);
+        config_setting_lookup_int(setting, "SPEED", &entry->speed);
+        config_setting_lookup_int(setting, "DURATION", &entry->duration);
+        if (entry->ramp < 0 || entry->ramp > 86400) {
+            logger(PARSER, "RAMP of schedule entry #%d must be from 0 to 86400 seconds!\n", i + 1);
+            return -1;
+        }
+    }
+    SCHEDULE_COUNT = count;
+    return 0;
+}
+#endif
+
+static int parse_openrgb_servers(const config_setting_t *servers) {
+    int count = config_setting_length(servers);
+    if (count < 1 || count > MAX_OPENRGB_SERVERS) {
+        logger(PARSER, "OPENRGB_SERVERS must contain from 1 to %d servers!\n", MAX_OPENRGB_SERVERS);
+        return -1;
+    }
+
+    for (int i = 0; i < count; i++) {
+        const config_setting_t *setting = config_setting_get_elem(servers, i);
+        const char *address;
+        if (!config_setting_lookup_string(setting, "SERVER", &address)) {
+            logger(PARSER, "OpenRGB server #%d needs SERVER address!\n", i + 1);
+            return -1;
+        }
+        OPENRGB_SERVERS[i].address = strdup(address);
+        OPENRGB_SERVERS[i].port = 6742;
+        config_setting_lookup_int(setting, "PORT", &OPENRGB_SERVERS[i].port);
+    }
+    OPENRGB_SERVERS_COUNT = count;
+    return 0;
+}
+
 uint8_t parse_config(const char *config_file) {
     config_t cfg;
     config_init(&cfg);
@@ -37,22 +187,161 @@ uint8_t parse_config(const char *config_file) {
         PI_PORT[strlen(port)] = 0;
     }
 
-    if (!config_lookup_int(&cfg, "RED_PIN", &RED_PIN)) {
-        logger(PARSER, "Missing RED_PIN in config file!\n");
-        config_destroy(&cfg);
-        exit(EXIT_FAILURE);
+    const config_setting_t *outputs = config_lookup(&cfg, "OUTPUTS");
+    if (outputs) {
+        if (parse_outputs(outputs) != 0) {
+            config_destroy(&cfg);
+            exit(EXIT_FAILURE);
+        }
+        // first output is the primary one, reported to clients and OpenRGB
+        RED_PIN = STRIPS[0].pins[0];
+        GREEN_PIN = STRIPS[0].pins[1];
+        BLUE_PIN = STRIPS[0].pins[2];
+    } else if (config_lookup_int(&cfg, "PIXELS", &STRIPS[0].pixels) && STRIPS[0].pixels > 0) {
+        // single addressable strip
+        STRIPS[0] = (struct strip_config){strdup("default"), {-1, -1, -1, -1}, 0, 0, STRIPS[0].pixels};
+        STRIPS_COUNT = 1;
+    } else {
+        // single strip configured with plain RED_PIN/GREEN_PIN/BLUE_PIN keys
+        if (!config_lookup_int(&cfg, "RED_PIN", &RED_PIN)) {
+            logger(PARSER, "Missing RED_PIN in config file!\n");
+            config_destroy(&cfg);
+            exit(EXIT_FAILURE);
+        }
+
+        if (!config_lookup_int(&cfg, "GREEN_PIN", &GREEN_PIN)) {
+            logger(PARSER, "Missing GREEN_PIN in config file!\n");
+            config_destroy(&cfg);
+            exit(EXIT_FAILURE);
+        }
+        if (!config_lookup_int(&cfg, "BLUE_PIN", &BLUE_PIN)) {
+            logger(PARSER, "Missing BLUE_PIN in config file!\n");
+            config_destroy(&cfg);
+            exit(EXIT_FAILURE);
+        }
+        STRIPS[0] = (struct strip_config){strdup("default"), {RED_PIN, GREEN_PIN, BLUE_PIN, -1}, 0, 0, 0};
+        config_lookup_int(&cfg, "WHITE_PIN", &STRIPS[0].pins[3]);
+        STRIPS_COUNT = 1;
     }
 
-    if (!config_lookup_int(&cfg, "GREEN_PIN", &GREEN_PIN)) {
-        logger(PARSER, "Missing GREEN_PIN in config file!\n");
-        config_destroy(&cfg);
-        exit(EXIT_FAILURE);
+    const char *backend;
+    if (!config_lookup_string(&cfg, "OUTPUT_BACKEND", &backend)) {
+        logger(PARSER, "Missing OUTPUT_BACKEND in config file, using default (pigpiod)\n");
+        OUTPUT_BACKEND = NULL;
+    } else {
+        OUTPUT_BACKEND = malloc(strlen(backend) + 1);
+        strncpy(OUTPUT_BACKEND, backend, strlen(backend));
+        OUTPUT_BACKEND[strlen(backend)] = 0;
+    }
+
+    if (!config_lookup_int(&cfg, "SYSFS_PWM_CHIP", &SYSFS_PWM_CHIP)) {
+        SYSFS_PWM_CHIP = 0;
+    }
+    if (!config_lookup_int(&cfg, "SYSFS_PWM_PERIOD", &SYSFS_PWM_PERIOD)) {
+        SYSFS_PWM_PERIOD = 1000000;
+    }
+
+    const char *mock_file;
+    if (!config_lookup_string(&cfg, "MOCK_OUTPUT_FILE", &mock_file)) {
+        MOCK_OUTPUT_FILE = NULL;
+    } else {
+        MOCK_OUTPUT_FILE = malloc(strlen(mock_file) + 1);
+        strncpy(MOCK_OUTPUT_FILE, mock_file, strlen(mock_file));
+        MOCK_OUTPUT_FILE[strlen(mock_file)] = 0;
+    }
+
+    const char *spi_device;
+    if (!config_lookup_string(&cfg, "SPI_DEVICE", &spi_device)) {
+        SPI_DEVICE = NULL;
+    } else {
+        SPI_DEVICE = malloc(strlen(spi_device) + 1);
+        strncpy(SPI_DEVICE, spi_device, strlen(spi_device));
+        SPI_DEVICE[strlen(spi_device)] = 0;
+    }
+
+    const char *spi_led_type;
+    if (!config_lookup_string(&cfg, "SPI_LED_TYPE", &spi_led_type)) {
+        SPI_LED_TYPE = NULL;
+    } else {
+        SPI_LED_TYPE = malloc(strlen(spi_led_type) + 1);
+        strncpy(SPI_LED_TYPE, spi_led_type, strlen(spi_led_type));
+        SPI_LED_TYPE[strlen(spi_led_type)] = 0;
+    }
+
+    const char *plugin_dir;
+    if (!config_lookup_string(&cfg, "PLUGIN_DIR", &plugin_dir)) {
+        PLUGIN_DIR = NULL;
+    } else {
+        PLUGIN_DIR = malloc(strlen(plugin_dir) + 1);
+        strncpy(PLUGIN_DIR, plugin_dir, strlen(plugin_dir));
+        PLUGIN_DIR[strlen(plugin_dir)] = 0;
+    }
+
+    const char *audio_source;
+    if (!config_lookup_string(&cfg, "AUDIO_SOURCE", &audio_source)) {
+        AUDIO_SOURCE = NULL;
+    } else {
+        AUDIO_SOURCE = malloc(strlen(audio_source) + 1);
+        strncpy(AUDIO_SOURCE, audio_source, strlen(audio_source));
+        AUDIO_SOURCE[strlen(audio_source)] = 0;
+    }
+    if (!config_lookup_int(&cfg, "AUDIO_RATE", &AUDIO_RATE)) {
+        AUDIO_RATE = 44100;
     }
-    if (!config_lookup_int(&cfg, "BLUE_PIN", &BLUE_PIN)) {
-        logger(PARSER, "Missing BLUE_PIN in config file!\n");
+    if (!config_lookup_int(&cfg, "AUDIO_CHANNELS", &AUDIO_CHANNELS)) {
+        AUDIO_CHANNELS = 2;
+    }
+
+    const char *scene_file;
+    if (!config_lookup_string(&cfg, "SCENE_FILE", &scene_file)) {
+        scene_file = "/etc/piled/scenes";
+    }
+    SCENE_FILE = strdup(scene_file);
+
+    const char *state_file;
+    if (!config_lookup_string(&cfg, "STATE_FILE", &state_file)) {
+        state_file = "/etc/piled/state";
+    }
+    STATE_FILE = strdup(state_file);
+
+    if (!config_lookup_int(&cfg, "PWM_RANGE", &PWM_RANGE)) {
+        PWM_RANGE = 255;
+    } else if (PWM_RANGE < 25 || PWM_RANGE > 40000) {
+        logger(PARSER, "PWM_RANGE must be between 25 and 40000, using default (255)\n");
+        PWM_RANGE = 255;
+    }
+    if (!config_lookup_int(&cfg, "PWM_FREQUENCY", &PWM_FREQUENCY)) {
+        PWM_FREQUENCY = 0;
+    }
+    if (!config_lookup_float(&cfg, "GAMMA", &GAMMA)) {
+        GAMMA = 1.0;
+    }
+    BRIGHTNESS = lookup_level(&cfg, "BRIGHTNESS");
+    WHITE_BALANCE_RED = lookup_level(&cfg, "WHITE_BALANCE_RED");
+    WHITE_BALANCE_GREEN = lookup_level(&cfg, "WHITE_BALANCE_GREEN");
+    WHITE_BALANCE_BLUE = lookup_level(&cfg, "WHITE_BALANCE_BLUE");
+    if (!config_lookup_int(&cfg, "TRANSITION_RATE", &TRANSITION_RATE) || TRANSITION_RATE <= 0) {
+        TRANSITION_RATE = 100;
+    }
+    if (!config_lookup_bool(&cfg, "DITHERING", &DITHERING)) {
+        DITHERING = 0;
+    }
+    if (!config_lookup_int(&cfg, "DITHER_RATE", &DITHER_RATE) || DITHER_RATE <= 0) {
+        DITHER_RATE = 200;
+    }
+    if (!config_lookup_bool(&cfg, "HARDWARE_ANIMATIONS", &HARDWARE_ANIMATIONS)) {
+        HARDWARE_ANIMATIONS = 0;
+    }
+    if (!config_lookup_bool(&cfg, "OPENRGB_SPATIAL", &OPENRGB_SPATIAL)) {
+        OPENRGB_SPATIAL = 0;
+    }
+
+    const config_setting_t *schedule = config_lookup(&cfg, "SCHEDULE");
+    if (schedule && parse_schedule(schedule) != 0) {
         config_destroy(&cfg);
         exit(EXIT_FAILURE);
     }
+
     const char *secret;
     if (!config_lookup_string(&cfg, "SHARED_SECRET", &secret)) {
         logger(PARSER, "Missing SHARED_SECRET in config file\n");
@@ -63,25 +352,54 @@ uint8_t parse_config(const char *config_file) {
     strncpy(SHARED_SECRET, secret, strlen(secret));
     SHARED_SECRET[strlen(secret)] = 0;
 #endif
+    const config_setting_t *openrgb_servers = config_lookup(&cfg, "OPENRGB_SERVERS");
     const char *openrgb_addr;
-    if (!config_lookup_string(&cfg, "OPENRGB_SERVER", &openrgb_addr)) {
-        logger(PARSER, "Missing OPENRGB_SERVER in config file\n");
-        OPENRGB_SERVER = NULL;
+    if (openrgb_servers) {
+        if (parse_openrgb_servers(openrgb_servers) != 0) {
+            config_destroy(&cfg);
+            exit(EXIT_FAILURE);
+        }
+    } else if (!config_lookup_string(&cfg, "OPENRGB_SERVER", &openrgb_addr)) {
+        logger(PARSER, "Missing OPENRGB_SERVERS in config file\n");
+        OPENRGB_SERVERS_COUNT = 0;
     } else {
-        OPENRGB_SERVER = malloc(strlen(openrgb_addr) + 1);
-        strncpy(OPENRGB_SERVER, openrgb_addr, strlen(openrgb_addr));
-        OPENRGB_SERVER[strlen(openrgb_addr)] = 0;
+        // single server of older configs
+        OPENRGB_SERVERS[0].address = strdup(openrgb_addr);
+        if (!config_lookup_int(&cfg, "OPENRGB_PORT", &OPENRGB_SERVERS[0].port)) {
+            logger(PARSER, "Missing OPENRGB_PORT in config file, using default 6742\n");
+            OPENRGB_SERVERS[0].port = 6742;
+        }
+        OPENRGB_SERVERS_COUNT = 1;
     }
-
-    if (!config_lookup_int(&cfg, "OPENRGB_PORT", &OPENRGB_PORT)) {
-        logger(PARSER, "Missing OPENRGB_PORT in config file, using default 6742\n");
-        OPENRGB_PORT = 6742;
+    if (!config_lookup_int(&cfg, "OPENRGB_RECONNECT_MAX", &OPENRGB_RECONNECT_MAX)) {
+        OPENRGB_RECONNECT_MAX = 10000;
+    } else if (OPENRGB_RECONNECT_MAX < OPENRGB_RECONNECT_MIN_MS) {
+        logger(PARSER, "OPENRGB_RECONNECT_MAX must be at least %d ms, using %d\n", OPENRGB_RECONNECT_MIN_MS,
+               OPENRGB_RECONNECT_MIN_MS);
+        OPENRGB_RECONNECT_MAX = OPENRGB_RECONNECT_MIN_MS;
     }
 #ifndef ORGBCONFIGURATOR
     logger(PARSER,
            "Passed config:\nRaspberry Pi address: %s\nPort: %s\nRed pin: %d\nGreen pin: %d\nBlue pin: %d\nShared "
-           "secret: %s\nOpenRGB server: %s\nOpenRGB Port: %d\n",
-           PI_ADDR, PI_PORT, RED_PIN, GREEN_PIN, BLUE_PIN, SHARED_SECRET, OPENRGB_SERVER, OPENRGB_PORT);
+           "secret: %s\nOpenRGB servers: %d\nOutput backend: %s\nOutputs: %d\n",
+           PI_ADDR, PI_PORT, RED_PIN, GREEN_PIN, BLUE_PIN, SHARED_SECRET, OPENRGB_SERVERS_COUNT,
+           OUTPUT_BACKEND ? OUTPUT_BACKEND : "pigpiod", STRIPS_COUNT);
+    for (int i = 0; i < OPENRGB_SERVERS_COUNT; i++) {
+        logger(PARSER, "OpenRGB server #%d: %s:%d", i + 1, OPENRGB_SERVERS[i].address, OPENRGB_SERVERS[i].port);
+    }
+    for (int i = 0; i < STRIPS_COUNT; i++) {
+        if (STRIPS[i].pixels) {
+            logger(PARSER, "Output #%d \"%s\": pixels %d-%d", i + 1, STRIPS[i].name, STRIPS[i].first_pixel,
+                   STRIPS[i].first_pixel + STRIPS[i].pixels - 1);
+            continue;
+        }
+        logger(PARSER, "Output #%d \"%s\": pins %d %d %d, white pin %d", i + 1, STRIPS[i].name, STRIPS[i].pins[0],
+               STRIPS[i].pins[1], STRIPS[i].pins[2], STRIPS[i].pins[3]);
+    }
+    for (int i = 0; i < SCHEDULE_COUNT; i++) {
+        logger(PARSER, "Schedule #%d: %s at %02d:%02d:%02d, target %d", i + 1, SCHEDULE[i].action,
+               SCHEDULE[i].time / 3600, SCHEDULE[i].time / 60 % 60, SCHEDULE[i].time % 60, SCHEDULE[i].target);
+    }
 #endif
     config_destroy(&cfg);
     return 0;
@@ -97,9 +415,10 @@ void parse_args(int argc, char *argv[]) {
                                            {"SHARED_SECRET", required_argument, 0, 'S'},
                                            {"OPENRGB_SERVER", required_argument, 0, 'O'},
                                            {"OPENRGB_PORT", required_argument, 0, 'P'},
+                                           {"OUTPUT_BACKEND", required_argument, 0, 'b'},
                                            {0, 0, 0, 0}};
 
-    while ((opt = getopt_long(argc, argv, "c:s:p:R:G:B:S:O:P:", long_options, NULL)) != -1) {
+    while ((opt = getopt_long(argc, argv, "c:s:p:R:G:B:S:O:P:b:", long_options, NULL)) != -1) {
         switch (opt) {
         case 's':
             snprintf(PI_ADDR, sizeof(PI_ADDR), "%s", optarg);
@@ -111,14 +430,17 @@ void parse_args(int argc, char *argv[]) {
             break;
         case 'R':
             RED_PIN = atoi(optarg);
+            STRIPS[0].pins[0] = RED_PIN;
             logger(PARSER, "Red pin set to: %d", RED_PIN);
             break;
         case 'G':
             GREEN_PIN = atoi(optarg);
+            STRIPS[0].pins[1] = GREEN_PIN;
             logger(PARSER, "Green pin set to: %d", GREEN_PIN);
             break;
         case 'B':
             BLUE_PIN = atoi(optarg);
+            STRIPS[0].pins[2] = BLUE_PIN;
             logger(PARSER, "Blue pin set to: %d", BLUE_PIN);
             break;
         case 'S':
@@ -126,13 +448,24 @@ void parse_args(int argc, char *argv[]) {
             logger(PARSER, "Shared secret set to: %s", SHARED_SECRET);
             break;
         case 'O': {
-            snprintf(OPENRGB_SERVER, sizeof(OPENRGB_SERVER), "%s", optarg);
-            logger(PARSER, "OpenRGB server address set to: %s", OPENRGB_SERVER);
+            // replaces servers of the config with this one
+            for (int i = 0; i < OPENRGB_SERVERS_COUNT; i++) {
+                free(OPENRGB_SERVERS[i].address);
+            }
+            OPENRGB_SERVERS[0].address = strdup(optarg);
+            OPENRGB_SERVERS_COUNT = 1;
+            logger(PARSER, "OpenRGB server address set to: %s", OPENRGB_SERVERS[0].address);
             break;
         }
         case 'P': {
-            OPENRGB_PORT = atoi(optarg);
-            logger(PARSER, "OpenRGB Server port set to: %d", OPENRGB_PORT);
+            OPENRGB_SERVERS[0].port = atoi(optarg);
+            logger(PARSER, "OpenRGB Server port set to: %d", OPENRGB_SERVERS[0].port);
+            break;
+        }
+        case 'b': {
+            free(OUTPUT_BACKEND);
+            OUTPUT_BACKEND = strdup(optarg);
+            logger(PARSER, "Output backend set to: %s", OUTPUT_BACKEND);
             break;
         }
         default:
@@ -1,4 +1,8 @@
 #include "parser.h"
+#include "../rgb/effects.h"
+#include "../rgb/plugins.h"
+#include "../rgb/scenes.h"
+#include "../rgb/scheduler.h"
 #include "../utils/utils.h"
 #include <libconfig.h>
 #include <openssl/hmac.h>
@@ -8,9 +12,10 @@
 #include <sys/types.h>
 #include <time.h>
 
-struct parse_result parse_payload(unsigned char *buffer, const uint8_t version, unsigned char *PARSED_HMAC) {
+struct parse_result parse_payload(unsigned char *buffer, const uint8_t version, unsigned char *PARSED_HMAC,
+                                  const unsigned char *data, uint8_t data_size) {
     // PAYLOAD
-    uint8_t RED = 0, GREEN = 0, BLUE = 0, duration = 0, speed = 0;
+    uint8_t RED = 0, GREEN = 0, BLUE = 0, duration = 0, speed = 0, target = TARGET_ALL;
 
     struct section_sizes sizes = get_section_sizes(version);
     uint8_t payload_offset = sizes.header_size + 32;
@@ -26,14 +31,20 @@ struct parse_result parse_payload(unsigned char *buffer, const uint8_t version,
         speed |= buffer[payload_offset + 4] & 0xFF;
         logger_debug(PARSER, "parse_message: Version: %d, got speed: %d", version, speed);
     }
+    if (version >= 5) {
+        target |= buffer[payload_offset + 5] & 0xFF;
+        logger_debug(PARSER, "parse_message: Version: %d, got target: %d", version, target);
+    }
 
     logger_debug(PARSER, "parse_message: Color: R: 0x%x, G: 0x%x, B: 0x%x", RED, GREEN, BLUE);
-    const int HMAC_DATA_SIZE = sizes.header_size + sizes.payload_size;
+    const int HMAC_DATA_SIZE = sizes.header_size + sizes.payload_size + data_size;
     logger_debug(PARSER, "parse_message: data for hmac size: %d; payload size: %d", HMAC_DATA_SIZE, sizes.payload_size);
     unsigned char HMAC_DATA[HMAC_DATA_SIZE];
     memset(HMAC_DATA, 0, HMAC_DATA_SIZE);
     memcpy(HMAC_DATA, buffer, sizes.header_size);                                       // HEADER
     memcpy(&HMAC_DATA[sizes.header_size], &buffer[payload_offset], sizes.payload_size); // PAYLOAD
+    if (data_size)
+        memcpy(&HMAC_DATA[sizes.header_size + sizes.payload_size], data, data_size); // DATA after PAYLOAD
 
 #ifdef DEBUG
     logger_debug(PARSER, "parse_message: HEADER + PAYLOAD:");
@@ -78,10 +89,11 @@ struct parse_result parse_payload(unsigned char *buffer, const uint8_t version,
     res.BLUE = BLUE;
     res.duration = duration;
     res.speed = speed;
+    res.target = target;
     return res;
 }
 
-struct parse_result parse_message(unsigned char buffer[BUFFER_SIZE]) {
+struct parse_result parse_message(unsigned char buffer[BUFFER_SIZE], const unsigned char *data, uint8_t data_size) {
 #ifdef DEBUG
     logger_debug(PARSER, "parse_message: received buffer: ");
     for (int i = 0; i < BUFFER_SIZE; i++) {
@@ -159,7 +171,7 @@ struct parse_result parse_message(unsigned char buffer[BUFFER_SIZE]) {
     switch (OP) {
     case LED_SET_COLOR: { // SET COLOR
         logger_debug(PARSER, "parse_message: Operational code is 0, setting color");
-        result = parse_payload(buffer, version, PARSED_HMAC);
+        result = parse_payload(buffer, version, PARSED_HMAC, NULL, 0);
         result.OP = LED_SET_COLOR;
         break;
     };
@@ -169,32 +181,82 @@ struct parse_result parse_message(unsigned char buffer[BUFFER_SIZE]) {
         result.result = 0;
         result.OP = LED_GET_CURRENT_COLOR;
         result.version = 3; // minimal for this OP; change logic in future?
+        result.target = TARGET_ALL;
         break;
     }
-    case ANIM_SET_FADE: {
-        logger_debug(PARSER, "parse_message: OP code is ANIM_SET_FADE, starting FADE animation");
-        result = parse_payload(buffer, version, PARSED_HMAC);
-        result.OP = ANIM_SET_FADE;
-        result.version = 4;
+    case LED_SET_OVERLAY: {
+        logger_debug(PARSER, "parse_message: OP code is LED_SET_OVERLAY, setting overlay");
+        result = parse_payload(buffer, version, PARSED_HMAC, NULL, 0);
+        result.OP = LED_SET_OVERLAY;
+        result.version = version >= 5 ? 5 : 4;
         break;
     }
-    case ANIM_SET_PULSE: {
-        logger_debug(PARSER, "parse_message: OP code is ANIM_SET_PULSE, setting PULSE animation");
-        result = parse_payload(buffer, version, PARSED_HMAC);
-        result.OP = ANIM_SET_PULSE;
-        result.version = 4;
+    case ANIM_RUN_PROGRAM: {
+        // program follows the payload, its length is in Duration field
+        logger_debug(PARSER, "parse_message: OP code is ANIM_RUN_PROGRAM, %d bytes of program", data_size);
+        if (version < 5 || data_size != buffer[PAYLOAD_OFFSET + 3]) {
+            logger_debug(PARSER, "parse_message: Program is missing or has wrong length, aborting!");
+            result.result = 1;
+            break;
+        }
+        result = parse_payload(buffer, version, PARSED_HMAC, data, data_size);
+        result.OP = ANIM_RUN_PROGRAM;
+        break;
+    }
+    case SYS_SCHEDULE: {
+        // time, repeat, ramp and action of the command follow the payload
+        logger_debug(PARSER, "parse_message: OP code is SYS_SCHEDULE.");
+        if (version < 5 || data_size != SCHEDULE_DATA_SIZE) {
+            logger_debug(PARSER, "parse_message: Schedule data is missing, aborting!");
+            result.result = 1;
+            break;
+        }
+        result = parse_payload(buffer, version, PARSED_HMAC, data, data_size);
+        result.OP = SYS_SCHEDULE;
+        break;
+    }
+    case SCENE_SAVE:
+    case SCENE_DELETE:
+    case SCENE_RECALL: {
+        // ID of the scene follows the payload, and OP and name of the saved command for SCENE_SAVE
+        logger_debug(PARSER, "parse_message: OP code is %d, scene OP.", OP);
+        if (version < 5 || data_size != (OP == SCENE_SAVE ? SCENE_SAVE_DATA_SIZE : SCENE_ID_DATA_SIZE)) {
+            logger_debug(PARSER, "parse_message: Scene data is missing, aborting!");
+            result.result = 1;
+            break;
+        }
+        result = parse_payload(buffer, version, PARSED_HMAC, data, data_size);
+        result.OP = OP;
+        break;
+    }
+    case ANIM_AUDIO: {
+        logger_debug(PARSER, "parse_message: OP code is ANIM_AUDIO, starting audio effect");
+        result = parse_payload(buffer, version, PARSED_HMAC, NULL, 0);
+        result.OP = ANIM_AUDIO;
+        result.version = version >= 5 ? 5 : 4;
         break;
     }
     case SYS_TOGGLE_SUSPEND: {
         logger_debug(PARSER, "parse_message: OP code is SYS_TOGGLE_SUSPEND.");
-        result = parse_payload(buffer, version, PARSED_HMAC);
+        result = parse_payload(buffer, version, PARSED_HMAC, NULL, 0);
         result.OP = SYS_TOGGLE_SUSPEND;
-        result.version = 4;
+        result.version = version >= 5 ? 5 : 4;
         break;
     }
     default: {
-        logger_debug(PARSER, "parse_message: Unknown OP (%d), aborting!", OP);
-        result.result = 1;
+        // ANIM_SET_FADE, ANIM_SET_PULSE, other effects and plugins
+        const struct effect *effect = effect_by_op(OP);
+        const struct piled_plugin *plugin = plugin_by_op(OP);
+        if (effect == NULL && plugin == NULL) {
+            logger_debug(PARSER, "parse_message: Unknown OP (%d), aborting!", OP);
+            result.result = 1;
+            break;
+        }
+        logger_debug(PARSER, "parse_message: OP code is %d, starting %s effect", OP,
+                     effect ? effect->name : plugin->name);
+        result = parse_payload(buffer, version, PARSED_HMAC, NULL, 0);
+        result.OP = OP;
+        result.version = version >= 5 ? 5 : 4;
         break;
     }
     }
@@ -220,26 +282,30 @@ int count_valid_lines(const char *config_file) {
     return count;
 }
 
-void parse_openrgb_config_devices(const char *config_file) {
+int32_t parse_openrgb_config_devices(const char *config_file, struct openrgb_device **devices) {
     int device_count = count_valid_lines(config_file);
+    *devices = NULL;
     if (device_count <= 0) {
-        logger(PARSER, "No valid OpenRGB devices found in the config file. Re/Create OpenRGB config using "
-                       "openrgb_configurator!\n");
-        return;
+        logger(PARSER, "No valid OpenRGB devices found in %s. Re/Create OpenRGB config using openrgb_configurator!\n",
+               config_file);
+        return 0;
     }
-    openrgb_using_devices_num = device_count;
 
-    openrgb_devices_to_change = malloc(sizeof(struct openrgb_device) * device_count);
+    *devices = malloc(sizeof(struct openrgb_device) * device_count);
 
     FILE *file = fopen(config_file, "r");
-    if (file == NULL) {
+    if (file == NULL || *devices == NULL) {
         logger(PARSER, "Failed to open config file %s", config_file);
-        return;
+        if (file)
+            fclose(file);
+        free(*devices);
+        *devices = NULL;
+        return 0;
     }
 
     uint8_t line[256];
-    uint8_t device = 0;
-    while (fgets((char *)line, sizeof(line), file) != NULL) {
+    int32_t device = 0;
+    while (device < device_count && fgets((char *)line, sizeof(line), file) != NULL) {
         if (line[0] != '#') {
             continue;
         }
@@ -264,12 +330,14 @@ void parse_openrgb_config_devices(const char *config_file) {
         uint8_t *newline = (uint8_t *)strchr((char *)name, '\n');
         if (newline != NULL)
             *newline = '\0';
-        openrgb_devices_to_change[device].device_id = number;
-        openrgb_devices_to_change[device].name = malloc(strlen((char *)name) + 1);
-        strcpy((char *)openrgb_devices_to_change[device++].name, (char *)name);
+        (*devices)[device].device_id = number;
+        (*devices)[device].config_index = number;
+        (*devices)[device].name = malloc(strlen((char *)name) + 1);
+        strcpy((char *)(*devices)[device++].name, (char *)name);
     }
 
     fclose(file);
+    return device;
 }
 
 struct section_sizes get_section_sizes(uint8_t version) {
@@ -290,10 +358,17 @@ struct section_sizes get_section_sizes(uint8_t version) {
     case 3: { // OP added
         result.header_size = 18;
         result.payload_size = 4;
+        break;
     }
     case 4: { // Speed added to PAYLOAD
         result.header_size = 18;
         result.payload_size = 5;
+        break;
+    }
+    case 5: { // Target added to PAYLOAD
+        result.header_size = 18;
+        result.payload_size = 6;
+        break;
     }
     }
     return result;
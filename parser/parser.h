@@ -12,7 +12,8 @@ struct parse_result {
     uint8_t BLUE;
     uint8_t duration;
     uint8_t OP;    // OPerational code
-    uint8_t speed; // for animations
+    uint8_t speed;  // for animations
+    uint8_t target; // v5: strip or group the command applies to, TARGET_ALL for older versions
 };
 
 struct section_sizes {
@@ -20,9 +21,11 @@ struct section_sizes {
     unsigned short payload_size;
 };
 
-struct parse_result parse_message(unsigned char buffer[BUFFER_SIZE]);
+// `data` follows the payload in some packets (ANIM_RUN_PROGRAM, SYS_SCHEDULE) and is covered by HMAC, NULL if none
+struct parse_result parse_message(unsigned char buffer[BUFFER_SIZE], const unsigned char *data, uint8_t data_size);
 
-void parse_openrgb_config_devices(const char *config_file);
+// reads devices picked by openrgb_configurator to `devices`, returns their number
+int32_t parse_openrgb_config_devices(const char *config_file, struct openrgb_device **devices);
 struct section_sizes get_section_sizes(uint8_t version);
 
 #endif // PARSER_H
\ No newline at end of file
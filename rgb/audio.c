@@ -0,0 +1,412 @@
+#include "audio.h"
+#include "../globals/globals.h"
+#include "color.h"
+#include "engine.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <poll.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define AUDIO_SIMD
+typedef float32x4_t vfloat;
+#define VLOAD vld1q_f32
+#define VSTORE vst1q_f32
+#define VADD vaddq_f32
+#define VSUB vsubq_f32
+#define VMUL vmulq_f32
+#elif defined(__SSE__)
+#include <xmmintrin.h>
+#define AUDIO_SIMD
+typedef __m128 vfloat;
+#define VLOAD _mm_loadu_ps
+#define VSTORE _mm_storeu_ps
+#define VADD _mm_add_ps
+#define VSUB _mm_sub_ps
+#define VMUL _mm_mul_ps
+#endif
+
+// Real FFT of AUDIO_FFT_SIZE samples is done as complex FFT of half the size: even samples go to real parts,
+// odd ones to imaginary, and the spectrum is split afterwards. Arrays are kept apart (not interleaved complex
+// numbers), so a butterfly stage is plain vector arithmetic over 4 butterflies at a time.
+#define FFT_POINTS (AUDIO_FFT_SIZE / 2)
+
+#define AUDIO_NOISE_FLOOR 1.0f   // band amplitude treated as silence, ~50 dB under a full scale sine
+#define AUDIO_PEAK_DECAY 0.998f  // automatic gain follows quieter music within a few seconds
+#define AUDIO_LEVEL_RELEASE 0.9f // levels rise at once and fall by this per analysis
+static const float band_edges_hz[AUDIO_BANDS + 1] = {30, 250, 2000, 10000};
+
+static float window[AUDIO_FFT_SIZE]; // Hann
+static uint16_t bit_reverse[FFT_POINTS];
+static float twiddle_re[FFT_POINTS]; // stage with butterflies of span m uses m entries from m - 1
+static float twiddle_im[FFT_POINTS];
+static float split_re[FFT_POINTS]; // e^(-2 pi i k / AUDIO_FFT_SIZE), splits the spectrum of the real signal
+static float split_im[FFT_POINTS];
+
+struct audio_format {
+    uint32_t rate;
+    uint16_t channels;
+};
+
+// analysis results, written by the audio thread and read by the render engine
+static pthread_mutex_t levels_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct audio_levels {
+    uint32_t sequence; // changes with every analysis
+    uint64_t analyzed_us;
+    int32_t level_q16[AUDIO_BANDS]; // 0 - 1.0 in 16.16 fixed point
+} published;
+
+static pthread_mutex_t audio_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t audio_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t audio_thread;
+static uint8_t audio_running = 0;
+static uint8_t source_ended = 0; // file was played to its end, played again when the effect is started again
+static int wake_pipe[2] = {-1, -1};
+
+// statistics: analyses are counted by the audio thread, latencies by the render engine
+static uint64_t analyses, analysis_total_us, analysis_max_us;
+static uint32_t rendered_sequence;
+static uint64_t latencies, latency_total_us, latency_max_us;
+
+static void fft_init() {
+    int bits = 0;
+    while ((1 << bits) < FFT_POINTS)
+        bits++;
+    for (int i = 0; i < FFT_POINTS; i++) {
+        int reversed = 0;
+        for (int bit = 0; bit < bits; bit++) {
+            reversed |= ((i >> bit) & 1) << (bits - 1 - bit);
+        }
+        bit_reverse[i] = reversed;
+    }
+    for (int m = 1; m < FFT_POINTS; m <<= 1) {
+        for (int k = 0; k < m; k++) {
+            twiddle_re[m - 1 + k] = cosf(M_PI * k / m);
+            twiddle_im[m - 1 + k] = -sinf(M_PI * k / m);
+        }
+    }
+    for (int k = 0; k < FFT_POINTS; k++) {
+        split_re[k] = cosf(2 * M_PI * k / AUDIO_FFT_SIZE);
+        split_im[k] = -sinf(2 * M_PI * k / AUDIO_FFT_SIZE);
+    }
+    for (int i = 0; i < AUDIO_FFT_SIZE; i++) {
+        window[i] = 0.5f - 0.5f * cosf(2 * M_PI * i / AUDIO_FFT_SIZE);
+    }
+}
+
+// in-place radix-2 FFT of FFT_POINTS points given in bit-reversed order
+static void fft(float *re, float *im) {
+    for (int m = 1; m < FFT_POINTS; m <<= 1) {
+        const float *wr = &twiddle_re[m - 1];
+        const float *wi = &twiddle_im[m - 1];
+        for (int start = 0; start < FFT_POINTS; start += 2 * m) {
+            float *ar = re + start, *ai = im + start;
+            float *br = ar + m, *bi = ai + m;
+            int k = 0;
+#ifdef AUDIO_SIMD
+            for (; k + 4 <= m; k += 4) {
+                vfloat xr = VLOAD(br + k), xi = VLOAD(bi + k);
+                vfloat cr = VLOAD(wr + k), ci = VLOAD(wi + k);
+                vfloat tr = VSUB(VMUL(xr, cr), VMUL(xi, ci));
+                vfloat ti = VADD(VMUL(xr, ci), VMUL(xi, cr));
+                vfloat yr = VLOAD(ar + k), yi = VLOAD(ai + k);
+                VSTORE(br + k, VSUB(yr, tr));
+                VSTORE(bi + k, VSUB(yi, ti));
+                VSTORE(ar + k, VADD(yr, tr));
+                VSTORE(ai + k, VADD(yi, ti));
+            }
+#endif
+            for (; k < m; k++) {
+                float tr = br[k] * wr[k] - bi[k] * wi[k];
+                float ti = br[k] * wi[k] + bi[k] * wr[k];
+                br[k] = ar[k] - tr;
+                bi[k] = ai[k] - ti;
+                ar[k] += tr;
+                ai[k] += ti;
+            }
+        }
+    }
+}
+
+// power of every band in the spectrum of `samples`
+static void analyze(const float samples[AUDIO_FFT_SIZE], const int band_bins[AUDIO_BANDS + 1],
+                    float power[AUDIO_BANDS]) {
+    static float re[FFT_POINTS], im[FFT_POINTS]; // audio thread only
+    for (int n = 0; n < FFT_POINTS; n++) {
+        re[bit_reverse[n]] = samples[2 * n] * window[2 * n];
+        im[bit_reverse[n]] = samples[2 * n + 1] * window[2 * n + 1];
+    }
+    fft(re, im);
+
+    // X[k] = E[k] + W^k * O[k], spectra of even and odd samples are
+    // E[k] = (Z[k] + conj(Z[M - k])) / 2 and O[k] = (Z[k] - conj(Z[M - k])) / 2i
+    for (int band = 0; band < AUDIO_BANDS; band++) {
+        power[band] = 0;
+        for (int k = band_bins[band]; k < band_bins[band + 1]; k++) {
+            int j = FFT_POINTS - k;
+            float even_re = (re[k] + re[j]) / 2, even_im = (im[k] - im[j]) / 2;
+            float odd_re = (im[k] + im[j]) / 2, odd_im = (re[j] - re[k]) / 2;
+            float x_re = even_re + split_re[k] * odd_re - split_im[k] * odd_im;
+            float x_im = even_im + split_re[k] * odd_im + split_im[k] * odd_re;
+            power[band] += x_re * x_re + x_im * x_im;
+        }
+    }
+}
+
+static uint16_t le16(const uint8_t *bytes) { return bytes[0] | bytes[1] << 8; }
+static uint32_t le32(const uint8_t *bytes) { return le16(bytes) | (uint32_t)le16(bytes + 2) << 16; }
+
+// takes format from WAV header and skips to samples. Returns 1 if file isn't WAV, -1 if it's not 16-bit PCM.
+static int read_wav_header(int fd, struct audio_format *format) {
+    uint8_t header[12], chunk[8], fmt[16];
+    if (read(fd, header, sizeof(header)) != sizeof(header) || memcmp(header, "RIFF", 4) != 0 ||
+        memcmp(header + 8, "WAVE", 4) != 0)
+        return 1;
+    while (read(fd, chunk, sizeof(chunk)) == sizeof(chunk)) {
+        uint32_t size = le32(chunk + 4);
+        if (memcmp(chunk, "data", 4) == 0)
+            return 0;
+        if (memcmp(chunk, "fmt ", 4) == 0 && size >= sizeof(fmt)) {
+            if (read(fd, fmt, sizeof(fmt)) != sizeof(fmt) || le16(fmt) != 1 || le16(fmt + 14) != 16)
+                return -1;
+            format->channels = le16(fmt + 2);
+            format->rate = le32(fmt + 4);
+            size -= sizeof(fmt);
+        }
+        lseek(fd, size + (size & 1), SEEK_CUR); // chunks are padded to even size
+    }
+    return -1;
+}
+
+// waits for readable fd, or until deadline if fd is -1. Returns -1 when audio is stopped.
+static int wait_for(int fd, uint64_t deadline_us) {
+    struct pollfd fds[2] = {{wake_pipe[0], POLLIN, 0}, {fd, POLLIN, 0}};
+    while (1) {
+        int timeout_ms = -1;
+        if (fd < 0) {
+            uint64_t now_us = get_time_us();
+            if (now_us >= deadline_us)
+                return 0;
+            timeout_ms = (deadline_us - now_us + 999) / 1000;
+        }
+        int ready = poll(fds, fd < 0 ? 1 : 2, timeout_ms);
+        if (ready > 0 && fds[0].revents)
+            return -1;
+        if (ready > 0 && fds[1].revents)
+            return 0;
+    }
+}
+
+// reads exactly `size` bytes, returns -1 at end of source or when audio is stopped
+static int read_block(int fd, uint8_t *buffer, size_t size) {
+    size_t done = 0;
+    while (done < size) {
+        if (wait_for(fd, 0) != 0)
+            return -1;
+        ssize_t bytes = read(fd, buffer + done, size - done);
+        if (bytes == 0 || (bytes < 0 && errno != EAGAIN && errno != EINTR))
+            return -1;
+        if (bytes > 0)
+            done += bytes;
+    }
+    return 0;
+}
+
+static void log_stats() {
+    if (analyses)
+        logger(ANIM, "Audio: %lu analyses, %lu us average, %lu us max.", analyses, analysis_total_us / analyses,
+               analysis_max_us);
+    if (latencies)
+        logger(ANIM, "Audio: analysis to output %lu us average, %lu us max.", latency_total_us / latencies,
+               latency_max_us);
+}
+
+// plays source until its end, stop or until no strip shows the effect anymore. Returns 1 if source has ended.
+static uint8_t play_source() {
+    int fd = open(AUDIO_SOURCE, O_RDONLY | O_NONBLOCK);
+    if (fd < 0) {
+        logger(ANIM, "Audio: failed to open %s", AUDIO_SOURCE);
+        return 1;
+    }
+    struct stat st;
+    uint8_t is_file = fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+    struct audio_format format = {AUDIO_RATE, AUDIO_CHANNELS};
+    int wav = is_file ? read_wav_header(fd, &format) : 1;
+    if (wav == 1 && is_file)
+        lseek(fd, 0, SEEK_SET); // raw samples
+    if (wav < 0 || format.rate == 0 || format.channels == 0 || format.channels > AUDIO_MAX_CHANNELS) {
+        logger(ANIM, "Audio: %s is not 16-bit PCM with 1-%d channels.", AUDIO_SOURCE, AUDIO_MAX_CHANNELS);
+        close(fd);
+        return 1;
+    }
+    logger(ANIM, "Audio: playing %s, %u Hz, %u channels.", AUDIO_SOURCE, format.rate, format.channels);
+
+    int band_bins[AUDIO_BANDS + 1];
+    for (int band = 0; band <= AUDIO_BANDS; band++) {
+        int bin = band_edges_hz[band] * AUDIO_FFT_SIZE / format.rate;
+        band_bins[band] = bin < 1 ? 1 : bin > FFT_POINTS ? FFT_POINTS : bin;
+    }
+
+    static float samples[AUDIO_FFT_SIZE];
+    static int16_t pcm[AUDIO_HOP * AUDIO_MAX_CHANNELS];
+    float peak[AUDIO_BANDS], level[AUDIO_BANDS] = {0};
+    for (int band = 0; band < AUDIO_BANDS; band++) {
+        peak[band] = AUDIO_NOISE_FLOOR;
+    }
+    memset(samples, 0, sizeof(samples));
+    uint64_t start_us = get_time_us();
+    uint64_t hops = 0;
+    uint8_t ended = 0;
+
+    while (1) {
+        // a file is read as if its samples were arriving in real time
+        if (is_file && wait_for(-1, start_us + (hops + 1) * AUDIO_HOP * 1000000 / format.rate) != 0)
+            break;
+        if (read_block(fd, (uint8_t *)pcm, AUDIO_HOP * format.channels * sizeof(int16_t)) != 0) {
+            ended = is_file || hops == 0; // FIFO is reopened for the next writer, unless it never gave anything
+            break;
+        }
+        uint64_t read_us = get_time_us();
+        hops++;
+
+        memmove(samples, samples + AUDIO_HOP, (AUDIO_FFT_SIZE - AUDIO_HOP) * sizeof(float));
+        for (int i = 0; i < AUDIO_HOP; i++) {
+            int32_t sum = 0;
+            for (int channel = 0; channel < format.channels; channel++) {
+                sum += pcm[i * format.channels + channel];
+            }
+            samples[AUDIO_FFT_SIZE - AUDIO_HOP + i] = sum / (32768.0f * format.channels);
+        }
+        float power[AUDIO_BANDS];
+        analyze(samples, band_bins, power);
+
+        struct audio_levels levels;
+        for (int band = 0; band < AUDIO_BANDS; band++) {
+            float amplitude = sqrtf(power[band]);
+            peak[band] = fmaxf(fmaxf(amplitude, peak[band] * AUDIO_PEAK_DECAY), AUDIO_NOISE_FLOOR);
+            level[band] = fmaxf(amplitude / peak[band], level[band] * AUDIO_LEVEL_RELEASE);
+            levels.level_q16[band] = level[band] * 65536;
+        }
+        levels.analyzed_us = get_time_us();
+        uint64_t analysis_us = levels.analyzed_us - read_us;
+        analyses++;
+        analysis_total_us += analysis_us;
+        if (analysis_us > analysis_max_us)
+            analysis_max_us = analysis_us;
+
+        pthread_mutex_lock(&levels_mutex);
+        levels.sequence = published.sequence + 1;
+        published = levels;
+        pthread_mutex_unlock(&levels_mutex);
+
+        if (!engine_animation_in_use(&published))
+            break;
+    }
+    close(fd);
+    if (ended)
+        logger(ANIM, "Audio: end of %s after %.1f seconds.", AUDIO_SOURCE, (double)hops * AUDIO_HOP / format.rate);
+    return ended;
+}
+
+static void *audio_thread_func(void *arg) {
+    pthread_mutex_lock(&audio_mutex);
+    while (audio_running) {
+        if (source_ended || !engine_animation_in_use(&published)) {
+            pthread_cond_wait(&audio_cond, &audio_mutex);
+            continue;
+        }
+        pthread_mutex_unlock(&audio_mutex);
+        uint8_t ended = play_source();
+        pthread_mutex_lock(&audio_mutex);
+        source_ended = ended;
+    }
+    pthread_mutex_unlock(&audio_mutex);
+    return NULL;
+}
+
+int audio_start() {
+    if (AUDIO_SOURCE == NULL)
+        return 0;
+    fft_init();
+    if (pipe(wake_pipe) != 0) {
+        logger(ANIM, "Audio: failed to create wake pipe");
+        return -1;
+    }
+    audio_running = 1;
+    if (pthread_create(&audio_thread, NULL, audio_thread_func, NULL) != 0) {
+        logger(ANIM, "Failed to create audio thread");
+        audio_running = 0;
+        return -1;
+    }
+    return 0;
+}
+
+void audio_stop() {
+    pthread_mutex_lock(&audio_mutex);
+    if (!audio_running) {
+        pthread_mutex_unlock(&audio_mutex);
+        return;
+    }
+    audio_running = 0;
+    pthread_cond_signal(&audio_cond);
+    pthread_mutex_unlock(&audio_mutex);
+    if (write(wake_pipe[1], "", 1) != 1)
+        logger(ANIM, "Audio: failed to wake audio thread");
+    pthread_join(audio_thread, NULL);
+    close(wake_pipe[0]);
+    close(wake_pipe[1]);
+    log_stats();
+}
+
+static uint8_t render_audio(const struct engine_animation *animation, uint64_t elapsed_us,
+                            int32_t color_q16[COLOR_CHANNELS]) {
+    pthread_mutex_lock(&levels_mutex);
+    struct audio_levels levels = published;
+    pthread_mutex_unlock(&levels_mutex);
+
+    // frame is written right after rendering, so this is the time from analysis to output
+    if (levels.sequence != rendered_sequence) {
+        uint64_t latency_us = get_time_us() - levels.analyzed_us;
+        rendered_sequence = levels.sequence;
+        latencies++;
+        latency_total_us += latency_us;
+        if (latency_us > latency_max_us)
+            latency_max_us = latency_us;
+    }
+
+    int64_t gain = animation->speed ? animation->speed : 64;
+    struct Color color = animation->color;
+    if (!color.RED && !color.GREEN && !color.BLUE) {
+        for (int channel = 0; channel < COLOR_CHANNELS; channel++) {
+            int64_t level_q16 = levels.level_q16[channel] * gain / 64;
+            color_q16[channel] = (level_q16 > 65536 ? 65536 : level_q16) * 255;
+        }
+        return 1;
+    }
+    // loudness, bass counts twice
+    int64_t level_q16 = (2 * levels.level_q16[0] + levels.level_q16[1] + levels.level_q16[2]) / 4 * gain / 64;
+    if (level_q16 > 65536)
+        level_q16 = 65536;
+    color_q16[COLOR_RED] = COLOR_Q16(color.RED) * level_q16 >> 16;
+    color_q16[COLOR_GREEN] = COLOR_Q16(color.GREEN) * level_q16 >> 16;
+    color_q16[COLOR_BLUE] = COLOR_Q16(color.BLUE) * level_q16 >> 16;
+    return 1;
+}
+
+int audio_start_animation(uint32_t strips, struct Color color, uint8_t speed) {
+    if (!audio_running)
+        return -1;
+    struct engine_animation animation = {.render = render_audio, .params = &published, .color = color, .speed = speed};
+    engine_start_animation(strips, &animation);
+
+    pthread_mutex_lock(&audio_mutex);
+    source_ended = 0;
+    pthread_cond_signal(&audio_cond);
+    pthread_mutex_unlock(&audio_mutex);
+    return 0;
+}
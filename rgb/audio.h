@@ -0,0 +1,23 @@
+#ifndef AUDIO_H
+#define AUDIO_H
+
+#include "../utils/utils.h"
+#include <stdint.h>
+
+// Audio-reactive effect (ANIM_AUDIO). While it runs PCM is read from AUDIO_SOURCE: a FIFO fed with raw 16-bit
+// samples (e.g. by arecord or MPD) or a WAV/raw file, which is played in real time so it can stand in for a live
+// source in tests. Every AUDIO_HOP samples the last AUDIO_FFT_SIZE of them go through a real FFT (butterflies in
+// NEON or SSE where available) and levels of AUDIO_BANDS bands are published; the render engine maps the latest
+// of them to colors on every tick. Analysis time and analysis-to-output latency are measured.
+#define AUDIO_FFT_SIZE 1024 // ~23 ms at 44.1 kHz
+#define AUDIO_HOP 512       // windows overlap by half, ~86 analyses per second at 44.1 kHz
+#define AUDIO_BANDS 3       // bass, mids and treble, shown as red, green and blue
+#define AUDIO_MAX_CHANNELS 8
+
+int audio_start(); // does nothing without AUDIO_SOURCE
+void audio_stop(); // after engine_stop(), prints statistics
+// starts audio effect on strips: bands as red, green and blue, or `color` following loudness if it isn't black.
+// `speed` is gain, 64 is 1.0 (and so is 0). Returns -1 without AUDIO_SOURCE.
+int audio_start_animation(uint32_t strips, struct Color color, uint8_t speed);
+
+#endif // AUDIO_H
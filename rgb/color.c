@@ -0,0 +1,48 @@
+#include "color.h"
+#include "../globals/globals.h"
+#include "../utils/utils.h"
+#include <math.h>
+
+// 256 entries + one more, so interpolation between 255 and "256" needs no bounds check.
+// Values are duty cycles with 8 fractional bits, rounding happens only at the very end.
+static uint32_t color_lut[COLOR_LUTS][257];
+
+void color_pipeline_init() {
+    int white_balance[COLOR_LUTS] = {WHITE_BALANCE_RED, WHITE_BALANCE_GREEN, WHITE_BALANCE_BLUE, 255};
+    double gamma = GAMMA > 0 ? GAMMA : 1.0;
+
+    for (int channel = 0; channel < COLOR_LUTS; channel++) {
+        double scale = (double)PWM_RANGE * 256.0 * (BRIGHTNESS / 255.0) * (white_balance[channel] / 255.0);
+        for (int value = 0; value < 256; value++) {
+            color_lut[channel][value] = (uint32_t)(pow(value / 255.0, gamma) * scale + 0.5);
+        }
+        color_lut[channel][256] = color_lut[channel][255];
+    }
+
+    logger(GPIO, "Color pipeline: gamma %.2f, brightness %d, white balance %d/%d/%d, PWM range %d", gamma, BRIGHTNESS,
+           white_balance[COLOR_RED], white_balance[COLOR_GREEN], white_balance[COLOR_BLUE], PWM_RANGE);
+}
+
+uint32_t color_to_duty_q8(uint8_t channel, int32_t value_q16) {
+    if (value_q16 <= 0)
+        return color_lut[channel][0];
+    if (value_q16 >= COLOR_Q16(255))
+        return color_lut[channel][255];
+
+    uint32_t index = value_q16 >> 16;
+    uint32_t frac = value_q16 & 0xFFFF;
+    int64_t low = color_lut[channel][index];
+    int64_t high = color_lut[channel][index + 1];
+    return (uint32_t)(low + (((high - low) * frac) >> 16));
+}
+
+uint32_t color_to_duty(uint8_t channel, int32_t value_q16) { return (color_to_duty_q8(channel, value_q16) + 128) >> 8; }
+
+uint32_t color_dither(uint32_t *error, uint32_t duty_q8) {
+    // fraction left after truncation is carried to the next tick,
+    // so the average duty over 2^COLOR_DITHER_BITS ticks matches the requested one
+    uint32_t sum = (duty_q8 >> (8 - COLOR_DITHER_BITS)) + *error;
+    *error = sum & ((1 << COLOR_DITHER_BITS) - 1);
+    uint32_t duty = sum >> COLOR_DITHER_BITS;
+    return duty > (uint32_t)PWM_RANGE ? (uint32_t)PWM_RANGE : duty;
+}
@@ -0,0 +1,31 @@
+#ifndef COLOR_H
+#define COLOR_H
+
+#include <stdint.h>
+
+#define COLOR_RED 0
+#define COLOR_GREEN 1
+#define COLOR_BLUE 2
+#define COLOR_CHANNELS 3
+#define COLOR_WHITE 3 // only exists on output side, extracted from RGB for strips with a white pin
+#define COLOR_LUTS 4
+
+// Channel values inside the engine are kept in 8.16 fixed point (0..255 << 16),
+// so transitions can move by less than one 8-bit step per tick.
+#define COLOR_Q16(value) ((int32_t)(value) << 16)
+#define COLOR_FROM_Q16(value) ((uint8_t)(((value) + 0x8000) >> 16))
+
+// Color-processing stage applied right before output.
+// Gamma, brightness and white balance are baked into per-channel lookup tables at startup,
+// so converting a channel value into a duty cycle is one lookup and one interpolation, no floats or divisions.
+void color_pipeline_init();
+uint32_t color_to_duty_q8(uint8_t channel, int32_t value_q16); // duty cycle with 8 fractional bits
+uint32_t color_to_duty(uint8_t channel, int32_t value_q16);    // duty cycle in range 0..PWM_RANGE
+
+// Temporal dithering: alternates adjacent duty cycles across ticks, so 8-bit PWM gets
+// COLOR_DITHER_BITS more bits of effective resolution (averaged over 2^COLOR_DITHER_BITS ticks).
+#define COLOR_DITHER_BITS 4
+#define COLOR_DITHER_MASK (((1 << COLOR_DITHER_BITS) - 1) << (8 - COLOR_DITHER_BITS))
+uint32_t color_dither(uint32_t *error, uint32_t duty_q8); // `error` is kept per output pin between ticks
+
+#endif // COLOR_H
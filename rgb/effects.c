@@ -0,0 +1,174 @@
+#include "effects.h"
+#include "../globals/globals.h"
+#include "color.h"
+#include <math.h>
+#include <stddef.h>
+#include <strings.h>
+
+// Adding an effect is adding an entry here (and its OP to globals.h).
+static const struct effect effects[] = {
+    // every phase of the wheel is 255 steps of 5000 / speed us, same timing as it always was
+    {"fade", ANIM_SET_FADE, WAVE_CONSTANT, PALETTE_FADE, EFFECT_BY_SPEED, 8 * 255 * 5000, 0, {0, 0, 0}},
+    // smooth change to given color in 3 seconds, then fading to black and back, `duration` seconds each way
+    {"pulse", ANIM_SET_PULSE, WAVE_TRIANGLE, PALETTE_NONE, EFFECT_BY_DURATION, 2000000, 3000000, {0, 0, 0}},
+    {"breathing", ANIM_SET_BREATHING, WAVE_SINE, PALETTE_NONE, EFFECT_BY_DURATION, 2000000, 1000000, {255, 255, 255}},
+    {"rainbow", ANIM_SET_RAINBOW, WAVE_CONSTANT, PALETTE_RAINBOW, EFFECT_BY_SPEED, 6 * 255 * 5000, 1000000, {0, 0, 0}},
+    {"strobe", ANIM_SET_STROBE, WAVE_STROBE, PALETTE_NONE, EFFECT_BY_SPEED, 20400000, 0, {255, 255, 255}},
+    {"candle", ANIM_SET_CANDLE, WAVE_NOISE, PALETTE_NONE, EFFECT_BY_SPEED, 25600000, 1000000, {255, 147, 41}},
+    {"color cycle", ANIM_SET_COLOR_CYCLE, WAVE_CONSTANT, PALETTE_CYCLE, EFFECT_BY_DURATION, 6000000, 0, {0, 0, 0}},
+    {NULL},
+};
+
+// keyframes of palettes, spread evenly over the period and wrapping around to the first one
+struct palette_def {
+    uint8_t count;
+    uint8_t smooth; // interpolate between keyframes or hold each of them
+    uint8_t colors[8][COLOR_CHANNELS];
+};
+
+static const struct palette_def palette_defs[PALETTE_COUNT] = {
+    [PALETTE_FADE] = {8,
+                      1,
+                      {{255, 255, 255},
+                       {0, 255, 255},
+                       {0, 255, 0},
+                       {255, 255, 0},
+                       {255, 0, 0},
+                       {255, 0, 255},
+                       {0, 0, 255},
+                       {0, 255, 255}}},
+    [PALETTE_RAINBOW] = {6, 1, {{255, 0, 0}, {255, 255, 0}, {0, 255, 0}, {0, 255, 255}, {0, 0, 255}, {255, 0, 255}}},
+    [PALETTE_CYCLE] = {6, 0, {{255, 0, 0}, {255, 255, 0}, {0, 255, 0}, {0, 255, 255}, {0, 0, 255}, {255, 0, 255}}},
+};
+
+// one extra sample at the end repeats the first one, so interpolation never wraps
+static int32_t wave_tables[WAVE_COUNT][EFFECT_TABLE_SIZE + 1];
+static int32_t palette_tables[PALETTE_COUNT][COLOR_CHANNELS][EFFECT_TABLE_SIZE + 1];
+
+#define NOISE_POINTS 32
+#define NOISE_FLOOR 0.55
+
+// periodic value noise: random points joined with cosine interpolation, plus a weaker octave twice as fast
+static double noise_sample(const double *points, int count, double position) {
+    int point = (int)position % count;
+    double t = position - floor(position);
+    double smooth = (1 - cos(t * M_PI)) / 2;
+    return points[point] + (points[(point + 1) % count] - points[point]) * smooth;
+}
+
+static void build_noise(int32_t *table) {
+    double points[NOISE_POINTS * 2];
+    uint32_t seed = 0x50494C45; // fixed seed, flicker is the same on every start and every strip
+    for (int i = 0; i < NOISE_POINTS * 2; i++) {
+        seed = seed * 1664525 + 1013904223;
+        points[i] = (seed >> 8) / (double)(1 << 24);
+    }
+    for (int i = 0; i < EFFECT_TABLE_SIZE; i++) {
+        double position = (double)i * NOISE_POINTS / EFFECT_TABLE_SIZE;
+        double noise = 0.7 * noise_sample(points, NOISE_POINTS, position) +
+                       0.3 * noise_sample(points + NOISE_POINTS, NOISE_POINTS, fmod(position * 2, NOISE_POINTS));
+        table[i] = (int32_t)((NOISE_FLOOR + (1 - NOISE_FLOOR) * noise) * 65536);
+    }
+}
+
+static void build_palette(const struct palette_def *def, int32_t tables[COLOR_CHANNELS][EFFECT_TABLE_SIZE + 1]) {
+    for (int i = 0; i < EFFECT_TABLE_SIZE; i++) {
+        uint32_t position = i * def->count; // keyframe in upper bits, progress to the next one in lower bits
+        uint8_t from = position >> EFFECT_TABLE_BITS;
+        uint8_t to = (from + 1) % def->count;
+        int32_t progress = def->smooth ? position & (EFFECT_TABLE_SIZE - 1) : 0;
+        for (int channel = 0; channel < COLOR_CHANNELS; channel++) {
+            int32_t delta = COLOR_Q16(def->colors[to][channel]) - COLOR_Q16(def->colors[from][channel]);
+            tables[channel][i] = COLOR_Q16(def->colors[from][channel]) + delta / EFFECT_TABLE_SIZE * progress;
+        }
+    }
+    for (int channel = 0; channel < COLOR_CHANNELS; channel++) {
+        tables[channel][EFFECT_TABLE_SIZE] = tables[channel][0];
+    }
+}
+
+void effects_init() {
+    for (int i = 0; i < EFFECT_TABLE_SIZE; i++) {
+        int32_t half = EFFECT_TABLE_SIZE / 2;
+        wave_tables[WAVE_CONSTANT][i] = 65536;
+        wave_tables[WAVE_TRIANGLE][i] = (i < half ? half - i : i - half) * 65536 / half;
+        wave_tables[WAVE_SINE][i] = (int32_t)((1 + cos(2 * M_PI * i / EFFECT_TABLE_SIZE)) / 2 * 65536);
+        wave_tables[WAVE_STROBE][i] = i < EFFECT_TABLE_SIZE / 8 ? 65536 : 0;
+    }
+    build_noise(wave_tables[WAVE_NOISE]);
+    for (int wave = 0; wave < WAVE_COUNT; wave++) {
+        wave_tables[wave][EFFECT_TABLE_SIZE] = wave_tables[wave][0];
+    }
+    for (int palette = 0; palette < PALETTE_COUNT; palette++) {
+        build_palette(&palette_defs[palette], palette_tables[palette]);
+    }
+}
+
+const struct effect *effect_by_op(uint8_t op) {
+    for (int i = 0; effects[i].name != NULL; i++) {
+        if (effects[i].op == op)
+            return &effects[i];
+    }
+    return NULL;
+}
+
+const struct effect *effect_by_name(const char *name) {
+    for (int i = 0; effects[i].name != NULL; i++) {
+        if (strcasecmp(effects[i].name, name) == 0)
+            return &effects[i];
+    }
+    return NULL;
+}
+
+// phase has EFFECT_TABLE_BITS of sample index and 8 bits of progress to the next sample
+static inline int32_t table_sample(const int32_t *table, uint32_t phase) {
+    uint32_t index = phase >> 8;
+    return table[index] + (int32_t)(((int64_t)(table[index + 1] - table[index]) * (phase & 0xFF)) >> 8);
+}
+
+static void effect_color(const struct effect *effect, const struct engine_animation *animation, uint32_t phase,
+                         int32_t color_q16[COLOR_CHANNELS]) {
+    const uint8_t color[COLOR_CHANNELS] = {animation->color.RED, animation->color.GREEN, animation->color.BLUE};
+    int32_t level_q16 = table_sample(wave_tables[effect->wave], phase);
+    for (int channel = 0; channel < COLOR_CHANNELS; channel++) {
+        int32_t value_q16 = effect->palette == PALETTE_NONE
+                                ? COLOR_Q16(color[channel])
+                                : table_sample(palette_tables[effect->palette][channel], phase);
+        color_q16[channel] = (int32_t)(((int64_t)value_q16 * level_q16) >> 16);
+    }
+}
+
+static uint8_t render_effect(const struct engine_animation *animation, uint64_t elapsed_us,
+                             int32_t color_q16[COLOR_CHANNELS]) {
+    const struct effect *effect = animation->params;
+    if (elapsed_us < animation->loop_start_us) {
+        // intro: from the color animation started at to the first color of the loop
+        int32_t from[COLOR_CHANNELS] = {COLOR_Q16(animation->start_color.RED), COLOR_Q16(animation->start_color.GREEN),
+                                        COLOR_Q16(animation->start_color.BLUE)};
+        int64_t progress_q16 = (elapsed_us << 16) / animation->loop_start_us;
+        effect_color(effect, animation, 0, color_q16);
+        for (int channel = 0; channel < COLOR_CHANNELS; channel++) {
+            color_q16[channel] =
+                from[channel] + (int32_t)(((int64_t)(color_q16[channel] - from[channel]) * progress_q16) >> 16);
+        }
+        return 1;
+    }
+    uint64_t t = (elapsed_us - animation->loop_start_us) % animation->period_us;
+    effect_color(effect, animation, (uint32_t)((t << (EFFECT_TABLE_BITS + 8)) / animation->period_us), color_q16);
+    return 1;
+}
+
+void effect_animation(const struct effect *effect, struct Color color, uint8_t speed, uint8_t duration,
+                      struct engine_animation *animation) {
+    uint64_t period_us = effect->timing == EFFECT_BY_SPEED ? effect->period_us / (speed ? speed : 1)
+                                                           : effect->period_us * (duration ? duration : 1);
+    if (!color.RED && !color.GREEN && !color.BLUE)
+        color = effect->default_color;
+    *animation = (struct engine_animation){.render = render_effect,
+                                           .params = effect,
+                                           .color = color,
+                                           .speed = speed,
+                                           .duration = duration,
+                                           .loop_start_us = effect->intro_us,
+                                           .period_us = period_us};
+}
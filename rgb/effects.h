@@ -0,0 +1,52 @@
+#ifndef EFFECTS_H
+#define EFFECTS_H
+
+#include "../utils/utils.h"
+#include "engine.h"
+#include <stdint.h>
+
+// Data-driven animations. Every effect is one entry of the effects table: a wavetable giving the level of the color
+// and optionally a palette giving the color itself (otherwise the color from client is used), both sampled by phase
+// of the loop, so rendering costs two table lookups per channel whatever the effect is.
+// Tables hold one period of EFFECT_TABLE_SIZE samples in 16.16 fixed point and are built once at startup.
+#define EFFECT_TABLE_BITS 8
+#define EFFECT_TABLE_SIZE (1 << EFFECT_TABLE_BITS)
+
+// wavetables, level of color during the loop
+#define WAVE_CONSTANT 0 // always full level
+#define WAVE_TRIANGLE 1 // full -> black -> full, linear
+#define WAVE_SINE 2     // full -> black -> full, smooth
+#define WAVE_STROBE 3   // short flash at the start of the period
+#define WAVE_NOISE 4    // smoothed random flicker between ~55% and full level
+#define WAVE_COUNT 5
+
+// palettes, color during the loop
+#define PALETTE_NONE 0xFF // color from client
+#define PALETTE_FADE 0    // legacy FADE color wheel, starting from white
+#define PALETTE_RAINBOW 1 // smooth hue wheel
+#define PALETTE_CYCLE 2   // primary and secondary colors, each held for a while
+#define PALETTE_COUNT 3
+
+// how the loop period is derived from packet fields
+#define EFFECT_BY_SPEED 0    // period_us / speed
+#define EFFECT_BY_DURATION 1 // period_us * duration
+
+struct effect {
+    const char *name;
+    uint8_t op;                 // protocol OP starting the effect
+    uint8_t wave;               // WAVE_*
+    uint8_t palette;            // PALETTE_*
+    uint8_t timing;             // EFFECT_BY_SPEED or EFFECT_BY_DURATION
+    uint64_t period_us;         // see timing, speed and duration of 0 count as 1
+    uint64_t intro_us;          // smooth change from previous color before the loop starts
+    struct Color default_color; // used instead of black from client, for effects without palette
+};
+
+void effects_init();
+const struct effect *effect_by_op(uint8_t op);         // NULL if OP doesn't start an effect
+const struct effect *effect_by_name(const char *name); // case-insensitive, NULL if there is no such effect
+// fills animation for the engine, `color` is ignored by effects with palette
+void effect_animation(const struct effect *effect, struct Color color, uint8_t speed, uint8_t duration,
+                      struct engine_animation *animation);
+
+#endif // EFFECTS_H
@@ -0,0 +1,671 @@
+#include "engine.h"
+#include "../globals/globals.h"
+#include "../server/server.h"
+#include "../utils/utils.h"
+#include "openrgb.h"
+#include "output.h"
+#include "waveform.h"
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+
+static pthread_mutex_t engine_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t engine_cond; // waits on CLOCK_MONOTONIC, initialized in engine_start()
+static pthread_t engine_thread;
+static uint8_t engine_running = 0;
+static uint8_t frame_pending = 0; // color was changed directly, one frame must be written
+static struct engine_status engine_status;
+
+// State of all strips is kept as structure of arrays, indexed by channel `strip * COLOR_CHANNELS + color`,
+// so one tick interpolates every channel of every strip in a single branchless loop.
+// Every frame is composed of layers: base color (with its transition), animation and overlays on top.
+#define ENGINE_CHANNELS (MAX_STRIPS * COLOR_CHANNELS)
+static int channel_count;
+#define ALPHA_OPAQUE 65536 // 1.0 in 16.16 fixed point
+
+// logical colors (before gamma/brightness/white balance), 8.16 fixed point per channel
+static int32_t base_q16[ENGINE_CHANNELS];  // base layer, where transitions happen
+static int32_t frame_q16[ENGINE_CHANNELS]; // all layers blended, this is what gets to the output
+
+// channel moves from `from` by `delta` during `duration` after `start`. Static channels have zero delta and duration.
+static uint8_t transition_active = 0;
+static int32_t transition_from[ENGINE_CHANNELS];
+static int32_t transition_delta[ENGINE_CHANNELS];
+static uint64_t transition_start_us[ENGINE_CHANNELS];
+static uint64_t transition_duration_us[ENGINE_CHANNELS];
+static uint64_t transition_scale[ENGINE_CHANNELS]; // 2^48 / duration, so progress needs no division per tick
+static uint32_t transition_tick_rate = 0;          // ticks per second running transitions need, see transition_rate()
+
+static uint32_t animation_mask = 0; // strips running an animation
+static struct engine_animation animations[MAX_STRIPS];
+static uint64_t animation_start_us[MAX_STRIPS];
+static uint32_t animation_id[MAX_STRIPS]; // same for all strips animated by one command
+static uint32_t animation_generation = 0; // changes every time any animation is started or stopped
+static int32_t animation_q16[ENGINE_CHANNELS];
+static int32_t animation_alpha_q16[ENGINE_CHANNELS]; // ALPHA_OPAQUE on animated strips, 0 elsewhere
+
+// overlays are kept from bottom to top, alpha is 0 on channels of strips overlay doesn't cover
+struct engine_overlay {
+    uint32_t strips;
+    uint64_t expires_us;
+    int32_t color_q16[ENGINE_CHANNELS];
+    int32_t alpha_q16[ENGINE_CHANNELS];
+};
+static struct engine_overlay overlays[ENGINE_MAX_OVERLAYS];
+static int overlay_count = 0;
+
+static uint8_t waveform_playing = 0;     // pins of animated strips are owned by the waveform
+static uint32_t waveform_generation = 0; // animations the waveform was built (or tried) for
+static uint32_t waveform_frames[WAVEFORM_MAX_FRAMES * WAVEFORM_MAX_PINS];
+
+// with OPENRGB_SPATIAL the loop of the primary strip's animation is spread over a canvas of OpenRGB
+static struct openrgb_canvas canvas, published_canvas;
+
+static uint32_t dither_error[OUTPUT_MAX_PINS];
+static int32_t written_duty[OUTPUT_MAX_PINS]; // last duty written to every pin, -1 forces a write
+static int16_t written_pixel[MAX_STRIPS * COLOR_LUTS]; // same for RGB(W) values of addressable strips
+
+static uint32_t configured_strips() { return STRIPS_COUNT >= 32 ? STRIPS_ALL : (1u << STRIPS_COUNT) - 1; }
+
+static uint8_t strip_has_white(int strip) {
+    return STRIPS[strip].pixels ? output->pixel_channels() == 4 : STRIPS[strip].pins[COLOR_WHITE] >= 0;
+}
+
+static uint8_t strip_pin_count(int strip) { return strip_has_white(strip) ? 4 : 3; }
+
+static struct Color q16_color(const int32_t color_q16[COLOR_CHANNELS]) {
+    struct Color color = {COLOR_FROM_Q16(color_q16[COLOR_RED]), COLOR_FROM_Q16(color_q16[COLOR_GREEN]),
+                          COLOR_FROM_Q16(color_q16[COLOR_BLUE])};
+    return color;
+}
+
+static struct Color strip_color(int strip) { return q16_color(&frame_q16[strip * COLOR_CHANNELS]); }
+
+// duty cycles (8 fractional bits) of every pin of strip, white part of the color goes to the white pin if there is one
+static void strip_duty_q8(int strip, const int32_t color_q16[COLOR_CHANNELS], uint32_t duty_q8[COLOR_LUTS]) {
+    int32_t white_q16 = 0;
+    if (strip_has_white(strip)) {
+        white_q16 = color_q16[COLOR_RED];
+        if (color_q16[COLOR_GREEN] < white_q16)
+            white_q16 = color_q16[COLOR_GREEN];
+        if (color_q16[COLOR_BLUE] < white_q16)
+            white_q16 = color_q16[COLOR_BLUE];
+    }
+    for (int channel = 0; channel < COLOR_CHANNELS; channel++) {
+        duty_q8[channel] = color_to_duty_q8(channel, color_q16[channel] - white_q16);
+    }
+    duty_q8[COLOR_WHITE] = color_to_duty_q8(COLOR_WHITE, white_q16);
+}
+
+// strips whose pins are written by the engine, the rest is played by the waveform
+static uint32_t rendered_strips() { return waveform_playing ? configured_strips() & ~animation_mask : STRIPS_ALL; }
+
+// addressable strips take 8-bit values and are never dithered, all pixels of strip get the same color
+static uint8_t write_pixels(int strip, const uint32_t duty_q8[COLOR_LUTS]) {
+    uint8_t values[COLOR_LUTS];
+    uint8_t changed = 0;
+    for (int i = 0; i < COLOR_LUTS; i++) {
+        values[i] = (duty_q8[i] + 128) >> 8;
+        if (values[i] != written_pixel[strip * COLOR_LUTS + i]) {
+            written_pixel[strip * COLOR_LUTS + i] = values[i];
+            changed = 1;
+        }
+    }
+    if (changed)
+        output->set_pixels(STRIPS[strip].first_pixel, STRIPS[strip].pixels, values);
+    return changed;
+}
+
+static void write_channels() {
+    uint32_t strips = rendered_strips();
+    uint32_t duty_q8[COLOR_LUTS];
+    uint8_t changed = 0;
+    for (int strip = 0; strip < STRIPS_COUNT; strip++) {
+        if (!(strips & (1u << strip)))
+            continue;
+        strip_duty_q8(strip, &frame_q16[strip * COLOR_CHANNELS], duty_q8);
+        if (STRIPS[strip].pixels) {
+            changed |= write_pixels(strip, duty_q8);
+            continue;
+        }
+        for (int i = 0; i < strip_pin_count(strip); i++) {
+            int pin = STRIPS[strip].pins[i];
+            uint32_t duty = DITHERING ? color_dither(&dither_error[pin], duty_q8[i]) : (duty_q8[i] + 128) >> 8;
+            // static strips cost nothing: only pins whose duty changed are written
+            if ((int32_t)duty != written_duty[pin]) {
+                output->set_duty(pin, duty);
+                written_duty[pin] = duty;
+                changed = 1;
+            }
+        }
+    }
+    if (changed)
+        output->commit();
+}
+
+static uint8_t needs_dithering() {
+    if (!DITHERING)
+        return 0;
+    uint32_t strips = rendered_strips();
+    uint32_t duty_q8[COLOR_LUTS];
+    for (int strip = 0; strip < STRIPS_COUNT; strip++) {
+        if (!(strips & (1u << strip)) || STRIPS[strip].pixels)
+            continue;
+        strip_duty_q8(strip, &frame_q16[strip * COLOR_CHANNELS], duty_q8);
+        for (int i = 0; i < strip_pin_count(strip); i++) {
+            if (duty_q8[i] & COLOR_DITHER_MASK)
+                return 1;
+        }
+    }
+    return 0;
+}
+
+// one pass over all channels, without branches so the compiler can vectorize it.
+// Returns whether any transition is still running.
+static uint8_t interpolate(uint64_t now_us) {
+    uint8_t running = 0;
+    for (int i = 0; i < channel_count; i++) {
+        uint64_t elapsed_us = now_us - transition_start_us[i];
+        uint8_t done = elapsed_us >= transition_duration_us[i];
+        int64_t progress_q16 = done ? 65536 : (int64_t)((elapsed_us * transition_scale[i]) >> 32);
+        base_q16[i] = transition_from[i] + (int32_t)(((int64_t)transition_delta[i] * progress_q16) >> 16);
+        running |= !done;
+    }
+    return running;
+}
+
+// Ticks per second transition of a channel needs: about one output step per tick (with dithering 1/16 of it),
+// at most TRANSITION_RATE. So an hour-long sunrise ticks a few times per second instead of 100.
+static uint32_t transition_rate(int32_t delta_q16, uint64_t duration_us) {
+    uint64_t steps_q16 = (uint64_t)(delta_q16 < 0 ? -delta_q16 : delta_q16) * PWM_RANGE / 255;
+    if (GAMMA > 1.0)
+        steps_q16 *= GAMMA; // steepest part of the gamma curve
+    if (DITHERING)
+        steps_q16 <<= COLOR_DITHER_BITS;
+    uint64_t rate = ((steps_q16 * 1000000 / duration_us) >> 16) + 1;
+    return rate < (uint64_t)TRANSITION_RATE ? rate : TRANSITION_RATE;
+}
+
+// base layer of strip takes its current color (animation included, overlays not), transition on it is cancelled
+static void hold_strip(int strip) {
+    for (int i = strip * COLOR_CHANNELS; i < (strip + 1) * COLOR_CHANNELS; i++) {
+        if (animation_alpha_q16[i])
+            base_q16[i] = animation_q16[i];
+        transition_from[i] = base_q16[i];
+        transition_delta[i] = 0;
+        transition_duration_us[i] = 0;
+    }
+}
+
+static void set_animation_alpha(int strip, int32_t alpha_q16) {
+    for (int i = strip * COLOR_CHANNELS; i < (strip + 1) * COLOR_CHANNELS; i++) {
+        animation_alpha_q16[i] = alpha_q16;
+    }
+}
+
+// animation leaves strip, its current color becomes the base color.
+// Animation is released once no strip shows it anymore.
+static void end_animation(int strip) {
+    const struct engine_animation *animation = &animations[strip];
+    hold_strip(strip);
+    set_animation_alpha(strip, 0);
+    animation_mask &= ~(1u << strip);
+    if (!animation->release)
+        return;
+    for (int other = 0; other < STRIPS_COUNT; other++) {
+        if ((animation_mask & (1u << other)) && animations[other].params == animation->params)
+            return;
+    }
+    animation->release(animation);
+}
+
+static void render_animations(uint64_t now_us) {
+    for (int strip = 0; strip < STRIPS_COUNT; strip++) {
+        if (!(animation_mask & (1u << strip)))
+            continue;
+        if (!animations[strip].render(&animations[strip], now_us - animation_start_us[strip],
+                                      &animation_q16[strip * COLOR_CHANNELS])) {
+            end_animation(strip);
+            animation_generation++;
+        }
+    }
+}
+
+static uint32_t overlay_strips() {
+    uint32_t strips = 0;
+    for (int o = 0; o < overlay_count; o++) {
+        strips |= overlays[o].strips;
+    }
+    return strips;
+}
+
+static void remove_overlay(int o) {
+    overlay_count--;
+    memmove(&overlays[o], &overlays[o + 1], (overlay_count - o) * sizeof(overlays[0]));
+}
+
+static void expire_overlays(uint64_t now_us) {
+    for (int o = overlay_count - 1; o >= 0; o--) {
+        if (now_us >= overlays[o].expires_us)
+            remove_overlay(o);
+    }
+}
+
+// blends layers into frame: a + (b - a) * alpha, alpha is 16.16 fixed point, same branchless loops as interpolate()
+static void composite() {
+    for (int i = 0; i < channel_count; i++) {
+        frame_q16[i] =
+            base_q16[i] + (int32_t)(((int64_t)(animation_q16[i] - base_q16[i]) * animation_alpha_q16[i]) >> 16);
+    }
+    for (int o = 0; o < overlay_count; o++) {
+        const int32_t *color_q16 = overlays[o].color_q16;
+        const int32_t *alpha_q16 = overlays[o].alpha_q16;
+        for (int i = 0; i < channel_count; i++) {
+            frame_q16[i] += (int32_t)(((int64_t)(color_q16[i] - frame_q16[i]) * alpha_q16[i]) >> 16);
+        }
+    }
+}
+
+static void render_frame(uint64_t now_us) {
+    if (transition_active)
+        transition_active = interpolate(now_us);
+    render_animations(now_us);
+    expire_overlays(now_us);
+    composite();
+}
+
+// renders one period of the primary strip's animation across the canvas with overlays on top, so the effect flows
+// over OpenRGB devices. Returns 0 if the strip doesn't loop an animation, OpenRGB gets its color then.
+static uint8_t render_canvas(uint64_t now_us) {
+    const struct engine_animation *animation = &animations[0];
+    uint64_t elapsed_us = now_us - animation_start_us[0];
+    if (!OPENRGB_SPATIAL || !OPENRGB_SERVERS_COUNT || !(animation_mask & 1) || !animation->period_us ||
+        elapsed_us < animation->loop_start_us)
+        return 0;
+    canvas.width = OPENRGB_CANVAS_WIDTH;
+    canvas.height = 1;
+    for (int x = 0; x < OPENRGB_CANVAS_WIDTH; x++) {
+        // periodic animations are a function of time only, see can_play_waveform()
+        int32_t color_q16[COLOR_CHANNELS];
+        animation->render(animation, elapsed_us + animation->period_us * x / OPENRGB_CANVAS_WIDTH, color_q16);
+        for (int o = 0; o < overlay_count; o++) {
+            for (int channel = 0; channel < COLOR_CHANNELS; channel++) {
+                int64_t delta_q16 = overlays[o].color_q16[channel] - color_q16[channel];
+                color_q16[channel] += (int32_t)((delta_q16 * overlays[o].alpha_q16[channel]) >> 16);
+            }
+        }
+        canvas.pixels[x] = q16_color(color_q16);
+    }
+    return 1;
+}
+
+// while animations are played by hardware, their current colors are only known by rendering them
+static void sync_colors() {
+    if (waveform_playing) {
+        render_animations(get_time_us());
+        composite();
+    }
+}
+
+// one waveform plays all animated strips, so they must run one animation started by one command
+static uint8_t can_play_waveform(uint64_t now_us) {
+    if (!HARDWARE_ANIMATIONS || !output->play_waveform || !animation_mask ||
+        waveform_generation == animation_generation || (overlay_strips() & animation_mask))
+        return 0;
+    for (int strip = 0; strip < STRIPS_COUNT; strip++) {
+        if (!(animation_mask & (1u << strip)))
+            continue;
+        if (animation_id[strip] != animation_generation || !animations[strip].period_us ||
+            now_us - animation_start_us[strip] < animations[strip].loop_start_us)
+            return 0;
+    }
+    return 1;
+}
+
+// sample one period of animations, as fine as waveform limits allow, and hand it to the backend
+static void start_waveform(uint64_t now_us) {
+    unsigned pins[WAVEFORM_MAX_PINS];
+    uint8_t pin_count = 0;
+    uint64_t period_us = 0;
+    waveform_generation = animation_generation; // don't retry for these animations if backend refused them
+
+    for (int strip = 0; strip < STRIPS_COUNT; strip++) {
+        if (!(animation_mask & (1u << strip)))
+            continue;
+        period_us = animations[strip].period_us;
+        for (int i = 0; i < strip_pin_count(strip); i++) {
+            if (pin_count == WAVEFORM_MAX_PINS)
+                return;
+            pins[pin_count++] = STRIPS[strip].pins[i];
+        }
+    }
+
+    uint64_t frame_count = period_us / waveform_period_us(); // frame can't be shorter than PWM period
+    if (frame_count > WAVEFORM_MAX_FRAMES)
+        frame_count = WAVEFORM_MAX_FRAMES;
+    if (frame_count < 2)
+        frame_count = 2;
+    uint32_t frame_us = period_us / frame_count;
+    int32_t color_q16[COLOR_CHANNELS];
+    uint32_t duty_q8[COLOR_LUTS];
+    uint32_t *frame_duty = waveform_frames;
+
+    for (uint32_t frame = 0; frame < frame_count; frame++) {
+        for (int strip = 0; strip < STRIPS_COUNT; strip++) {
+            if (!(animation_mask & (1u << strip)))
+                continue;
+            animations[strip].render(&animations[strip],
+                                     now_us - animation_start_us[strip] + (uint64_t)frame * frame_us, color_q16);
+            strip_duty_q8(strip, color_q16, duty_q8);
+            for (int i = 0; i < strip_pin_count(strip); i++) {
+                *frame_duty++ = (duty_q8[i] + 128) >> 8;
+            }
+        }
+    }
+    if (output->play_waveform(pins, pin_count, waveform_frames, frame_count, frame_us) == 0) {
+        waveform_playing = 1;
+        logger(ANIM, "Animation is played by hardware: %lu frames of %u us on %d pins.", frame_count, frame_us,
+               pin_count);
+    }
+}
+
+static void stop_waveform() {
+    output->stop_waveform();
+    waveform_playing = 0;
+    memset(written_duty, 0xFF, sizeof(written_duty)); // backend dropped PWM of waveform pins
+    frame_pending = 1;
+}
+
+static void set_mode(uint8_t mode, uint32_t tick_rate) {
+    if (engine_status.mode == mode && engine_status.tick_rate == tick_rate)
+        return;
+    engine_status.mode = mode;
+    engine_status.tick_rate = tick_rate;
+    if (mode == ENGINE_ACTIVE) {
+        logger(ANIM, "Render engine is active, %u ticks per second.", tick_rate);
+    } else {
+        logger(ANIM, "Render engine is idle after %lu ticks.", engine_status.ticks);
+    }
+}
+
+static void *engine_thread_func(void *arg) {
+    // clients and OpenRGB follow the first (primary) strip
+    struct Color published_color = strip_color(0);
+    uint8_t published_spatial = 0;
+    uint64_t next_tick_us = get_time_us();
+
+    pthread_mutex_lock(&engine_mutex);
+    while (engine_running) {
+        if (waveform_playing && waveform_generation != animation_generation)
+            stop_waveform();
+        if (waveform_playing && (overlay_strips() & animation_mask)) {
+            // overlay has to be blended over the animation, waveform is tried again once overlays expire
+            stop_waveform();
+            waveform_generation--;
+        }
+        uint8_t animating = animation_mask && !waveform_playing;
+        if (!frame_pending && !transition_active && !animating && !needs_dithering()) {
+            // output is static: nothing to do until a new command wakes us up or an overlay expires
+            set_mode(ENGINE_IDLE, 0);
+            if (overlay_count) {
+                uint64_t expires_us = overlays[0].expires_us;
+                for (int o = 1; o < overlay_count; o++) {
+                    if (overlays[o].expires_us < expires_us)
+                        expires_us = overlays[o].expires_us;
+                }
+                struct timespec deadline = {expires_us / 1000000, (expires_us % 1000000) * 1000};
+                if (pthread_cond_timedwait(&engine_cond, &engine_mutex, &deadline) == ETIMEDOUT)
+                    frame_pending = 1;
+            } else {
+                pthread_cond_wait(&engine_cond, &engine_mutex);
+            }
+            engine_status.wakeups++;
+            next_tick_us = get_time_us();
+            continue;
+        }
+
+        uint64_t now_us = get_time_us();
+        frame_pending = 0;
+        render_frame(now_us);
+        if (can_play_waveform(now_us))
+            start_waveform(now_us);
+        write_channels();
+        engine_status.ticks++;
+
+        animating = animation_mask && !waveform_playing;
+        uint8_t active = transition_active || animating || needs_dithering();
+        uint32_t tick_rate = animating ? TRANSITION_RATE : transition_active ? transition_tick_rate : DITHER_RATE;
+        if (active)
+            set_mode(ENGINE_ACTIVE, tick_rate);
+        struct Color color = strip_color(0);
+        uint8_t spatial = render_canvas(now_us);
+        pthread_mutex_unlock(&engine_mutex);
+
+        // clients and OpenRGB only care about the 8-bit color, skip frames where it did not change
+        uint8_t color_changed = memcmp(&color, &published_color, sizeof(color)) != 0;
+        if (spatial) {
+            size_t size = canvas.width * canvas.height * sizeof(struct Color);
+            if (!published_spatial || memcmp(canvas.pixels, published_canvas.pixels, size) != 0) {
+                memcpy(published_canvas.pixels, canvas.pixels, size);
+                openrgb_sync_canvas(&canvas);
+            }
+        } else if (color_changed || published_spatial) {
+            openrgb_sync_color(color);
+        }
+        published_spatial = spatial;
+        if (color_changed) {
+            published_color = color;
+            send_info_about_color();
+        }
+
+        pthread_mutex_lock(&engine_mutex);
+        if (active && engine_running) {
+            next_tick_us += 1000000 / tick_rate;
+            if (next_tick_us < now_us)
+                next_tick_us = now_us; // we fell behind, don't try to catch up with a burst of frames
+            // a slow ramp may tick once a second, new commands must not wait for it
+            struct timespec deadline = {next_tick_us / 1000000, (next_tick_us % 1000000) * 1000};
+            if (pthread_cond_timedwait(&engine_cond, &engine_mutex, &deadline) != ETIMEDOUT)
+                next_tick_us = get_time_us();
+        }
+    }
+    if (waveform_playing)
+        stop_waveform();
+    pthread_mutex_unlock(&engine_mutex);
+    return NULL;
+}
+
+void engine_init() {
+    pthread_condattr_t cond_attr;
+    pthread_condattr_init(&cond_attr);
+    pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC); // same clock as get_time_us()
+    pthread_cond_init(&engine_cond, &cond_attr);
+    pthread_condattr_destroy(&cond_attr);
+
+    channel_count = STRIPS_COUNT * COLOR_CHANNELS;
+    memset(written_duty, 0xFF, sizeof(written_duty));
+    memset(written_pixel, 0xFF, sizeof(written_pixel));
+}
+
+int engine_start() {
+    engine_running = 1;
+    frame_pending = 1;
+    if (pthread_create(&engine_thread, NULL, engine_thread_func, NULL) != 0) {
+        logger(ANIM, "Failed to create render engine thread");
+        engine_running = 0;
+        return -1;
+    }
+    return 0;
+}
+
+void engine_stop() {
+    pthread_mutex_lock(&engine_mutex);
+    if (!engine_running) {
+        pthread_mutex_unlock(&engine_mutex);
+        return;
+    }
+    engine_running = 0;
+    pthread_cond_signal(&engine_cond);
+    pthread_mutex_unlock(&engine_mutex);
+    pthread_join(engine_thread, NULL);
+
+    pthread_mutex_lock(&engine_mutex);
+    for (int strip = 0; strip < STRIPS_COUNT; strip++) {
+        if (animation_mask & (1u << strip))
+            end_animation(strip);
+    }
+    pthread_mutex_unlock(&engine_mutex);
+}
+
+void engine_set_color(uint32_t strips, struct Color color, uint32_t duration_ms) {
+    int32_t target[COLOR_CHANNELS] = {COLOR_Q16(color.RED), COLOR_Q16(color.GREEN), COLOR_Q16(color.BLUE)};
+    uint64_t now_us = get_time_us();
+    strips &= configured_strips();
+
+    pthread_mutex_lock(&engine_mutex);
+    sync_colors();
+    if (!transition_active)
+        transition_tick_rate = 0;
+    if (animation_mask & strips) {
+        for (int strip = 0; strip < STRIPS_COUNT; strip++) {
+            if (animation_mask & strips & (1u << strip))
+                end_animation(strip); // new color always replaces animation, starting from its current color
+        }
+        animation_generation++;
+    }
+    for (int strip = 0; strip < STRIPS_COUNT; strip++) {
+        if (!(strips & (1u << strip)))
+            continue;
+        for (int channel = 0; channel < COLOR_CHANNELS; channel++) {
+            int i = strip * COLOR_CHANNELS + channel;
+            if (duration_ms == 0) {
+                base_q16[i] = target[channel];
+                transition_from[i] = target[channel];
+                transition_delta[i] = 0;
+                transition_duration_us[i] = 0;
+            } else {
+                transition_from[i] = base_q16[i];
+                transition_delta[i] = target[channel] - base_q16[i];
+                transition_start_us[i] = now_us;
+                transition_duration_us[i] = (uint64_t)duration_ms * 1000;
+                transition_scale[i] = ((uint64_t)1 << 48) / transition_duration_us[i];
+                uint32_t rate = transition_rate(transition_delta[i], transition_duration_us[i]);
+                if (rate > transition_tick_rate)
+                    transition_tick_rate = rate;
+            }
+        }
+    }
+    if (duration_ms == 0)
+        frame_pending = 1;
+    else
+        transition_active = 1;
+    pthread_cond_signal(&engine_cond);
+    pthread_mutex_unlock(&engine_mutex);
+}
+
+void engine_start_animation(uint32_t strips, const struct engine_animation *animation) {
+    uint64_t now_us = get_time_us();
+    strips &= configured_strips();
+
+    pthread_mutex_lock(&engine_mutex);
+    sync_colors();
+    animation_generation++;
+    for (int strip = 0; strip < STRIPS_COUNT; strip++) {
+        if (!(strips & (1u << strip)))
+            continue;
+        if (animation_mask & (1u << strip))
+            end_animation(strip);
+        hold_strip(strip);
+        animations[strip] = *animation;
+        animations[strip].start_color = q16_color(&base_q16[strip * COLOR_CHANNELS]);
+        set_animation_alpha(strip, ALPHA_OPAQUE);
+        animation_start_us[strip] = now_us;
+        animation_id[strip] = animation_generation;
+    }
+    animation_mask |= strips;
+    if (!strips && animation->release)
+        animation->release(animation); // no strip took it
+    pthread_cond_signal(&engine_cond);
+    pthread_mutex_unlock(&engine_mutex);
+}
+
+void engine_stop_animation(uint32_t strips) {
+    pthread_mutex_lock(&engine_mutex);
+    if (animation_mask & strips) {
+        sync_colors();
+        for (int strip = 0; strip < STRIPS_COUNT; strip++) {
+            if (animation_mask & strips & (1u << strip))
+                end_animation(strip);
+        }
+        animation_generation++;
+        pthread_cond_signal(&engine_cond); // waveform has to be stopped
+    }
+    pthread_mutex_unlock(&engine_mutex);
+}
+
+void engine_add_overlay(uint32_t strips, struct Color color, uint8_t alpha, uint32_t ttl_ms) {
+    int32_t color_q16[COLOR_CHANNELS] = {COLOR_Q16(color.RED), COLOR_Q16(color.GREEN), COLOR_Q16(color.BLUE)};
+    strips &= configured_strips();
+    if (!strips || !alpha)
+        return;
+
+    pthread_mutex_lock(&engine_mutex);
+    if (overlay_count == ENGINE_MAX_OVERLAYS)
+        remove_overlay(0); // the bottom one is the oldest
+    struct engine_overlay *overlay = &overlays[overlay_count++];
+    overlay->strips = strips;
+    overlay->expires_us = get_time_us() + (uint64_t)ttl_ms * 1000;
+    for (int strip = 0; strip < STRIPS_COUNT; strip++) {
+        uint8_t covered = (strips >> strip) & 1;
+        for (int channel = 0; channel < COLOR_CHANNELS; channel++) {
+            overlay->color_q16[strip * COLOR_CHANNELS + channel] = color_q16[channel];
+            overlay->alpha_q16[strip * COLOR_CHANNELS + channel] = covered ? (int32_t)alpha * ALPHA_OPAQUE / 255 : 0;
+        }
+    }
+    frame_pending = 1;
+    pthread_cond_signal(&engine_cond);
+    pthread_mutex_unlock(&engine_mutex);
+}
+
+void engine_clear_overlays(uint32_t strips) {
+    pthread_mutex_lock(&engine_mutex);
+    for (int o = overlay_count - 1; o >= 0; o--) {
+        if (!(overlays[o].strips & strips))
+            continue;
+        overlays[o].strips &= ~strips;
+        for (int strip = 0; strip < STRIPS_COUNT; strip++) {
+            if (strips & (1u << strip))
+                memset(&overlays[o].alpha_q16[strip * COLOR_CHANNELS], 0, COLOR_CHANNELS * sizeof(int32_t));
+        }
+        if (!overlays[o].strips)
+            remove_overlay(o);
+        frame_pending = 1;
+    }
+    pthread_cond_signal(&engine_cond);
+    pthread_mutex_unlock(&engine_mutex);
+}
+
+uint8_t engine_animation_in_use(const void *params) {
+    uint8_t in_use = 0;
+    pthread_mutex_lock(&engine_mutex);
+    for (int strip = 0; strip < STRIPS_COUNT; strip++) {
+        if ((animation_mask & (1u << strip)) && animations[strip].params == params)
+            in_use = 1;
+    }
+    pthread_mutex_unlock(&engine_mutex);
+    return in_use;
+}
+
+struct Color engine_get_color(uint8_t strip) {
+    pthread_mutex_lock(&engine_mutex);
+    sync_colors();
+    struct Color color = strip < STRIPS_COUNT ? strip_color(strip) : (struct Color){0, 0, 0};
+    pthread_mutex_unlock(&engine_mutex);
+    return color;
+}
+
+void engine_get_status(struct engine_status *status) {
+    pthread_mutex_lock(&engine_mutex);
+    *status = engine_status;
+    pthread_mutex_unlock(&engine_mutex);
+}
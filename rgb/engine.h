@@ -0,0 +1,59 @@
+#ifndef ENGINE_H
+#define ENGINE_H
+
+#include "../utils/utils.h"
+#include "color.h"
+#include <stdint.h>
+
+// Render engine: the only thread that writes to the output backend.
+// While a transition, animation or dithering is in progress it ticks at TRANSITION_RATE (DITHER_RATE when
+// dithering, slower for transitions too slow to change the output on every tick), otherwise it is fully blocked
+// until a new command arrives. With HARDWARE_ANIMATIONS periodic
+// animations are sampled once and looped by the output backend, so the engine blocks during them too.
+#define ENGINE_IDLE 0
+#define ENGINE_ACTIVE 1
+
+// Every frame is blended from layers: base color, animation (replaces the base while it runs) and up to
+// ENGINE_MAX_OVERLAYS overlays, newest on top. Overlays outlive colors and animations set beneath them
+// and are removed after their TTL, uncovering whatever runs beneath.
+#define ENGINE_MAX_OVERLAYS 4
+
+struct engine_animation {
+    // renders color of animation at given time since its start, must not block.
+    // Returns 0 when animation has ended, its last color is kept then.
+    uint8_t (*render)(const struct engine_animation *animation, uint64_t elapsed_us,
+                      int32_t color_q16[COLOR_CHANNELS]);
+    // called once animation isn't shown on any strip anymore, under engine lock. May be NULL.
+    void (*release)(const struct engine_animation *animation);
+    const void *params;       // data of render function, e.g. effect definition
+    struct Color color;       // animation parameters, as received from client
+    uint8_t speed;
+    uint8_t duration;
+    uint64_t loop_start_us;   // animation repeats itself every period_us after this time,
+    uint64_t period_us;       // 0 if it never does. Periodic animations can be played by hardware.
+    struct Color start_color; // filled by engine: color at the moment animation started
+};
+
+struct engine_status {
+    uint8_t mode;       // ENGINE_IDLE or ENGINE_ACTIVE
+    uint32_t tick_rate; // ticks per second in active mode, 0 when idle
+    uint64_t ticks;     // frames rendered since start
+    uint64_t wakeups;   // times engine left idle mode
+};
+
+// commands given between engine_init() and engine_start() are shown from the very first frame
+void engine_init();
+int engine_start();
+void engine_stop();
+// `strips` is a bitmask of STRIPS the command applies to
+void engine_set_color(uint32_t strips, struct Color color, uint32_t duration_ms);
+void engine_start_animation(uint32_t strips, const struct engine_animation *animation);
+void engine_stop_animation(uint32_t strips);
+uint8_t engine_animation_in_use(const void *params); // whether any running animation has these params
+// alpha: 0 transparent - 255 opaque
+void engine_add_overlay(uint32_t strips, struct Color color, uint8_t alpha, uint32_t ttl_ms);
+void engine_clear_overlays(uint32_t strips);
+struct Color engine_get_color(uint8_t strip); // color as it is shown, with all layers
+void engine_get_status(struct engine_status *status);
+
+#endif // ENGINE_H
@@ -1,198 +1,95 @@
 #include "gpio.h"
 #include "../globals/globals.h"
-#include "../server/server.h"
 #include "../utils/utils.h"
-#include "openrgb.h"
-#include "pigpiod_if2.h"
-#include <pthread.h>
+#include "audio.h"
+#include "effects.h"
+#include "engine.h"
+#include "plugins.h"
+#include "state.h"
+#include "vm.h"
+#include <stddef.h>
 #include <stdint.h>
-#include <unistd.h>
-
-pthread_t animation_thread;
-uint8_t is_animating = 0;
-pthread_mutex_t animation_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 void set_color(int pi, struct Color color) {
     logger_debug(GPIO, "set_color: Setting colors: %d %d %d on RPi #%d", color.RED, color.GREEN, color.BLUE, pi);
-    set_PWM_dutycycle(pi, RED_PIN, color.RED);
-    set_PWM_dutycycle(pi, GREEN_PIN, color.GREEN);
-    set_PWM_dutycycle(pi, BLUE_PIN, color.BLUE);
-
-    openrgb_set_color_on_devices(color);
-    // will spam at animation :3
-    // but will be synced with UI on clients
-    // sending info about new color to all clients
-    send_info_about_color();
+    engine_set_color(STRIPS_ALL, color, 0);
+    state_record_color(STRIPS_ALL, color);
 }
 
-void set_color_duration(int pi, struct Color color, uint8_t duration) {
-    stop_animation();
-    set_color_duration_anim(pi, color, duration);
-}
+struct Color get_current_color() { return engine_get_color(0); }
 
-void set_color_duration_anim(int pi, struct Color color, uint8_t duration) {
-    logger_debug(ANIM, "set_color_duration: Setting colors: %d %d %d on RPi #%d", color.RED, color.GREEN, color.BLUE,
-                 pi);
+void set_color_duration(int pi, uint32_t strips, struct Color color, uint8_t duration) {
+    logger_debug(ANIM, "set_color_duration: Setting colors: %d %d %d on RPi #%d, strips 0x%x", color.RED, color.GREEN,
+                 color.BLUE, pi, strips);
     logger_debug(ANIM, "set_color_duration: duration is %d seconds.", duration);
-    if (duration == 0) {
-        set_color(pi, color);
-    } else {
-        is_animating = 1;
-        struct Color last_color = {get_PWM_dutycycle(pi, RED_PIN), get_PWM_dutycycle(pi, GREEN_PIN),
-                                   get_PWM_dutycycle(pi, BLUE_PIN)};
-        logger_debug(ANIM, "set_color_duration: Got last color %d %d %d", last_color.RED, last_color.GREEN,
-                     last_color.BLUE);
-        short red_step_size = color.RED - last_color.RED;
-        short green_step_size = color.GREEN - last_color.GREEN;
-        short blue_step_size = color.BLUE - last_color.BLUE;
-
-        logger_debug(ANIM, "set_color_duration: Calculated step sizes %d %d %d", red_step_size, green_step_size,
-                     blue_step_size);
-
-        uint32_t step_duration_us = (duration * 1000000) / TRANSITION_STEPS;
-
-        for (uint8_t step = 0; step < TRANSITION_STEPS; step++) {
-            if (!is_animating)
-                return;
-            logger_debug(ANIM, "set_color_duration: step #%d", step);
-            short red = last_color.RED + (red_step_size * step) / TRANSITION_STEPS;
-            short green = last_color.GREEN + (green_step_size * step) / TRANSITION_STEPS;
-            short blue = last_color.BLUE + (blue_step_size * step) / TRANSITION_STEPS;
-            logger_debug(ANIM, "set_color_duration: setting color %d %d %d", red, green, blue);
-            set_color(pi, (struct Color){red, green, blue});
-            usleep(step_duration_us);
-        }
-        set_color(pi, color);
-    }
+    stop_animation(strips);
+    engine_set_color(strips, color, duration * 1000);
+    state_record_color(strips, color);
 }
 
-void fade_out(int pi, uint8_t color_pin, uint8_t speed) {
-    for (int i = get_PWM_dutycycle(pi, color_pin); i < 255; i++) {
-        pthread_mutex_lock(&animation_mutex);
-        if (!is_animating || stop_server) {
-            pthread_mutex_unlock(&animation_mutex);
-            return;
-        }
-        pthread_mutex_unlock(&animation_mutex);
-
-        set_PWM_dutycycle(pi, color_pin, i);
-        struct Color cur_color = {get_PWM_dutycycle(pi, RED_PIN), get_PWM_dutycycle(pi, GREEN_PIN),
-                                  get_PWM_dutycycle(pi, BLUE_PIN)};
-        openrgb_set_color_on_devices(cur_color);
-        send_info_about_color();
-        usleep(5000 / speed);
-    }
+void set_overlay(int pi, uint32_t strips, struct Color color, uint8_t alpha, uint8_t duration) {
+    logger_debug(ANIM, "set_overlay: Overlay %d %d %d with alpha %d for %d seconds on RPi #%d, strips 0x%x", color.RED,
+                 color.GREEN, color.BLUE, alpha, duration, pi, strips);
+    engine_add_overlay(strips, color, alpha ? alpha : 255, (duration ? duration : 1) * 1000);
 }
 
-void fade_in(int pi, uint8_t color_pin, uint8_t speed) {
-    for (int i = get_PWM_dutycycle(pi, color_pin); i > 0; i--) {
-        pthread_mutex_lock(&animation_mutex);
-        if (!is_animating || stop_server) {
-            pthread_mutex_unlock(&animation_mutex);
-            return;
-        }
-        pthread_mutex_unlock(&animation_mutex);
+void clear_overlays(uint32_t strips) { engine_clear_overlays(strips); }
 
-        set_PWM_dutycycle(pi, color_pin, i);
-        struct Color cur_color = {get_PWM_dutycycle(pi, RED_PIN), get_PWM_dutycycle(pi, GREEN_PIN),
-                                  get_PWM_dutycycle(pi, BLUE_PIN)};
-        openrgb_set_color_on_devices(cur_color);
-        send_info_about_color();
-        usleep(5000 / speed);
-    }
+void stop_animation(uint32_t strips) {
+    logger_debug(ANIM, "Stop animation function called.");
+    engine_stop_animation(strips);
+    state_record_stop(strips);
 }
 
-int check_to_stop_anim() {
-    logger_debug(ANIM, "Checking whether to stop animation...");
-    pthread_mutex_lock(&animation_mutex);
-    if (!is_animating || stop_server) {
-        pthread_mutex_unlock(&animation_mutex);
-        logger_debug(ANIM, "Stopping animation...");
-        return 1;
+uint32_t target_strips(uint8_t target) {
+    uint32_t strips = 0;
+    if (target == TARGET_ALL)
+        return STRIPS_ALL;
+    if (target < TARGET_GROUP_BASE)
+        return target <= STRIPS_COUNT ? 1u << (target - 1) : 0;
+
+    int group = target - TARGET_GROUP_BASE;
+    if (group >= STRIP_GROUPS_COUNT)
+        return 0;
+    for (int strip = 0; strip < STRIPS_COUNT; strip++) {
+        if (STRIPS[strip].groups & (1u << group))
+            strips |= 1u << strip;
     }
-    pthread_mutex_unlock(&animation_mutex);
-    logger_debug(ANIM, "Not stopping animation.");
-    return 0;
+    return strips;
 }
 
-void *start_fade_animation(void *arg) {
-    pthread_mutex_lock(&animation_mutex);
-    is_animating = 1;
-    pthread_mutex_unlock(&animation_mutex);
-
-    struct fade_animation_args *args = (struct fade_animation_args *)arg;
-    int pi = args->pi;
-    uint8_t speed = args->speed;
-
-    while (1) {
-        if (check_to_stop_anim())
-            break;
+void start_effect(int pi, uint32_t strips, const struct effect *effect, struct Color color, uint8_t speed,
+                  uint8_t duration) {
+    struct engine_animation animation;
+    effect_animation(effect, color, speed, duration, &animation);
+    logger_debug(ANIM, "Animating %s with color %d %d %d, speed %d, duration %d, period %lu us...", effect->name,
+                 animation.color.RED, animation.color.GREEN, animation.color.BLUE, speed, duration,
+                 animation.period_us);
+    engine_start_animation(strips, &animation);
+    state_record_animation(strips, effect->op, color, speed, duration, NULL, 0);
+}
 
-        logger_debug(ANIM, "Animating fade with speed %d...", speed);
-        fade_in(pi, RED_PIN, speed);
-        if (check_to_stop_anim())
-            break;
-        fade_in(pi, BLUE_PIN, speed);
-        if (check_to_stop_anim())
-            break;
-        fade_out(pi, RED_PIN, speed);
-        if (check_to_stop_anim())
-            break;
-        fade_in(pi, GREEN_PIN, speed);
-        if (check_to_stop_anim())
-            break;
-        fade_out(pi, BLUE_PIN, speed);
-        if (check_to_stop_anim())
-            break;
-        fade_in(pi, RED_PIN, speed);
-        if (check_to_stop_anim())
-            break;
-        fade_out(pi, GREEN_PIN, speed);
-        if (check_to_stop_anim())
-            break;
-        fade_out(pi, RED_PIN, speed);
-        if (check_to_stop_anim())
-            break;
+void start_program(int pi, uint32_t strips, const uint8_t *program, uint8_t length, struct Color color, uint8_t speed) {
+    logger_debug(ANIM, "Starting program of %d bytes on RPi #%d, strips 0x%x", length, pi, strips);
+    if (vm_start_animation(strips, program, length, color, speed) != 0) {
+        logger(ANIM, "Program is invalid, ignoring it.");
+        return;
     }
-    pthread_exit(NULL);
+    state_record_animation(strips, ANIM_RUN_PROGRAM, color, speed, 0, program, length);
 }
 
-void *start_pulse_animation(void *arg) {
-    pthread_mutex_lock(&animation_mutex);
-    is_animating = 1;
-    pthread_mutex_unlock(&animation_mutex);
-
-    struct pulse_animation_args *args = (struct pulse_animation_args *)arg;
-    int pi = args->pi;
-    struct Color color = args->color;
-    uint8_t duration = args->duration;
-
-    set_color_duration_anim(pi, color, 3);
-    logger_debug(ANIM, "Before while..... is_anim: %d, is stop server: %d", is_animating, stop_server);
-
-    while (1) {
-        if (check_to_stop_anim())
-            break;
-        pthread_mutex_lock(&animation_mutex);
-        if (!is_animating || stop_server) {
-            pthread_mutex_unlock(&animation_mutex);
-            break;
-        }
-        pthread_mutex_unlock(&animation_mutex);
+void start_plugin(int pi, uint32_t strips, const struct piled_plugin *plugin, struct Color color, uint8_t speed,
+                  uint8_t duration) {
+    logger_debug(ANIM, "Starting plugin \"%s\" on RPi #%d, strips 0x%x", plugin->name, pi, strips);
+    if (plugin_start_animation(plugin, strips, color, speed, duration) == 0)
+        state_record_animation(strips, plugin->op, color, speed, duration, NULL, 0);
+}
 
-        logger_debug(ANIM, "Animating PULSE with duration %d...", duration);
-        set_color_duration_anim(pi, (struct Color){0, 0, 0}, duration);
-        if (check_to_stop_anim())
-            break;
-        usleep(1000);
-        if (check_to_stop_anim())
-            break;
-        set_color_duration_anim(pi, color, duration);
-        if (check_to_stop_anim())
-            break;
-        usleep(500);
-        if (check_to_stop_anim())
-            break;
+void start_audio(int pi, uint32_t strips, struct Color color, uint8_t speed) {
+    logger_debug(ANIM, "Starting audio effect on RPi #%d, strips 0x%x", pi, strips);
+    if (audio_start_animation(strips, color, speed) != 0) {
+        logger(ANIM, "AUDIO_SOURCE is not set, ignoring audio effect.");
+        return;
     }
-    pthread_exit(NULL);
-}
\ No newline at end of file
+    state_record_animation(strips, ANIM_AUDIO, color, speed, 0, NULL, 0);
+}
@@ -2,33 +2,30 @@
 #define GPIO_H
 
 #include "../utils/utils.h"
-#include <pthread.h>
+#include "effects.h"
+#include "plugins.h"
 #include <stdint.h>
 
-#define TRANSITION_STEPS 100
-
-struct fade_animation_args {
-    int pi;
-    uint8_t speed;
-};
-
-struct pulse_animation_args {
-    int pi;
-    struct Color color;
-    uint8_t duration;
-};
-
-// operational functions
+// operational functions, all of them return immediately and are rendered by the engine.
+// `strips` is a bitmask of configured outputs, see target_strips()
 void set_color(int pi, struct Color color);
-void set_color_duration_anim(int pi, struct Color color, uint8_t duration);
-void set_color_duration(int pi, struct Color color, uint8_t duration);
-
-// animations
-void *start_fade_animation(void *arg);
-void *start_pulse_animation(void *arg);
-
-extern pthread_t animation_thread;
-extern uint8_t is_animating;
-extern pthread_mutex_t animation_mutex;
-
-#endif // GPIO_H
\ No newline at end of file
+void set_color_duration(int pi, uint32_t strips, struct Color color, uint8_t duration);
+struct Color get_current_color(); // color of the primary (first) output
+// color shown over everything else on strips for `duration` seconds, `alpha` 0 means opaque
+void set_overlay(int pi, uint32_t strips, struct Color color, uint8_t alpha, uint8_t duration);
+void clear_overlays(uint32_t strips);
+
+// animations, see effects.h
+void start_effect(int pi, uint32_t strips, const struct effect *effect, struct Color color, uint8_t speed,
+                  uint8_t duration);
+void start_program(int pi, uint32_t strips, const uint8_t *program, uint8_t length, struct Color color, uint8_t speed);
+void start_plugin(int pi, uint32_t strips, const struct piled_plugin *plugin, struct Color color, uint8_t speed,
+                  uint8_t duration);
+// audio-reactive effect, see audio.h
+void start_audio(int pi, uint32_t strips, struct Color color, uint8_t speed);
+void stop_animation(uint32_t strips);
+
+// strips addressed by protocol target: TARGET_ALL, output number or TARGET_GROUP_BASE + group number. 0 if none.
+uint32_t target_strips(uint8_t target);
+
+#endif // GPIO_H
@@ -1,31 +1,201 @@
 #include "openrgb.h"
 #include "../globals/globals.h"
 #include "../parser/parser.h"
+#ifndef ORGBCONFIGURATOR
+#include "openrgb_cache.h"
+#endif
 #include "../utils/utils.h"
 #include <arpa/inet.h>
 #include <bits/pthreadtypes.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <linux/sockios.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
 #include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <sys/time.h>
 #include <time.h>
 #include <unistd.h>
 
-int openrgb_socket;
-pthread_t openrgb_recv_thread_id, openrgb_reconnect_thread_id;
-pthread_mutex_t openrgb_send_mutex;
-int8_t openrgb_using_version = -1;
-int32_t openrgb_devices_num = -1;
-int32_t openrgb_using_devices_num = 0;
-int8_t openrgb_parsed_all_devices = -1;
-struct openrgb_controller_data *openrgb_controllers;
-volatile sig_atomic_t openrgb_stop_server = 0, openrgb_needs_reinit = 0, openrgb_exit = 0;
-struct openrgb_device *openrgb_devices_to_change;
+volatile sig_atomic_t openrgb_stop_server = 0;
+struct openrgb_connection *openrgb_connections = NULL;
+int openrgb_connections_count = 0;
+
+// UPDATELEDS packet of a device with its header, only color words change between updates
+struct openrgb_update_packet {
+    uint8_t *data;
+    uint32_t size;
+    uint8_t filled; // color words hold `color`
+    struct Color color;
+};
+
+// LEDs of a zone with the canvas pixel each of them shows, and UPDATEZONELEDS packet with the colors last sent
+struct openrgb_zone_packet {
+    uint8_t *data;
+    uint32_t size;
+    uint16_t *pixels;
+    uint32_t leds_count;
+};
+
+// zones of a device mapped onto a canvas of one size
+struct openrgb_zone_map {
+    uint16_t width;
+    uint16_t height;
+    uint8_t sent; // packets hold colors the device shows, UPDATELEDS to the device clears it
+    int zones_count;
+    struct openrgb_zone_packet zones[];
+};
+
+// memory of the connection, blocks are only freed all together: by arena_release(), or a detached generation of them
+// by arena_free()
+struct openrgb_arena_block {
+    struct openrgb_arena_block *next;
+    size_t size;
+    size_t used;
+    uint8_t data[];
+};
+
+static void *arena_alloc(struct openrgb_connection *connection, size_t size) {
+    size = (size + 7) & ~(size_t)7; // keeps allocations aligned for any field type
+    pthread_mutex_lock(&connection->arena_mutex);
+    struct openrgb_arena_block *arena = connection->arena;
+    if (arena == NULL || arena->size - arena->used < size) {
+        size_t block_size = size > OPENRGB_ARENA_BLOCK_SIZE ? size : OPENRGB_ARENA_BLOCK_SIZE;
+        struct openrgb_arena_block *block = malloc(sizeof(struct openrgb_arena_block) + block_size);
+        if (block == NULL) {
+            pthread_mutex_unlock(&connection->arena_mutex);
+            logger(OPENRGB, "Failed to allocate %lu bytes for OpenRGB.", block_size);
+            return NULL;
+        }
+        block->next = arena;
+        block->size = block_size;
+        block->used = 0;
+        arena = connection->arena = block;
+    }
+    void *memory = arena->data + arena->used;
+    arena->used += size;
+    pthread_mutex_unlock(&connection->arena_mutex);
+    return memory;
+}
+
+static void *arena_calloc(struct openrgb_connection *connection, size_t size) {
+    void *memory = arena_alloc(connection, size);
+    if (memory)
+        memset(memory, 0, size);
+    return memory;
+}
+
+static void *arena_copy(struct openrgb_connection *connection, const void *source, size_t size) {
+    void *memory = arena_alloc(connection, size);
+    if (memory)
+        memcpy(memory, source, size);
+    return memory;
+}
+
+// returns number of blocks
+static int arena_usage(struct openrgb_connection *connection, size_t *used, size_t *size) {
+    int blocks = 0;
+    *used = 0;
+    *size = 0;
+    pthread_mutex_lock(&connection->arena_mutex);
+    for (struct openrgb_arena_block *block = connection->arena; block != NULL; block = block->next) {
+        *used += block->used;
+        *size += block->size;
+        blocks++;
+    }
+    pthread_mutex_unlock(&connection->arena_mutex);
+    return blocks;
+}
+
+// starts a new generation of the arena, returns blocks of the previous one
+static struct openrgb_arena_block *arena_detach(struct openrgb_connection *connection) {
+    pthread_mutex_lock(&connection->arena_mutex);
+    struct openrgb_arena_block *blocks = connection->arena;
+    connection->arena = NULL;
+    pthread_mutex_unlock(&connection->arena_mutex);
+    return blocks;
+}
+
+// gives detached blocks back to the arena, when the generation which was to replace them is given up
+static void arena_attach(struct openrgb_connection *connection, struct openrgb_arena_block *blocks) {
+    pthread_mutex_lock(&connection->arena_mutex);
+    struct openrgb_arena_block **tail = &connection->arena;
+    while (*tail != NULL)
+        tail = &(*tail)->next;
+    *tail = blocks;
+    pthread_mutex_unlock(&connection->arena_mutex);
+}
+
+static void arena_free(struct openrgb_arena_block *blocks) {
+    while (blocks != NULL) {
+        struct openrgb_arena_block *next = blocks->next;
+        free(blocks);
+        blocks = next;
+    }
+}
+
+static void arena_release(struct openrgb_connection *connection) { arena_free(arena_detach(connection)); }
+
+static void init_monotonic_cond(pthread_cond_t *cond) {
+    pthread_condattr_t cond_attr;
+    pthread_condattr_init(&cond_attr);
+    pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC); // same clock as get_time_us()
+    pthread_cond_init(cond, &cond_attr);
+    pthread_condattr_destroy(&cond_attr);
+}
+
+// marks request as sent, must be called before sending it so the response can't come first
+static void expect_response(struct openrgb_connection *connection, uint8_t *pending) {
+    pthread_mutex_lock(&connection->response_mutex);
+    if (!*pending) {
+        *pending = 1;
+        connection->responses_pending++;
+    }
+    pthread_mutex_unlock(&connection->response_mutex);
+}
+
+// marks request as answered, called with response_mutex locked
+static void take_response(struct openrgb_connection *connection, uint8_t *pending) {
+    if (*pending) {
+        *pending = 0;
+        connection->responses_pending--;
+        pthread_cond_broadcast(&connection->response_cond);
+    }
+}
+
+// waits until request is answered, or all of them if `pending` is NULL. Returns -1 on timeout or if connection is
+// closed.
+static int wait_response(struct openrgb_connection *connection, const uint8_t *pending, uint64_t timeout_us) {
+    uint64_t deadline_us = get_time_us() + timeout_us;
+    struct timespec deadline = {deadline_us / 1000000, (deadline_us % 1000000) * 1000};
+    pthread_mutex_lock(&connection->response_mutex);
+    while ((pending ? *pending : connection->responses_pending > 0) && !connection->connection_closed &&
+           !openrgb_stop_server) {
+        if (pthread_cond_timedwait(&connection->response_cond, &connection->response_mutex, &deadline) == ETIMEDOUT)
+            break;
+    }
+    int result = (pending ? *pending : connection->responses_pending > 0) ? -1 : 0;
+    pthread_mutex_unlock(&connection->response_mutex);
+    return result;
+}
+
+// forgets requests which weren't answered, their late responses are ignored
+static void drop_responses(struct openrgb_connection *connection) {
+    pthread_mutex_lock(&connection->response_mutex);
+    connection->version_pending = 0;
+    connection->count_pending = 0;
+    if (connection->controllers_pending && connection->fetching_count > 0)
+        memset(connection->controllers_pending, 0, connection->fetching_count);
+    connection->responses_pending = 0;
+    pthread_mutex_unlock(&connection->response_mutex);
+}
 
 void openrgb_init_header(uint8_t *header, uint32_t pkt_dev_idx, uint32_t pkt_id, uint32_t pkg_size) {
     // adding magick
@@ -45,669 +215,1429 @@ void openrgb_init_header(uint8_t *header, uint32_t pkt_dev_idx, uint32_t pkt_id,
 #endif
 }
 
-void *openrgb_init() {
-    openrgb_stop_server = 0;
-    openrgb_needs_reinit = 0;
-    openrgb_using_devices_num = 0;
-    openrgb_devices_num = -1;
-    openrgb_using_version = -1;
-    openrgb_parsed_all_devices = -1;
-    logger(OPENRGB, "Initializing OpenRGB!");
-    // connects to OpenRGB server, negotiates OpenRGB's SDK version and listens for responses
-    if (pthread_mutex_init(&openrgb_send_mutex, NULL) != 0) {
-        logger(OPENRGB, "Mutex init failed\n");
-        return NULL;
+#ifndef ORGBCONFIGURATOR
+// devices were fetched again or remapped, all of them get the current color
+static void sync_all_devices(struct openrgb_connection *connection) {
+    pthread_mutex_lock(&connection->sync_mutex);
+    if (connection->sync_running) {
+        connection->sync_reset = 1;
+        connection->sync_sequence++;
+        pthread_cond_signal(&connection->sync_cond);
     }
+    pthread_mutex_unlock(&connection->sync_mutex);
+}
 
-    struct sockaddr_in server_addr;
-    openrgb_socket = socket(AF_INET, SOCK_STREAM, 0);
-    if (openrgb_socket < 0) {
-        logger(OPENRGB, "Failed to create socket");
-        return NULL;
+// reads devices picked in config_file, they are shared with the sync worker under send_mutex
+static void load_devices(struct openrgb_connection *connection) {
+    struct openrgb_device *devices;
+    int32_t count = parse_openrgb_config_devices(connection->config_file, &devices);
+    pthread_mutex_lock(&connection->send_mutex);
+    connection->devices_to_change = devices;
+    connection->using_devices_num = count;
+    pthread_mutex_unlock(&connection->send_mutex);
+}
+
+// maps devices to controllers of their pinned identity, returns number of moved devices
+static int resolve_devices(struct openrgb_connection *connection, uint8_t all_parsed) {
+    pthread_mutex_lock(&connection->send_mutex);
+    int moved = openrgb_cache_resolve_devices(connection, connection->controllers, connection->devices_num);
+    if (all_parsed)
+        connection->parsed_all_devices = 1;
+    pthread_mutex_unlock(&connection->send_mutex);
+    return moved;
+}
+#endif
+
+// starts filling a new zeroed table of `count` controllers, controllers which never come have no LEDs.
+// Returns NULL if there is no memory for it.
+static struct openrgb_controller_data *start_fetch(struct openrgb_connection *connection, int32_t count) {
+    struct openrgb_controller_data *table = arena_calloc(connection, count * sizeof(struct openrgb_controller_data));
+    uint8_t *pending = arena_calloc(connection, count);
+    if (pending == NULL)
+        table = NULL;
+    pthread_mutex_lock(&connection->response_mutex);
+    connection->fetching = table;
+    connection->fetching_count = table != NULL && pending != NULL ? count : 0;
+    connection->controllers_pending = pending;
+    connection->controllers_missing = count;
+    connection->controllers_changed = 0;
+    pthread_mutex_unlock(&connection->response_mutex);
+    return table;
+}
+
+void openrgb_connection_init(struct openrgb_connection *connection, int server) {
+    memset(connection, 0, sizeof(*connection));
+    connection->address = OPENRGB_SERVERS[server].address;
+    connection->port = OPENRGB_SERVERS[server].port;
+    snprintf(connection->name, sizeof(connection->name), "%s:%d", connection->address, connection->port);
+    if (server == 0) {
+        snprintf(connection->config_file, sizeof(connection->config_file), "%s", OPENRGB_CONFIG_FILE);
+        snprintf(connection->cache_file, sizeof(connection->cache_file), "%s", OPENRGB_CACHE_FILE);
+    } else {
+        snprintf(connection->config_file, sizeof(connection->config_file), "%s.%s", OPENRGB_CONFIG_FILE,
+                 connection->name);
+        snprintf(connection->cache_file, sizeof(connection->cache_file), "%s.%s", OPENRGB_CACHE_FILE, connection->name);
+    }
+    connection->socket = -1;
+    connection->using_version = -1;
+    connection->devices_num = -1;
+    connection->parsed_all_devices = -1;
+    connection->reported_count = -1;
+    connection->status.state = OPENRGB_DISCONNECTED;
+    pthread_mutex_init(&connection->send_mutex, NULL);
+    pthread_mutex_init(&connection->arena_mutex, NULL);
+    pthread_mutex_init(&connection->response_mutex, NULL);
+    pthread_mutex_init(&connection->status_mutex, NULL);
+    pthread_mutex_init(&connection->sync_mutex, NULL);
+    init_monotonic_cond(&connection->response_cond);
+    init_monotonic_cond(&connection->sync_cond);
+
+    connection->jitter_seed = get_time_us() ^ getpid() ^ server;
+    if (pipe(connection->wake_pipe) != 0) {
+        logger(OPENRGB, "%s: Failed to create wake pipe, reconnects are noticed by polling.", connection->name);
+        connection->wake_pipe[0] = connection->wake_pipe[1] = -1;
+        return;
     }
-    logger(OPENRGB, "Created socket.");
+    for (int end = 0; end < 2; end++) {
+        fcntl(connection->wake_pipe[end], F_SETFL, fcntl(connection->wake_pipe[end], F_GETFL) | O_NONBLOCK);
+    }
+}
 
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_port = htons(OPENRGB_PORT);
-
-    uint8_t connected = 0;
-    while (!connected && !openrgb_stop_server) {
-        if (inet_pton(AF_INET, OPENRGB_SERVER, &server_addr.sin_addr) <= 0) {
-            logger(OPENRGB, "Invalid OpenRGB server's IP address or IP address not supported");
-            close(openrgb_socket);
-            sleep(30);
-            continue;
+// wakes the connection thread, async-signal-safe
+static void wake_connection(struct openrgb_connection *connection) {
+    if (connection->wake_pipe[1] >= 0) {
+        char byte = 0;
+        if (write(connection->wake_pipe[1], &byte, 1) != 1) {
+            // pipe is full, the thread is woken anyway
         }
+    }
+}
 
-        if (connect(openrgb_socket, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
-            logger(OPENRGB, "Connection failed, waiting 30 seconds and trying again...");
-            sleep(30);
-            continue;
-        } else {
-            connected = 1;
+void openrgb_wake() {
+    // called from signal handler, write() is async-signal-safe
+    for (int server = 0; server < openrgb_connections_count; server++) {
+        wake_connection(&openrgb_connections[server]);
+    }
+}
+
+static void drain_events(struct openrgb_connection *connection) {
+    char bytes[64];
+    while (connection->wake_pipe[0] >= 0 && read(connection->wake_pipe[0], bytes, sizeof(bytes)) > 0) {
+    }
+}
+
+// waits until something happens or `timeout_ms` passes (-1 waits forever), the caller checks what it was
+static void wait_event(struct openrgb_connection *connection, int timeout_ms) {
+    struct pollfd fd = {connection->wake_pipe[0], POLLIN, 0};
+    if (connection->wake_pipe[0] < 0 && (timeout_ms < 0 || timeout_ms > 100))
+        timeout_ms = 100;
+    if (poll(&fd, 1, timeout_ms) > 0)
+        drain_events(connection);
+}
+
+static void set_state(struct openrgb_connection *connection, uint8_t state) {
+    pthread_mutex_lock(&connection->status_mutex);
+    connection->status.state = state;
+    pthread_mutex_unlock(&connection->status_mutex);
+}
+
+void openrgb_get_status(struct openrgb_connection *connection, struct openrgb_status *result) {
+    pthread_mutex_lock(&connection->status_mutex);
+    *result = connection->status;
+    pthread_mutex_unlock(&connection->status_mutex);
+}
+
+// delay after `failures` failed attempts, between half and all of the doubled delay, so Pis which lost the same PC
+// don't come back in step
+static uint32_t backoff_ms(struct openrgb_connection *connection, uint32_t failures) {
+    uint32_t cap = OPENRGB_RECONNECT_MAX > OPENRGB_RECONNECT_MIN_MS ? OPENRGB_RECONNECT_MAX : OPENRGB_RECONNECT_MIN_MS;
+    uint64_t delay = (uint64_t)OPENRGB_RECONNECT_MIN_MS << (failures < 16 ? failures - 1 : 15);
+    if (delay > cap)
+        delay = cap;
+    return delay / 2 + rand_r(&connection->jitter_seed) % (delay / 2 + 1);
+}
+
+// connects without blocking, so a PC which is off costs OPENRGB_CONNECT_TIMEOUT_MS and doesn't hold up shutdown.
+// Returns the socket, switched back to blocking mode, or -1 with errno set.
+static int connect_server(struct openrgb_connection *connection) {
+    struct sockaddr_in server_addr = {0};
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(connection->port);
+    if (inet_pton(AF_INET, connection->address, &server_addr.sin_addr) <= 0) {
+        logger(OPENRGB, "Invalid OpenRGB server's IP address or IP address not supported");
+        errno = EINVAL;
+        return -1;
+    }
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+    int flags = fcntl(fd, F_GETFL);
+    fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+
+    drain_events(connection); // from here on a wakeup means shutdown
+    int error = 0;
+    if (connect(fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
+        error = errno;
+        if (error == EINPROGRESS) {
+            struct pollfd fds[2] = {{fd, POLLOUT, 0}, {connection->wake_pipe[0], POLLIN, 0}};
+            socklen_t length = sizeof(error);
+            if (poll(fds, 2, OPENRGB_CONNECT_TIMEOUT_MS) <= 0 || !(fds[0].revents & (POLLOUT | POLLERR | POLLHUP)))
+                error = ETIMEDOUT;
+            else if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &length) < 0)
+                error = errno;
         }
     }
+    if (error != 0) {
+        close(fd);
+        errno = error;
+        return -1;
+    }
+    fcntl(fd, F_SETFL, flags);
+    return fd;
+}
 
-    logger(OPENRGB, "Connected to OpenRGB Server.");
+// handshake and controller fetch on a connected socket, returns 0 once updates can go
+static int open_connection(struct openrgb_connection *connection, int fd, uint64_t start_us) {
+    connection->using_version = -1;
+    connection->needs_refresh = 0;
+    drop_responses(connection);
+    connection->connection_closed = 0;
+    connection->closing = 0;
+    pthread_mutex_lock(&connection->send_mutex);
+    connection->socket = fd;
+    connection->devices_num = -1;
+    connection->parsed_all_devices = -1;
+    pthread_mutex_unlock(&connection->send_mutex);
+
+    logger(OPENRGB, "Connected to OpenRGB Server %s.", connection->name);
+    set_state(connection, OPENRGB_HANDSHAKE);
+    uint64_t connected_us = get_time_us();
+    // pipelined requests must not wait for acknowledgements of previous ones
+    int no_delay = 1;
+    if (setsockopt(connection->socket, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay)) < 0) {
+        logger_debug(OPENRGB, "Failed to disable Nagle's algorithm");
+    }
+    // a PC which stopped reading must not block the sync worker for minutes, see openrgb_request_update_leds()
+    struct timeval send_timeout = {1, 0};
+    if (setsockopt(connection->socket, SOL_SOCKET, SO_SNDTIMEO, &send_timeout, sizeof(send_timeout)) < 0) {
+        logger_debug(OPENRGB, "Failed to set socket send timeout");
+    }
 
     // at this state we successfully connected to OpenRGB server, starting recv thread
 
-    if (pthread_create(&openrgb_recv_thread_id, NULL, openrgb_recv_thread, NULL) != 0) {
+    if (pthread_create(&connection->recv_thread, NULL, openrgb_recv_thread, connection) != 0) {
         logger(OPENRGB, "Failed to create receive thread");
-        close(openrgb_socket);
-        return NULL;
+        return -1;
     }
+    connection->recv_thread_started = 1;
 
     // now all responses by openrgb will be received by recv thread.
-    // requesting version.
-    openrgb_request_protocol_version();
-    logger_debug(OPENRGB, "Requested protocol version, waiting...");
-    uint8_t timeout_counter = 0;
-    while (openrgb_using_version == -1) {
-        logger_debug(OPENRGB, "Waiting... current openrgb version: %d", openrgb_using_version);
-        usleep(100000);
-        timeout_counter++;
-        if (timeout_counter > 10) {
-            // if no protocol version received within 1s, assuming that server does not
-            // supports protocol versioning and working at version 0
-            openrgb_using_version = 0;
-            break;
-        }
+    // requests of the handshake go out together, each phase waits one round trip for its responses
+    openrgb_request_protocol_version(connection);
+    openrgb_set_client_name(connection);
+    openrgb_request_controller_count(connection);
+    logger_debug(OPENRGB, "Requested protocol version and devices number, waiting...");
+    if (wait_response(connection, &connection->count_pending, 2000000) != 0 || connection->reported_count < 0) {
+        logger(OPENRGB, "%s: OpenRGB didn't report its controllers.", connection->name);
+        return -1;
     }
-    logger_debug(OPENRGB, "OpenRGB negotiated version is %d!", openrgb_using_version);
-
-    logger_debug(OPENRGB, "Setting client's name");
-    openrgb_set_client_name();
-
-    logger_debug(OPENRGB, "Getting current devices number");
-    timeout_counter = 0;
-    openrgb_request_controller_count();
-    while (openrgb_devices_num == -1) {
-        logger_debug(OPENRGB, "Waiting... current openrgb version: %d", openrgb_using_version);
-        usleep(100000);
-        timeout_counter++;
-        if (timeout_counter > 20) {
-            logger_debug(OPENRGB, "Error! Can't get devices number!");
-            openrgb_devices_num = 0;
-            return NULL;
-            break;
-        }
+    // server answers in order, so without version by now it does not support protocol versioning and works at
+    // version 0
+    pthread_mutex_lock(&connection->response_mutex);
+    if (connection->version_pending) {
+        take_response(connection, &connection->version_pending);
+        connection->using_version = 0;
+    }
+    pthread_mutex_unlock(&connection->response_mutex);
+    logger_debug(OPENRGB, "OpenRGB negotiated version is %d!", connection->using_version);
+    logger_debug(OPENRGB, "Got %d devices count", connection->reported_count);
+
+    int32_t count = connection->reported_count;
+    if (count > OPENRGB_MAX_CONTROLLERS) {
+        logger(OPENRGB, "%s: OpenRGB reported %d controllers, at most %d are supported.", connection->name, count,
+               OPENRGB_MAX_CONTROLLERS);
+        return -1;
     }
-    logger_debug(OPENRGB, "Got %d devices count", openrgb_devices_num);
+    struct openrgb_controller_data *table = start_fetch(connection, count);
+    struct openrgb_update_packet *packets = arena_calloc(connection, count * sizeof(struct openrgb_update_packet));
+    struct openrgb_zone_map **zone_maps = arena_calloc(connection, count * sizeof(struct openrgb_zone_map *));
+    if (table == NULL || packets == NULL || zone_maps == NULL)
+        return -1;
+    pthread_mutex_lock(&connection->send_mutex);
+    connection->controllers = table;
+    connection->update_packets = packets;
+    connection->zone_maps = zone_maps;
+    connection->devices_num = count;
+    if (count == 0)
+        connection->parsed_all_devices = 1;
+    pthread_mutex_unlock(&connection->send_mutex);
 
-    openrgb_controllers = malloc(openrgb_devices_num * sizeof(struct openrgb_controller_data));
+#ifndef ORGBCONFIGURATOR
+    // with the controllers of the last connection updates go on now, their data is checked when it comes
+    uint8_t resumed = openrgb_cache_resume(connection, connection->controllers, count) == 0;
+    if (resumed) {
+        load_devices(connection);
+        resolve_devices(connection, 1);
+        set_state(connection, OPENRGB_READY);
+        sync_all_devices(connection);
+        logger(OPENRGB, "%s: Resumed %d controllers from cache %lu ms after connecting.", connection->name, count,
+               (get_time_us() - connected_us) / 1000);
+    }
+#endif
 
-    for (int device = 0; device < openrgb_devices_num; device++) {
+    for (int device = 0; device < count; device++) {
         logger_debug(OPENRGB, "Getting device %d data...", device);
-        openrgb_request_controller_data(device);
+        openrgb_request_controller_data(connection, device);
     }
 
     logger_debug(OPENRGB, "Requested all controller data.");
-    while (openrgb_parsed_all_devices == -1) {
-        logger_debug(OPENRGB, "Waiting for all devices...");
-        usleep(200000);
-        timeout_counter++;
-        if (timeout_counter > 20) {
-            logger_debug(OPENRGB, "Error! Can't parse all device or timeout!");
-            break;
-        }
+    if (wait_response(connection, NULL, 4000000) != 0) {
+        logger(OPENRGB, "%s: Not all controllers came from OpenRGB.", connection->name);
+        return -1;
     }
+    uint64_t ready_us = get_time_us();
+    logger(OPENRGB, "%s: OpenRGB ready in %lu ms, %lu ms after connecting.", connection->name,
+           (ready_us - start_us) / 1000, (ready_us - connected_us) / 1000);
+    size_t arena_used, arena_size;
+    int arena_blocks = arena_usage(connection, &arena_used, &arena_size);
+    logger(OPENRGB, "%s: %d controllers take %lu bytes of %lu allocated in %d blocks.", connection->name, count,
+           arena_used, arena_size, arena_blocks);
 
 #ifndef ORGBCONFIGURATOR
-    logger_debug(OPENRGB, "Parsing device preferences config...");
-    parse_openrgb_config_devices("/etc/piled/openrgb_config");
+    if (resumed) {
+        logger(OPENRGB, "%s: Checked cached controllers, %d of %d changed.", connection->name,
+               connection->controllers_changed, count);
+    } else {
+        logger_debug(OPENRGB, "Parsing device preferences config...");
+        load_devices(connection);
+    }
+    int moved = resolve_devices(connection, 0);
+    openrgb_cache_save(connection, connection->controllers, count);
+    if (!resumed || moved > 0 || connection->controllers_changed > 0)
+        sync_all_devices(connection);
 #endif
+    return 0;
+}
 
-    pthread_create(&openrgb_reconnect_thread_id, NULL, openrgb_reconnect_thread, NULL);
-    return NULL;
+// stops recv thread, closes socket and releases everything of the connection. Does nothing if it is closed.
+static void close_connection(struct openrgb_connection *connection) {
+    pthread_mutex_lock(&connection->send_mutex);
+    connection->parsed_all_devices = -1; // sync worker stops using controllers
+    pthread_mutex_unlock(&connection->send_mutex);
+    connection->closing = 1;
+    if (connection->socket >= 0)
+        shutdown(connection->socket, SHUT_RDWR); // recv thread sees the end of the stream
+    if (connection->recv_thread_started) {
+        pthread_join(connection->recv_thread, NULL);
+        connection->recv_thread_started = 0;
+    }
+    if (connection->socket >= 0) {
+        pthread_mutex_lock(&connection->send_mutex);
+        close(connection->socket);
+        connection->socket = -1;
+        pthread_mutex_unlock(&connection->send_mutex);
+    }
+    // events of this connection are handled by closing it
+    connection->needs_reinit = 0;
+    connection->needs_refresh = 0;
+
+    // everything in the arena goes at once, nothing may point there anymore
+    pthread_mutex_lock(&connection->response_mutex);
+    connection->controllers_pending = NULL;
+    connection->fetching = NULL;
+    connection->fetching_count = 0;
+    pthread_mutex_unlock(&connection->response_mutex);
+    pthread_mutex_lock(&connection->send_mutex);
+    connection->update_packets = NULL;
+    connection->zone_maps = NULL;
+    connection->controllers = NULL;
+    connection->devices_num = -1;
+    struct openrgb_device *devices = connection->devices_to_change;
+    int32_t devices_count = connection->using_devices_num;
+    connection->devices_to_change = NULL;
+    connection->using_devices_num = 0;
+    pthread_mutex_unlock(&connection->send_mutex);
+    arena_release(connection);
+
+    for (int i = 0; i < devices_count; i++) {
+        free(devices[i].name);
+    }
+    free(devices);
+}
+
+// connects until the connection is ready, retrying with backoff. Returns -1 if OpenRGB was stopped first.
+static int establish_connection(struct openrgb_connection *connection, uint8_t reconnect) {
+    uint64_t start_us = get_time_us();
+    uint32_t failures = 0;
+    while (!openrgb_stop_server) {
+        set_state(connection, OPENRGB_CONNECTING);
+        uint64_t attempt_us = get_time_us();
+        int fd = connect_server(connection);
+        if (fd >= 0 && open_connection(connection, fd, attempt_us) == 0) {
+            uint64_t ready_us = get_time_us();
+            pthread_mutex_lock(&connection->status_mutex);
+            struct openrgb_status *status = &connection->status;
+            status->state = OPENRGB_READY;
+            status->failed_attempts = 0;
+            status->connections++;
+            if (reconnect) {
+                status->last_reconnect_us = ready_us - start_us;
+                if (status->last_reconnect_us > status->longest_reconnect_us)
+                    status->longest_reconnect_us = status->last_reconnect_us;
+            }
+            pthread_mutex_unlock(&connection->status_mutex);
+            if (reconnect)
+                logger(OPENRGB, "%s: Reconnected to OpenRGB in %lu ms, %u attempts failed.", connection->name,
+                       (ready_us - start_us) / 1000, failures);
+            return 0;
+        }
+        if (fd < 0) {
+            logger(OPENRGB, "Failed to connect to OpenRGB server %s: %s.", connection->name, strerror(errno));
+        } else {
+            close_connection(connection);
+        }
+        failures++;
+        uint32_t delay_ms = backoff_ms(connection, failures);
+        pthread_mutex_lock(&connection->status_mutex);
+        connection->status.state = OPENRGB_WAITING;
+        connection->status.failed_attempts = failures;
+        connection->status.next_attempt_us = get_time_us() + delay_ms * 1000;
+        pthread_mutex_unlock(&connection->status_mutex);
+        logger(OPENRGB, "%s: Trying again in %u ms.", connection->name, delay_ms);
+        wait_event(connection, delay_ms); // only shutdown ends the wait early
+    }
+    set_state(connection, OPENRGB_DISCONNECTED);
+    return -1;
 }
 
-void openrgb_request_protocol_version() {
+int openrgb_init(struct openrgb_connection *connection) {
+    logger(OPENRGB, "Initializing OpenRGB connection to %s!", connection->name);
+    return establish_connection(connection, 0);
+}
+
+// sends header and a small payload of a request with one syscall, so it isn't split by the network stack
+static void send_request(struct openrgb_connection *connection, uint32_t pkt_dev_idx, uint32_t pkt_id,
+                         const void *payload, uint32_t size) {
+    uint8_t packet[16 + OPENRGB_MAX_REQUEST_PAYLOAD];
+    if (size > OPENRGB_MAX_REQUEST_PAYLOAD)
+        return;
+    openrgb_init_header(packet, pkt_dev_idx, pkt_id, size);
+    if (size > 0)
+        memcpy(packet + 16, payload, size);
+    pthread_mutex_lock(&connection->send_mutex);
+    send(connection->socket, packet, 16 + size, MSG_NOSIGNAL);
+    pthread_mutex_unlock(&connection->send_mutex);
+}
+
+void openrgb_request_protocol_version(struct openrgb_connection *connection) {
     logger_debug(OPENRGB, "Requesting protocol version.");
-    uint8_t header[16];
-    openrgb_init_header(header, 0, OPENRGB_NET_PACKET_ID_REQUEST_PROTOCOL_VERSION, 4);
     uint32_t version = OPENRGB_SUPPORTED_VERSION;
-    pthread_mutex_lock(&openrgb_send_mutex);
-#ifdef DEBUG
-    printf("Sending header:\n");
-    for (int i = 0; i < 16; i++) {
-        printf("%x ", header[i]);
-    }
-    printf("\n");
-#endif
-    send(openrgb_socket, header, 16, MSG_NOSIGNAL);
-#ifdef DEBUG
-    printf("Sending version: %d\n", version);
-#endif
-    send(openrgb_socket, &version, 4, MSG_NOSIGNAL);
-    pthread_mutex_unlock(&openrgb_send_mutex);
+    expect_response(connection, &connection->version_pending);
+    send_request(connection, 0, OPENRGB_NET_PACKET_ID_REQUEST_PROTOCOL_VERSION, &version, 4);
 }
 
-void openrgb_set_client_name() {
-    uint8_t *name = malloc(strlen("piled vx"));
-    strcpy((char *)name, "PiLED v");
+void openrgb_set_client_name(struct openrgb_connection *connection) {
+    char name[] = "PiLED vX"; // sent without null termination
     name[7] = PILED_VERSION + '0';
-    uint8_t header[16];
-    openrgb_init_header(header, 0, OPENRGB_NET_PACKET_ID_SET_CLIENT_NAME, strlen("piled vx"));
-    pthread_mutex_lock(&openrgb_send_mutex);
-    send(openrgb_socket, header, 16, MSG_NOSIGNAL);
-    send(openrgb_socket, name, strlen("piled vx"), MSG_NOSIGNAL);
-    pthread_mutex_unlock(&openrgb_send_mutex);
-    free(name);
+    send_request(connection, 0, OPENRGB_NET_PACKET_ID_SET_CLIENT_NAME, name, strlen(name));
 }
 
-void openrgb_request_controller_count() {
+void openrgb_request_controller_count(struct openrgb_connection *connection) {
     logger_debug(OPENRGB, "Requesting controller count");
-    uint8_t header[16];
-    openrgb_init_header(header, 0, OPENRGB_NET_PACKET_ID_REQUEST_CONTROLLER_COUNT, 0);
-    pthread_mutex_lock(&openrgb_send_mutex);
-    send(openrgb_socket, header, 16, MSG_NOSIGNAL);
-    pthread_mutex_unlock(&openrgb_send_mutex);
+    expect_response(connection, &connection->count_pending);
+    send_request(connection, 0, OPENRGB_NET_PACKET_ID_REQUEST_CONTROLLER_COUNT, NULL, 0);
 }
 
-void openrgb_request_controller_data(uint32_t pkt_dev_idx) {
+void openrgb_request_controller_data(struct openrgb_connection *connection, uint32_t pkt_dev_idx) {
     logger_debug(OPENRGB, "Requesting controller data");
-    uint8_t header[16];
-    openrgb_init_header(header, pkt_dev_idx, OPENRGB_NET_PACKET_ID_REQUEST_CONTROLLER_DATA, 4);
-    pthread_mutex_lock(&openrgb_send_mutex);
-    send(openrgb_socket, header, 16, MSG_NOSIGNAL);
-    send(openrgb_socket, &openrgb_using_version, 4, MSG_NOSIGNAL);
-    pthread_mutex_unlock(&openrgb_send_mutex);
+    if (connection->controllers_pending == NULL || pkt_dev_idx >= (uint32_t)connection->fetching_count)
+        return;
+    uint32_t version = connection->using_version;
+    expect_response(connection, &connection->controllers_pending[pkt_dev_idx]);
+    send_request(connection, pkt_dev_idx, OPENRGB_NET_PACKET_ID_REQUEST_CONTROLLER_DATA, &version, 4);
 }
 
-void openrgb_request_update_leds(uint32_t pkt_dev_idx, struct Color color) {
-    logger_debug(OPENRGB, "Setting controller #%d color", pkt_dev_idx);
+// fills `count` color words, doubling copies let memcpy do the bulk with its vector loops
+static void fill_colors(uint8_t *colors, uint16_t count, struct Color color) {
+    uint32_t color_data = color.RED | color.GREEN << 8 | color.BLUE << 16;
+    size_t size = 4 * (size_t)count, filled = 4;
+    if (count == 0)
+        return;
+    memcpy(colors, &color_data, 4);
+    while (filled < size) {
+        size_t chunk = filled < size - filled ? filled : size - filled;
+        memcpy(colors + filled, colors, chunk);
+        filled += chunk;
+    }
+}
 
-    uint32_t packet_size = 4 +                                            // data_size
-                           2 +                                            // num_colors
-                           4 * openrgb_controllers[pkt_dev_idx].num_leds; // led_color
+// returns UPDATELEDS packet of device with `color`, built on first use. Called with send_mutex locked.
+static struct openrgb_update_packet *update_packet(struct openrgb_connection *connection, uint32_t pkt_dev_idx,
+                                                   struct Color color) {
+    struct openrgb_update_packet *packet = &connection->update_packets[pkt_dev_idx];
+    if (packet->data == NULL) {
+        uint16_t num_leds = connection->controllers[pkt_dev_idx].num_leds;
+        uint32_t packet_size = 4 +           // data_size
+                               2 +           // num_colors
+                               4 * num_leds; // led_color
+        packet->data = arena_alloc(connection, 16 + packet_size);
+        if (packet->data == NULL)
+            return NULL;
+        packet->size = 16 + packet_size;
+        openrgb_init_header(packet->data, pkt_dev_idx, OPENRGB_NET_PACKET_ID_RGBCONTROLLER_UPDATELEDS, packet_size);
+        memcpy(packet->data + 16, &packet_size, 4);
+        memcpy(packet->data + 20, &num_leds, 2);
+        packet->filled = 0;
+    }
+    if (!packet->filled || memcmp(&packet->color, &color, sizeof(color)) != 0) {
+        fill_colors(packet->data + 22, (packet->size - 22) / 4, color);
+        packet->color = color;
+        packet->filled = 1;
+    }
+    return packet;
+}
 
-    uint8_t header[16];
-    openrgb_init_header(header, pkt_dev_idx, OPENRGB_NET_PACKET_ID_RGBCONTROLLER_UPDATELEDS, packet_size);
+// sends packets of `message` with one syscall, called with send_mutex locked. Returns -1 if connection broke.
+static int send_packets(struct openrgb_connection *connection, const struct msghdr *message, size_t size) {
+    if (sendmsg(connection->socket, message, MSG_NOSIGNAL) == (ssize_t)size)
+        return 0;
+    // stream is out of sync after a partial send, recv thread sees the shutdown and reconnect follows
+    logger(OPENRGB, "%s: OpenRGB server doesn't take updates, reconnecting.", connection->name);
+    shutdown(connection->socket, SHUT_RDWR);
+    return -1;
+}
 
-    uint8_t packet[packet_size];
-    memcpy(packet, &packet_size, 4);
-    memcpy(packet + 4, &openrgb_controllers[pkt_dev_idx].num_leds, 2);
-#ifdef DEBUG
-    printf("Num leds for #%d device is %d\n", pkt_dev_idx, openrgb_controllers[pkt_dev_idx].num_leds);
-#endif
-    for (int color_idx = 0; color_idx < openrgb_controllers[pkt_dev_idx].num_leds; color_idx++) {
-        uint32_t color_data = 0;
-        color_data |= (color.BLUE & 0xFF) << 16;
-        color_data |= (color.GREEN & 0xFF) << 8;
-        color_data |= (color.RED & 0xFF);
-        logger_debug(OPENRGB, "red: %x, green: %x, blue: %x\nColor data: %02x", color.RED, color.GREEN, color.BLUE,
-                     color_data);
-        memcpy(packet + 6 + 4 * color_idx, &color_data, 4);
+int openrgb_request_update_leds_batch(struct openrgb_connection *connection, const uint32_t *devices, int count,
+                                      struct Color color) {
+    logger_debug(OPENRGB, "Setting color of %d controllers", count);
+    struct iovec iov[OPENRGB_BATCH_MAX];
+    int result = 0;
+    pthread_mutex_lock(&connection->send_mutex);
+    for (int first = 0; first < count && result == 0 && connection->update_packets != NULL;
+         first += OPENRGB_BATCH_MAX) {
+        struct msghdr message = {0};
+        size_t size = 0;
+        message.msg_iov = iov;
+        for (int device = first; device < count && message.msg_iovlen < OPENRGB_BATCH_MAX; device++) {
+            if (devices[device] >= (uint32_t)connection->devices_num)
+                continue;
+            struct openrgb_update_packet *packet = update_packet(connection, devices[device], color);
+            if (packet == NULL)
+                continue;
+            iov[message.msg_iovlen].iov_base = packet->data;
+            iov[message.msg_iovlen].iov_len = packet->size;
+            message.msg_iovlen++;
+            size += packet->size;
+            if (connection->zone_maps != NULL && connection->zone_maps[devices[device]] != NULL)
+                connection->zone_maps[devices[device]]->sent = 0;
+        }
+        if (message.msg_iovlen > 0)
+            result = send_packets(connection, &message, size);
     }
-#ifdef DEBUG
-    printf("Sending color packet:\n");
-    for (int i = 0; i < packet_size; i++) {
-        printf("%02x ", packet[i]);
+    pthread_mutex_unlock(&connection->send_mutex);
+    return result;
+}
+
+int openrgb_request_update_leds(struct openrgb_connection *connection, uint32_t pkt_dev_idx, struct Color color) {
+    return openrgb_request_update_leds_batch(connection, &pkt_dev_idx, 1, color);
+}
+
+void openrgb_set_color_on_devices(struct openrgb_connection *connection, struct Color color) {
+    uint32_t devices[OPENRGB_BATCH_MAX];
+    for (int32_t first = 0;; first += OPENRGB_BATCH_MAX) {
+        int count = 0;
+        pthread_mutex_lock(&connection->send_mutex);
+        for (int32_t device = first; device < connection->using_devices_num && count < OPENRGB_BATCH_MAX; device++) {
+            devices[count++] = connection->devices_to_change[device].device_id;
+        }
+        pthread_mutex_unlock(&connection->send_mutex);
+        if (count == 0)
+            break;
+        openrgb_request_update_leds_batch(connection, devices, count, color);
     }
-    printf("\n");
-#endif
-    pthread_mutex_lock(&openrgb_send_mutex);
-    send(openrgb_socket, header, 16, MSG_NOSIGNAL);
-    send(openrgb_socket, packet, packet_size, MSG_NOSIGNAL);
-    pthread_mutex_unlock(&openrgb_send_mutex);
 }
 
-void openrgb_set_color_on_devices(struct Color color) {
-    for (uint16_t device = 0; device < openrgb_using_devices_num; device++) {
-        openrgb_request_update_leds(openrgb_devices_to_change[device].device_id, color);
+// canvas pixel of every LED of zone: matrix cells cover the whole canvas, LEDs of other zones lie along its middle
+// row. LEDs which aren't in the matrix keep their place on the row.
+static void map_zone_pixels(const struct openrgb_zone *zone, uint32_t leds_count, uint16_t width, uint16_t height,
+                            uint16_t *pixels) {
+    for (uint32_t led = 0; led < leds_count; led++) {
+        pixels[led] = height / 2 * width + (2 * led + 1) * width / (2 * leds_count);
+    }
+    if (zone->matrix == NULL)
+        return;
+    for (uint32_t y = 0; y < zone->matrix_height; y++) {
+        uint32_t row = (2 * y + 1) * height / (2 * zone->matrix_height);
+        for (uint32_t x = 0; x < zone->matrix_width; x++) {
+            uint32_t led;
+            memcpy(&led, zone->matrix + 4 * (y * zone->matrix_width + x), 4);
+            if (led < leds_count) // cells without a LED hold 0xFFFFFFFF
+                pixels[led] = row * width + (2 * x + 1) * width / (2 * zone->matrix_width);
+        }
     }
 }
 
-void *openrgb_recv_thread(void *arg) {
-    logger(OPENRGB, "Started OpenRGB receive thread!");
-    uint8_t header_recv[16];
-    int recv_size;
-    struct timeval timeout;
-    timeout.tv_sec = 0;
-    timeout.tv_usec = 100000;
+// returns zones of device mapped onto canvas, built on first use or when the canvas size changes, NULL while its
+// layout is unknown. Called with send_mutex locked.
+static struct openrgb_zone_map *zone_map(struct openrgb_connection *connection, uint32_t pkt_dev_idx,
+                                         const struct openrgb_canvas *canvas) {
+    struct openrgb_zone_map *map = connection->zone_maps[pkt_dev_idx];
+    if (map != NULL && map->width == canvas->width && map->height == canvas->height)
+        return map;
+    const struct openrgb_controller_data *controller = &connection->controllers[pkt_dev_idx];
+    struct openrgb_zone zones[OPENRGB_MAX_ZONES];
+    int zones_count = controller->data != NULL ? openrgb_controller_zones(controller, zones, OPENRGB_MAX_ZONES) : -1;
+    if (zones_count <= 0)
+        return NULL;
+    if (zones_count > OPENRGB_MAX_ZONES)
+        zones_count = OPENRGB_MAX_ZONES;
 
-    if (setsockopt(openrgb_socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0) {
-        logger_debug(OPENRGB, "Failed to set socket timeout");
+    uint64_t start_us = get_time_us();
+    map = arena_alloc(connection, sizeof(struct openrgb_zone_map) + zones_count * sizeof(struct openrgb_zone_packet));
+    if (map == NULL)
+        return NULL;
+    map->width = canvas->width;
+    map->height = canvas->height;
+    map->sent = 0;
+    map->zones_count = zones_count;
+    for (int zone = 0; zone < zones_count; zone++) {
+        struct openrgb_zone_packet *packet = &map->zones[zone];
+        // zones of malformed data may claim more LEDs than the device has, they are left out
+        uint16_t num_colors = zones[zone].leds_count <= controller->num_leds ? zones[zone].leds_count : 0;
+        uint32_t packet_size = 4 +             // data_size
+                               4 +             // zone_idx
+                               2 +             // num_colors
+                               4 * num_colors; // led_color
+        packet->leds_count = num_colors;
+        packet->size = 16 + packet_size;
+        packet->data = arena_calloc(connection, packet->size);
+        packet->pixels = arena_alloc(connection, num_colors * sizeof(uint16_t) + 1);
+        if (packet->data == NULL || packet->pixels == NULL)
+            return NULL;
+        openrgb_init_header(packet->data, pkt_dev_idx, OPENRGB_NET_PACKET_ID_RGBCONTROLLER_UPDATEZONELEDS, packet_size);
+        memcpy(packet->data + 16, &packet_size, 4);
+        memcpy(packet->data + 20, &zone, 4);
+        memcpy(packet->data + 24, &num_colors, 2);
+        map_zone_pixels(&zones[zone], num_colors, canvas->width, canvas->height, packet->pixels);
     }
+    connection->zone_maps[pkt_dev_idx] = map;
+    logger_debug(OPENRGB, "%s: Mapped %d zones of device #%u onto %ux%u canvas in %lu us.", connection->name,
+                 zones_count, pkt_dev_idx, canvas->width, canvas->height, get_time_us() - start_us);
+    return map;
+}
 
-    while (!openrgb_stop_server) {
-        recv_size = recv(openrgb_socket, header_recv, sizeof(header_recv), 0);
-        if (recv_size < 0) {
-            if (errno == EWOULDBLOCK || errno == EAGAIN) {
+// copies zone map to the current generation of the arena for device that is `pkt_dev_idx` now, NULL without memory
+static struct openrgb_zone_map *copy_zone_map(struct openrgb_connection *connection, const struct openrgb_zone_map *map,
+                                              uint32_t pkt_dev_idx) {
+    size_t size = sizeof(struct openrgb_zone_map) + map->zones_count * sizeof(struct openrgb_zone_packet);
+    struct openrgb_zone_map *copy = arena_copy(connection, map, size);
+    if (copy == NULL)
+        return NULL;
+    for (int zone = 0; zone < copy->zones_count; zone++) {
+        struct openrgb_zone_packet *packet = &copy->zones[zone];
+        packet->data = arena_copy(connection, packet->data, packet->size);
+        packet->pixels = arena_copy(connection, packet->pixels, packet->leds_count * sizeof(uint16_t) + 1);
+        if (packet->data == NULL || packet->pixels == NULL)
+            return NULL;
+        memcpy(packet->data + 4, &pkt_dev_idx, 4); // device index in header
+    }
+    return copy;
+}
+
+// sends UPDATEZONELEDS of zones whose colors on the canvas differ from what the device shows. Returns -1 if
+// connection broke.
+static int send_canvas(struct openrgb_connection *connection, const uint32_t *devices, int count,
+                       const struct openrgb_canvas *canvas) {
+    struct iovec iov[OPENRGB_BATCH_MAX];
+    struct msghdr message = {0};
+    size_t size = 0;
+    int result = 0;
+    message.msg_iov = iov;
+    pthread_mutex_lock(&connection->send_mutex);
+    for (int device = 0; device < count && result == 0 && connection->zone_maps != NULL; device++) {
+        if (devices[device] >= (uint32_t)connection->devices_num)
+            continue;
+        struct openrgb_zone_map *map = zone_map(connection, devices[device], canvas);
+        if (map == NULL)
+            continue;
+        for (int zone = 0; zone < map->zones_count && result == 0; zone++) {
+            struct openrgb_zone_packet *packet = &map->zones[zone];
+            uint8_t *colors = packet->data + 26;
+            uint8_t changed = !map->sent;
+            for (uint32_t led = 0; led < packet->leds_count; led++) {
+                const struct Color *pixel = &canvas->pixels[packet->pixels[led]];
+                uint32_t color_data = pixel->RED | pixel->GREEN << 8 | pixel->BLUE << 16;
+                if (memcmp(colors + 4 * led, &color_data, 4) != 0) {
+                    memcpy(colors + 4 * led, &color_data, 4);
+                    changed = 1;
+                }
+            }
+            if (!changed || packet->leds_count == 0) {
+                connection->sync_zones_unchanged++;
                 continue;
             }
-            logger_debug(OPENRGB, "Failed to receive data");
-            break;
+            iov[message.msg_iovlen].iov_base = packet->data;
+            iov[message.msg_iovlen].iov_len = packet->size;
+            message.msg_iovlen++;
+            size += packet->size;
+            connection->sync_zones_sent++;
+            if (message.msg_iovlen == OPENRGB_BATCH_MAX) {
+                result = send_packets(connection, &message, size);
+                message.msg_iovlen = 0;
+                size = 0;
+            }
         }
+        map->sent = 1;
+    }
+    if (result == 0 && message.msg_iovlen > 0)
+        result = send_packets(connection, &message, size);
+    pthread_mutex_unlock(&connection->send_mutex);
+    return result;
+}
 
-        if (recv_size == 0) {
-            logger(OPENRGB, "Connection closed by peer");
-            openrgb_needs_reinit = 1;
-            break;
-        }
+// bytes of UPDATELEDS packet of device, -1 if there is no such device
+static int update_size(struct openrgb_connection *connection, uint32_t pkt_dev_idx) {
+    pthread_mutex_lock(&connection->send_mutex);
+    int size = -1;
+    if (pkt_dev_idx < (uint32_t)connection->devices_num)
+        size = 16 + 6 + 4 * connection->controllers[pkt_dev_idx].num_leds;
+    pthread_mutex_unlock(&connection->send_mutex);
+    return size;
+}
 
-        logger_debug(OPENRGB, "OpenRGB Parser: Starting parsing buffer with size %d", recv_size);
-#ifdef DEBUG
-        printf("Buffer:\n");
-        for (int i = 0; i < recv_size; i++) {
-            printf("%x ", header_recv[i]);
+// smoothed round-trip time of the connection measured by the kernel, 0 if unknown. Called with send_mutex locked.
+static uint64_t connection_rtt_us(struct openrgb_connection *connection) {
+    struct tcp_info info;
+    socklen_t length = sizeof(info);
+    if (getsockopt(connection->socket, IPPROTO_TCP, TCP_INFO, &info, &length) != 0)
+        return 0;
+    return info.tcpi_rtt;
+}
+
+// whether device doesn't show the color, or canvas `frame` if canvas isn't NULL
+static uint8_t sync_pending(const struct openrgb_sync_device *sync, struct Color color,
+                            const struct openrgb_canvas *canvas, uint32_t frame) {
+    if (canvas != NULL)
+        return sync->frame != frame;
+    return !sync->sent || memcmp(&sync->color, &color, sizeof(color)) != 0;
+}
+
+// sends color or canvas to devices whose interval has passed, returns time of the next pending update or UINT64_MAX
+static uint64_t sync_devices(struct openrgb_connection *connection, struct Color color,
+                             const struct openrgb_canvas *canvas, uint32_t frame) {
+    uint64_t next_us = UINT64_MAX;
+    // the connection thread frees devices and closes the socket on reconnect, the pass works on a snapshot
+    uint32_t devices[OPENRGB_SYNC_MAX_DEVICES];
+    // bytes the PC hasn't taken yet and how many of them are allowed before devices have to wait
+    int queued = 0, buffer_size = 0;
+    socklen_t length = sizeof(buffer_size);
+    pthread_mutex_lock(&connection->send_mutex);
+    int count = connection->parsed_all_devices == 1 ? connection->using_devices_num : 0;
+    if (count > OPENRGB_SYNC_MAX_DEVICES)
+        count = OPENRGB_SYNC_MAX_DEVICES;
+    for (int device = 0; device < count; device++) {
+        devices[device] = connection->devices_to_change[device].device_id;
+    }
+    uint8_t writable = ioctl(connection->socket, SIOCOUTQ, &queued) == 0 &&
+                       getsockopt(connection->socket, SOL_SOCKET, SO_SNDBUF, &buffer_size, &length) == 0;
+    uint64_t rtt_us = connection_rtt_us(connection);
+    pthread_mutex_unlock(&connection->send_mutex);
+    if (!writable)
+        return UINT64_MAX;
+    int queue_limit = buffer_size / 2 < OPENRGB_MAX_QUEUED ? buffer_size / 2 : OPENRGB_MAX_QUEUED;
+    uint64_t min_interval_us = 1000000 / OPENRGB_MAX_RATE;
+    if (rtt_us > min_interval_us)
+        min_interval_us = rtt_us;
+
+    uint32_t batch[OPENRGB_SYNC_MAX_DEVICES];
+    int batch_count = 0;
+    for (int device = 0; device < count; device++) {
+        struct openrgb_sync_device *sync = &connection->sync_devices[device];
+        uint32_t device_id = devices[device];
+        if (!sync_pending(sync, color, canvas, frame))
+            continue;
+        int size = update_size(connection, device_id); // changed zones of a canvas take at most about as much
+        if (size < 0)
+            continue;
+        uint64_t now_us = get_time_us();
+        if (now_us < sync->next_us) {
+            if (sync->next_us < next_us)
+                next_us = sync->next_us;
+            continue;
         }
-        printf("\n");
-#endif
 
-        // сhecking for magick
-        if (header_recv[0] != 'O' || header_recv[1] != 'R' || header_recv[2] != 'G' || header_recv[3] != 'B') {
-            logger_debug(OPENRGB, "Magick wrong! Not a OpenRGB package!");
-            return NULL;
+        uint64_t interval_us = sync->interval_us;
+        if (queued + size > queue_limit) {
+            // PC is behind, device gets the color later and less often
+            sync->deferred++;
+            interval_us = interval_us * 2 > OPENRGB_MAX_INTERVAL_US ? OPENRGB_MAX_INTERVAL_US : interval_us * 2;
+        } else {
+            batch[batch_count++] = device_id;
+            queued += size;
+            sync->sent = canvas == NULL;
+            sync->color = color;
+            sync->frame = frame;
+            sync->updates++;
+            interval_us -= interval_us / 16;
         }
+        if (interval_us < min_interval_us)
+            interval_us = min_interval_us;
+        if (interval_us >= 2 * sync->interval_us || 2 * interval_us <= sync->interval_us)
+            logger_debug(OPENRGB, "%s: Device #%d is limited to %lu updates per second, %d bytes queued, RTT %lu us.",
+                         connection->name, device_id, 1000000 / interval_us, queued, rtt_us);
+        sync->interval_us = interval_us;
+        sync->next_us = now_us + interval_us;
+        if (sync->next_us < next_us && sync_pending(sync, color, canvas, frame))
+            next_us = sync->next_us;
+    }
+    // devices updated in this pass go out with one syscall
+    if (batch_count > 0 && (canvas ? send_canvas(connection, batch, batch_count, canvas)
+                                   : openrgb_request_update_leds_batch(connection, batch, batch_count, color)) != 0)
+        return UINT64_MAX;
+    return next_us;
+}
 
-        uint32_t pkt_dev_idx = 0;
-        memcpy(&pkt_dev_idx, header_recv + 4, 4);
-        logger_debug(OPENRGB, "Got device index: %d", pkt_dev_idx);
-
-        uint32_t pkt_id = 0;
-        memcpy(&pkt_id, header_recv + 8, 4);
-        logger_debug(OPENRGB, "Got packet id: %d", pkt_id);
-
-        uint32_t pkt_size = 0;
-        memcpy(&pkt_size, header_recv + 12, 4);
-        logger_debug(OPENRGB, "Got packet size: %d", pkt_size);
-        // entire header received, now receive the data
-        uint8_t response[pkt_size];
-        switch (pkt_id) {
-        case OPENRGB_NET_PACKET_ID_REQUEST_CONTROLLER_DATA: {
-            logger_debug(OPENRGB, "NET_PACKET_ID_REQUEST_CONTROLLER_DATA.");
-            logger_debug(OPENRGB, "Receiving data packet...");
-
-            uint32_t bytes_received = 0;
-            uint32_t tmp_bytes_received;
-
-            while (bytes_received < pkt_size) {
-                tmp_bytes_received = recv(openrgb_socket, response + bytes_received, pkt_size - bytes_received, 0);
-                if (tmp_bytes_received <= 0) {
-                    logger_debug(OPENRGB, "Error: Failed to receive data. Received %d bytes so far.", bytes_received);
-                    return NULL;
-                }
-                bytes_received += tmp_bytes_received;
-            }
-            logger_debug(OPENRGB, "Received %d bytes. Starting parsing controller data...", bytes_received);
-            struct openrgb_controller_data result;
-            uint32_t offset = 0;
-            result.data_size = 0;
-            memcpy(&result.data_size, response, 4);
-            offset += 4;
-            result.type = 0;
-            logger_debug(OPENRGB, "Data size: %d", result.data_size);
-            memcpy(&result.type, response + offset, 4);
-            offset += 4;
-            result.name_len = 1; // initializing as 1 bc it will store '\0' anyway
-            logger_debug(OPENRGB, "Type: %d", result.type);
-            memcpy(&result.name_len, response + offset, 2);
-            offset += 2;
-            logger_debug(OPENRGB, "Name length: %d", result.name_len);
-            result.name = malloc(result.name_len);
-            strcpy((char *)result.name, (char *)response + offset);
-            result.name[result.name_len - 1] = 0;
-            offset += result.name_len;
-            logger_debug(OPENRGB, "Parsed name by bytes:");
-            for (int i = 0; i < result.name_len; i++) {
-                logger_debug(OPENRGB, "%x ", result.name[i]);
-            }
-            logger_debug(OPENRGB, "\nName: %s", result.name);
-
-            if (openrgb_using_version > 1) {
-                result.version_len = 1;
-                memcpy(&result.vendor_len, response + offset, 2);
-                offset += 2;
-                result.vendor = malloc(result.vendor_len);
-                strcpy((char *)result.vendor, (char *)response + offset);
-                result.vendor[result.vendor_len - 1] = 0;
-                offset += result.vendor_len;
-                logger_debug(OPENRGB, "Vendor: %s, length: %d", result.vendor, result.vendor_len);
-            }
-            result.description_len = 1;
-            memcpy(&result.description_len, response + offset, 2);
-            offset += 2;
-            result.description = malloc(result.description_len);
-            strcpy((char *)result.description, (char *)response + offset);
-            result.description[result.description_len - 1] = 0;
-            offset += result.description_len;
-            logger_debug(OPENRGB, "Description: %s, length: %d", result.description, result.description_len);
-
-            result.version_len = 1;
-            memcpy(&result.version_len, response + offset, 2);
-            offset += 2;
-            result.version = malloc(result.version_len);
-            strcpy((char *)result.version, (char *)response + offset);
-            result.version[result.version_len - 1] = 0;
-            offset += result.version_len;
-            logger_debug(OPENRGB, "Version: %s, length: %d", result.version, result.version_len);
-
-            result.serial_len = 1;
-            memcpy(&result.serial_len, response + offset, 2);
-            offset += 2;
-            result.serial = malloc(result.serial_len);
-            strcpy((char *)result.serial, (char *)response + offset);
-            result.serial[result.serial_len - 1] = 0;
-            offset += result.serial_len;
-            logger_debug(OPENRGB, "Serial: %s, length: %d", result.serial, result.serial_len);
-
-            result.location_len = 1;
-            memcpy(&result.location_len, response + offset, 2);
-            offset += 2;
-            result.location = malloc(result.location_len);
-            strcpy((char *)result.location, (char *)response + offset);
-            result.location[result.location_len - 1] = 0;
-            offset += result.location_len;
-            logger_debug(OPENRGB, "Location size: %d, Location: %s", result.location_len, result.location);
-
-            result.num_modes = 0;
-            memcpy(&result.num_modes, response + offset, 2);
-            offset += 2;
-            result.active_mode = 0;
-            memcpy(&result.active_mode, response + offset, 4);
-            offset += 4;
-            logger_debug(OPENRGB, "Modes count: %d, active mode: %d", result.num_modes, result.active_mode);
-
-            // parsing modes..
-            struct openrgb_mode_data *mode_data = malloc(sizeof(struct openrgb_mode_data) * result.num_modes);
-            for (int mode = 0; mode < result.num_modes; mode++) {
-                logger_debug(OPENRGB, "Parsing mode #%d of %d", mode + 1, result.num_modes);
-                mode_data[mode].mode_name_len = 1;
-                memcpy(&mode_data[mode].mode_name_len, response + offset, 2);
-                offset += 2;
-                mode_data[mode].mode_name = malloc(mode_data[mode].mode_name_len);
-                memcpy(mode_data[mode].mode_name, response + offset, mode_data[mode].mode_name_len);
-                mode_data[mode].mode_name[mode_data[mode].mode_name_len - 1] = 0;
-                offset += mode_data[mode].mode_name_len;
-                logger_debug(OPENRGB, "Mode name: %s", mode_data[mode].mode_name);
-
-                mode_data[mode].mode_value = 0;
-                memcpy(&mode_data[mode].mode_value, response + offset, 4);
-                offset += 4;
-                mode_data[mode].mode_flags = 0;
-                memcpy(&mode_data[mode].mode_flags, response + offset, 4);
-                offset += 4;
-                mode_data[mode].mode_speed_min = 0;
-                memcpy(&mode_data[mode].mode_speed_min, response + offset, 4);
-                offset += 4;
-                mode_data[mode].mode_speed_max = 0;
-                memcpy(&mode_data[mode].mode_speed_max, response + offset, 4);
-                offset += 4;
-                if (openrgb_using_version >= 3) {
-                    mode_data[mode].mode_brightness_min = 0;
-                    memcpy(&mode_data[mode].mode_brightness_min, response + offset, 4);
-                    offset += 4;
-                    mode_data[mode].mode_brightness_max = 1;
-                    memcpy(&mode_data[mode].mode_brightness_max, response + offset, 4);
-                    offset += 4;
-                }
-                mode_data[mode].mode_colors_min = 0;
-                memcpy(&mode_data[mode].mode_colors_min, response + offset, 4);
-                offset += 4;
-                mode_data[mode].mode_colors_max = 0;
-                memcpy(&mode_data[mode].mode_colors_max, response + offset, 4);
-                offset += 4;
-                mode_data[mode].mode_speed = 0;
-                memcpy(&mode_data[mode].mode_speed, response + offset, 4);
-                offset += 4;
-                if (openrgb_using_version >= 3) {
-                    mode_data[mode].mode_brightness = 0;
-                    memcpy(&mode_data[mode].mode_brightness, response + offset, 4);
-                    offset += 4;
-                }
-                mode_data[mode].mode_direction = 0;
-                memcpy(&mode_data[mode].mode_direction, response + offset, 4);
-                offset += 4;
-                mode_data[mode].mode_color_mode = 0;
-                memcpy(&mode_data[mode].mode_color_mode, response + offset, 4);
-                offset += 4;
-                mode_data[mode].mode_num_colors = 0;
-                memcpy(&mode_data[mode].mode_num_colors, response + offset, 2);
-                offset += 2;
-                logger_debug(OPENRGB, "Number of colors: %d", mode_data[mode].mode_num_colors);
-                mode_data[mode].mode_colors = malloc(4 * mode_data[mode].mode_num_colors);
-                memcpy(mode_data[mode].mode_colors, response + offset, 4 * mode_data[mode].mode_num_colors);
-                offset += 4 * mode_data[mode].mode_num_colors;
-            }
-            result.modes = mode_data;
-            // parsing zones..........
-            result.num_zones = 0;
-            memcpy(&result.num_zones, response + offset, 2);
-            offset += 2;
-            logger_debug(OPENRGB, "Zones number: %d", result.num_zones);
-            struct openrgb_zone_data *zone_data = malloc(sizeof(struct openrgb_zone_data) * result.num_zones);
-            for (int zone = 0; zone < result.num_zones; zone++) {
-                logger_debug(OPENRGB, "Parsing zone #%d of %d", zone + 1, result.num_zones);
-                zone_data[zone].zone_name_len = 1;
-                memcpy(&zone_data[zone].zone_name_len, response + offset, 2);
-                offset += 2;
-                zone_data[zone].zone_name = malloc(zone_data[zone].zone_name_len);
-                memcpy(zone_data[zone].zone_name, response + offset, zone_data[zone].zone_name_len);
-                zone_data[zone].zone_name[zone_data[zone].zone_name_len - 1] = 0;
-                offset += zone_data[zone].zone_name_len;
-                logger_debug(OPENRGB, "Zone name: %s", zone_data[zone].zone_name);
-
-                zone_data[zone].zone_type = 0;
-                memcpy(&zone_data[zone].zone_type, response + offset, 4);
-                offset += 4;
-
-                zone_data[zone].zone_leds_min = 0;
-                memcpy(&zone_data[zone].zone_leds_min, response + offset, 4);
-                offset += 4;
-                zone_data[zone].zone_leds_max = 0;
-                memcpy(&zone_data[zone].zone_leds_max, response + offset, 4);
-                offset += 4;
-
-                zone_data[zone].zone_leds_count = 0;
-                memcpy(&zone_data[zone].zone_leds_count, response + offset, 4);
-                offset += 4;
-
-                zone_data[zone].zone_matrix_len = 0;
-                memcpy(&zone_data[zone].zone_matrix_len, response + offset, 2);
-                offset += 2;
-
-                if (zone_data[zone].zone_matrix_len > 0) {
-                    logger_debug(OPENRGB, "Zone matrix parsing not supported, skipping!");
-                    // need to calculate offset...
-                    // memcpy(&zone_data[zone].zone_matrix_height, response_data + offset, 4);
-                    offset += 4;
-                    // memcpy(&zone_data[zone].zone_matrix_width, response_data + offset, 4);
-                    offset += 4;
-
-                    // there could be zone_matrix_data...
-                    offset += zone_data[zone].zone_matrix_len - 8;
-                    zone_data[zone].zone_matrix_data = NULL;
-                }
-                zone_data[zone].zone_matrix_data = NULL;
-                offset += 2; // why?
-            }
-            result.zones = zone_data;
-
-            // parsing leds
-            result.num_leds = 0;
-            memcpy(&result.num_leds, response + offset, 2);
-            offset += 2;
-            struct openrgb_led_data *led_data = malloc(sizeof(struct openrgb_led_data) * result.num_leds);
-            for (int led = 0; led < result.num_leds; led++) {
-                logger_debug(OPENRGB, "Parsing led #%d of %d", led, result.num_leds);
-                led_data[led].led_name_len = 1;
-                memcpy(&led_data[led].led_name_len, response + offset, 2);
-                offset += 2;
-                logger_debug(OPENRGB, "Led name len: %d", led_data[led].led_name_len);
-                led_data[led].led_name = malloc(led_data[led].led_name_len);
-                memcpy(led_data[led].led_name, response + offset, led_data[led].led_name_len);
-                led_data[led].led_name[led_data[led].led_name_len - 1] = 0;
-                offset += led_data[led].led_name_len;
-                logger_debug(OPENRGB, "Led name: %s", led_data[led].led_name);
-                led_data[led].led_value = 0;
-                memcpy(&led_data[led].led_value, response + offset, 4);
-                offset += 4;
-                logger_debug(OPENRGB, "Led value: %d", led_data[led].led_value);
-            }
-            result.leds = led_data;
-
-            memcpy(&result.num_colors, response + offset, 2);
-            offset += 2;
-            for (int color = 0; color < result.num_colors; color++) {
-                logger_debug(OPENRGB, "Parsing color #%d of %d", color, result.num_colors);
-                uint32_t parsed_color = 0;
-                memcpy(&parsed_color, response + offset, 4);
-                logger_debug(OPENRGB, "Parsed color: %x", parsed_color);
+static void *sync_thread_func(void *arg) {
+    struct openrgb_connection *connection = arg;
+    struct openrgb_canvas canvas; // copy of the slot, so the engine can leave the next one meanwhile
+    pthread_mutex_lock(&connection->sync_mutex);
+    uint32_t synced_sequence = connection->sync_sequence;
+    uint64_t next_us = UINT64_MAX;
+    while (connection->sync_running) {
+        if (synced_sequence == connection->sync_sequence) {
+            if (next_us == UINT64_MAX) {
+                pthread_cond_wait(&connection->sync_cond, &connection->sync_mutex);
+                continue;
             }
-            openrgb_controllers[pkt_dev_idx] = result;
-            if (pkt_dev_idx + 1 == openrgb_devices_num)
-                openrgb_parsed_all_devices = 1;
+            struct timespec deadline = {next_us / 1000000, (next_us % 1000000) * 1000};
+            if (pthread_cond_timedwait(&connection->sync_cond, &connection->sync_mutex, &deadline) != ETIMEDOUT)
+                continue;
         }
-        case OPENRGB_NET_PACKET_ID_REQUEST_PROTOCOL_VERSION: {
-            if (openrgb_using_version != -1)
-                break;
-            logger_debug(OPENRGB, "NET_PACKET_ID_REQUEST_PROTOCOL_VERSION");
-            logger_debug(OPENRGB, "Receiving data packet...");
+        if (connection->sync_sequence - synced_sequence > 1)
+            connection->sync_dropped += connection->sync_sequence - synced_sequence - 1;
+        synced_sequence = connection->sync_sequence;
+        struct Color color = connection->sync_color;
+        uint8_t spatial = connection->sync_spatial;
+        if (spatial) {
+            canvas.width = connection->sync_canvas.width;
+            canvas.height = connection->sync_canvas.height;
+            memcpy(canvas.pixels, connection->sync_canvas.pixels, canvas.width * canvas.height * sizeof(struct Color));
+        }
+        if (connection->sync_reset) {
+            memset(connection->sync_devices, 0, sizeof(connection->sync_devices));
+            connection->sync_reset = 0;
+        }
+        pthread_mutex_unlock(&connection->sync_mutex);
+        next_us = sync_devices(connection, color, spatial ? &canvas : NULL, synced_sequence);
+        pthread_mutex_lock(&connection->sync_mutex);
+    }
+    pthread_mutex_unlock(&connection->sync_mutex);
+    return NULL;
+}
 
-            uint32_t bytes_received = 0;
-            uint32_t tmp_bytes_received;
+static void sync_start(struct openrgb_connection *connection) {
+    connection->sync_running = 1;
+    if (pthread_create(&connection->sync_thread, NULL, sync_thread_func, connection) != 0) {
+        logger(OPENRGB, "%s: Failed to create OpenRGB sync thread", connection->name);
+        connection->sync_running = 0;
+    }
+}
 
-            while (bytes_received < pkt_size) {
-                tmp_bytes_received = recv(openrgb_socket, response + bytes_received, pkt_size - bytes_received, 0);
-                if (tmp_bytes_received <= 0) {
-                    logger_debug(OPENRGB, "Error: Failed to receive data. Received %d bytes so far.", bytes_received);
-                    return NULL;
-                }
-                bytes_received += tmp_bytes_received;
-            }
-            logger_debug(OPENRGB, "Received %d bytes.", bytes_received);
-            uint32_t openrgb_version = 0;
-            memcpy(&openrgb_version, response, 4);
-            openrgb_using_version =
-                openrgb_version <= OPENRGB_SUPPORTED_VERSION ? openrgb_version : OPENRGB_SUPPORTED_VERSION;
-            logger_debug(OPENRGB, "OpenRGB Server's Version: %d, Client max supported version: %d, Using version: %d",
-                         openrgb_version, OPENRGB_SUPPORTED_VERSION, openrgb_using_version);
+void openrgb_sync_stop() {
+    for (int server = 0; server < openrgb_connections_count; server++) {
+        struct openrgb_connection *connection = &openrgb_connections[server];
+        pthread_mutex_lock(&connection->sync_mutex);
+        if (!connection->sync_running) {
+            pthread_mutex_unlock(&connection->sync_mutex);
+            continue;
+        }
+        connection->sync_running = 0;
+        pthread_cond_signal(&connection->sync_cond);
+        pthread_mutex_unlock(&connection->sync_mutex);
+        pthread_join(connection->sync_thread, NULL);
+
+        pthread_mutex_lock(&connection->send_mutex);
+        uint64_t rtt_us = connection_rtt_us(connection);
+        pthread_mutex_unlock(&connection->send_mutex);
+        logger(OPENRGB,
+               "Sync %s: %u colors, %u of them replaced by newer ones before the worker took them, RTT %lu us.",
+               connection->name, connection->sync_colors, connection->sync_dropped, rtt_us);
+        for (int device = 0; device < OPENRGB_SYNC_MAX_DEVICES; device++) {
+            const struct openrgb_sync_device *sync = &connection->sync_devices[device];
+            if (sync->updates || sync->deferred)
+                logger(OPENRGB, "Sync %s: device %d got %lu updates, %lu deferred, now at most %lu per second.",
+                       connection->name, device, sync->updates, sync->deferred, 1000000 / sync->interval_us);
+        }
+        if (connection->sync_zones_sent || connection->sync_zones_unchanged)
+            logger(OPENRGB, "Sync %s: %lu zone updates of canvas frames sent, %lu unchanged zones skipped.",
+                   connection->name, connection->sync_zones_sent, connection->sync_zones_unchanged);
+    }
+}
 
-            break;
+void openrgb_sync_color(struct Color color) {
+    // every worker takes the color on its own, a PC which is slow or off doesn't hold up the others
+    for (int server = 0; server < openrgb_connections_count; server++) {
+        struct openrgb_connection *connection = &openrgb_connections[server];
+        pthread_mutex_lock(&connection->sync_mutex);
+        if (connection->sync_running) {
+            connection->sync_color = color;
+            connection->sync_spatial = 0;
+            connection->sync_sequence++;
+            connection->sync_colors++;
+            pthread_cond_signal(&connection->sync_cond);
         }
-        case OPENRGB_NET_PACKET_ID_REQUEST_CONTROLLER_COUNT: {
-            logger_debug(OPENRGB, "OPENRGB_NET_PACKET_ID_REQUEST_CONTROLLER_COUNT");
-            logger_debug(OPENRGB, "Receiving data packet...");
+        pthread_mutex_unlock(&connection->sync_mutex);
+    }
+}
 
-            uint32_t bytes_received = 0;
-            uint32_t tmp_bytes_received;
+void openrgb_sync_canvas(const struct openrgb_canvas *canvas) {
+    size_t pixels = (size_t)canvas->width * canvas->height;
+    if (pixels == 0 || pixels > OPENRGB_CANVAS_MAX_PIXELS)
+        return;
+    for (int server = 0; server < openrgb_connections_count; server++) {
+        struct openrgb_connection *connection = &openrgb_connections[server];
+        pthread_mutex_lock(&connection->sync_mutex);
+        if (connection->sync_running) {
+            connection->sync_canvas.width = canvas->width;
+            connection->sync_canvas.height = canvas->height;
+            memcpy(connection->sync_canvas.pixels, canvas->pixels, pixels * sizeof(struct Color));
+            connection->sync_spatial = 1;
+            connection->sync_sequence++;
+            connection->sync_colors++;
+            pthread_cond_signal(&connection->sync_cond);
+        }
+        pthread_mutex_unlock(&connection->sync_mutex);
+    }
+}
 
-            while (bytes_received < pkt_size) {
-                tmp_bytes_received = recv(openrgb_socket, response + bytes_received, pkt_size - bytes_received, 0);
-                if (tmp_bytes_received <= 0) {
-                    logger_debug(OPENRGB, "Error: Failed to receive data. Received %d bytes so far.", bytes_received);
-                    return NULL;
-                }
-                bytes_received += tmp_bytes_received;
-            }
-            logger_debug(OPENRGB, "Received %d bytes.", bytes_received);
-            memcpy(&openrgb_devices_num, response, 4);
-            logger_debug(OPENRGB, "Got OpenRGB devices: %d", openrgb_devices_num);
+// bounds-checked reader of controller data, reading past its end returns nothing and sets `failed`
+struct openrgb_view {
+    const uint8_t *data;
+    uint32_t size;
+    uint32_t offset;
+    uint8_t failed;
+};
+
+static const uint8_t *view_take(struct openrgb_view *view, uint32_t length) {
+    if (view->failed || length > view->size - view->offset) {
+        view->failed = 1;
+        return NULL;
+    }
+    const uint8_t *field = view->data + view->offset;
+    view->offset += length;
+    return field;
+}
 
-            break;
+static uint16_t view_u16(struct openrgb_view *view) {
+    uint16_t value = 0;
+    const uint8_t *field = view_take(view, 2);
+    if (field)
+        memcpy(&value, field, 2);
+    return value;
+}
+
+static uint32_t view_u32(struct openrgb_view *view) {
+    uint32_t value = 0;
+    const uint8_t *field = view_take(view, 4);
+    if (field)
+        memcpy(&value, field, 4);
+    return value;
+}
+
+// string is its length(2), including null termination, and characters
+static const char *view_string(struct openrgb_view *view) {
+    uint16_t length = view_u16(view);
+    const uint8_t *field = view_take(view, length);
+    if (field == NULL || length == 0 || field[length - 1] != 0) {
+        view->failed = 1;
+        return NULL;
+    }
+    return (const char *)field;
+}
+
+static void view_skip_modes(struct openrgb_view *view, int8_t version) {
+    uint16_t num_modes = view_u16(view);
+    view_take(view, 4); // active_mode
+    for (int mode = 0; mode < num_modes && !view->failed; mode++) {
+        view_string(view);
+        view_take(view, 4 * 4); // value, flags, speed_min, speed_max
+        if (version >= 3)
+            view_take(view, 2 * 4); // brightness_min, brightness_max
+        view_take(view, 3 * 4);     // colors_min, colors_max, speed
+        if (version >= 3)
+            view_take(view, 4); // brightness
+        view_take(view, 2 * 4); // direction, color_mode
+        uint16_t num_colors = view_u16(view);
+        view_take(view, 4 * num_colors);
+    }
+}
+
+// reads zones, first `max` of them to `zones` if it isn't NULL. Returns number of zones.
+static int view_zones(struct openrgb_view *view, int8_t version, struct openrgb_zone *zones, int max) {
+    uint16_t num_zones = view_u16(view);
+    for (int zone = 0; zone < num_zones && !view->failed; zone++) {
+        struct openrgb_zone parsed = {0};
+        parsed.name = view_string(view);
+        parsed.type = view_u32(view);
+        view_take(view, 2 * 4); // leds_min, leds_max
+        parsed.leds_count = view_u32(view);
+        uint16_t matrix_size = view_u16(view);
+        if (matrix_size > 0) {
+            parsed.matrix_height = view_u32(view);
+            parsed.matrix_width = view_u32(view);
+            if ((uint64_t)parsed.matrix_height * parsed.matrix_width * 4 != matrix_size - 8u)
+                view->failed = 1;
+            parsed.matrix = view_take(view, matrix_size - 8);
         }
+        if (version >= 4) {
+            uint16_t num_segments = view_u16(view);
+            for (int segment = 0; segment < num_segments && !view->failed; segment++) {
+                view_string(view);
+                view_take(view, 3 * 4); // type, start_idx, leds_count
+            }
         }
+        if (zones != NULL && zone < max)
+            zones[zone] = parsed;
     }
+    return num_zones;
+}
 
-    return NULL;
+// view positioned at the first string field, which follows data_size and type
+static struct openrgb_view controller_view(const struct openrgb_controller_data *controller) {
+    struct openrgb_view view = {controller->data, controller->size, 0, controller->data == NULL};
+    view_take(&view, 2 * 4);
+    return view;
 }
 
-void openrgb_shutdown() {
-    logger(OPENRGB, "Stopping OpenRGB recv thread...");
-    if (openrgb_recv_thread_id) {
-        openrgb_stop_server = 1;
-        pthread_join(openrgb_recv_thread_id, NULL);
+// copies response to the arena and decodes the number of LEDs, returns -1 if data is malformed
+static int parse_controller_data(struct openrgb_connection *connection, const uint8_t *data, uint32_t size,
+                                 struct openrgb_controller_data *result) {
+    uint8_t *copy = arena_copy(connection, data, size);
+    if (copy == NULL)
+        return -1;
+    result->data = copy;
+    result->size = size;
+    result->version = connection->using_version;
+
+    struct openrgb_view view = controller_view(result);
+    int strings = result->version > 1 ? 6 : 5; // name, vendor (since version 2), description, version, serial, location
+    for (int string = 0; string < strings; string++) {
+        view_string(&view);
+    }
+    view_skip_modes(&view, result->version);
+    view_zones(&view, result->version, NULL, 0);
+    uint16_t num_leds = view_u16(&view);
+    for (int led = 0; led < num_leds && !view.failed; led++) {
+        view_string(&view);
+        view_take(&view, 4); // value
+    }
+    view_take(&view, 4 * view_u16(&view)); // colors
+    result->num_leds = view.failed ? 0 : num_leds;
+    // FNV-1a
+    result->signature = 2166136261u;
+    for (uint32_t i = 0; i < size; i++) {
+        result->signature = (result->signature ^ copy[i]) * 16777619u;
     }
+    return view.failed ? -1 : 0;
+}
+
+enum controller_string { NAME, VENDOR, DESCRIPTION, VERSION, SERIAL, LOCATION };
 
-    if (openrgb_socket >= 0) {
-        pthread_mutex_lock(&openrgb_send_mutex);
-        close(openrgb_socket);
-        pthread_mutex_unlock(&openrgb_send_mutex);
-        openrgb_socket = -1;
+static const char *controller_string(const struct openrgb_controller_data *controller, enum controller_string field) {
+    if (controller->version <= 1 && field >= VENDOR) {
+        // no vendor before version 2
+        if (field == VENDOR)
+            return "";
+        field--;
     }
+    struct openrgb_view view = controller_view(controller);
+    const char *string = NULL;
+    for (int index = 0; index <= field; index++) {
+        string = view_string(&view);
+    }
+    return string != NULL ? string : "";
+}
 
-    if (openrgb_exit == 1) {
-        openrgb_needs_reinit = 0;
-        if (openrgb_reconnect_thread_id)
-            pthread_join(openrgb_reconnect_thread_id, NULL);
+const char *openrgb_controller_name(const struct openrgb_controller_data *controller) {
+    return controller_string(controller, NAME);
+}
+
+const char *openrgb_controller_vendor(const struct openrgb_controller_data *controller) {
+    return controller_string(controller, VENDOR);
+}
+
+const char *openrgb_controller_serial(const struct openrgb_controller_data *controller) {
+    return controller_string(controller, SERIAL);
+}
+
+const char *openrgb_controller_location(const struct openrgb_controller_data *controller) {
+    return controller_string(controller, LOCATION);
+}
+
+int openrgb_controller_zones(const struct openrgb_controller_data *controller, struct openrgb_zone *zones, int max) {
+    struct openrgb_view view = controller_view(controller);
+    for (int string = 0; string < (controller->version > 1 ? 6 : 5); string++) {
+        view_string(&view);
     }
+    view_skip_modes(&view, controller->version);
+    int num_zones = view_zones(&view, controller->version, zones, max);
+    return view.failed ? -1 : num_zones;
+}
 
-    logger(OPENRGB, "Releasing memory, allocated for OpenRGB");
-    for (int i = 0; i < openrgb_devices_num; i++) {
-        if (openrgb_controllers[i].name) {
-            free(openrgb_controllers[i].name);
+// handles a complete packet from the server, called by the recv thread
+static void handle_packet(struct openrgb_connection *connection, uint32_t pkt_dev_idx, uint32_t pkt_id,
+                          const uint8_t *data, uint32_t size) {
+    switch (pkt_id) {
+    case OPENRGB_NET_PACKET_ID_REQUEST_CONTROLLER_DATA: {
+        logger_debug(OPENRGB, "NET_PACKET_ID_REQUEST_CONTROLLER_DATA for device %u, %u bytes.", pkt_dev_idx, size);
+        pthread_mutex_lock(&connection->response_mutex);
+        uint8_t expected = connection->controllers_pending != NULL &&
+                           pkt_dev_idx < (uint32_t)connection->fetching_count &&
+                           connection->controllers_pending[pkt_dev_idx];
+        pthread_mutex_unlock(&connection->response_mutex);
+        if (!expected) {
+            logger_debug(OPENRGB, "Controller data of device %u wasn't requested, ignoring it.", pkt_dev_idx);
+            break;
         }
-        if (openrgb_controllers[i].vendor) {
-            free(openrgb_controllers[i].vendor);
+        uint64_t start_us = get_time_us();
+        struct openrgb_controller_data result = {0};
+        if (parse_controller_data(connection, data, size, &result) != 0)
+            logger(OPENRGB, "%s: Controller data of device %u is malformed.", connection->name, pkt_dev_idx);
+        logger(OPENRGB, "%s: Device #%u \"%s\": %u LEDs, %u bytes, parsed in %lu us.", connection->name, pkt_dev_idx,
+               openrgb_controller_name(&result), result.num_leds, size, get_time_us() - start_us);
+        pthread_mutex_lock(&connection->send_mutex);
+        struct openrgb_controller_data *controller = &connection->fetching[pkt_dev_idx];
+        if (connection->fetching == connection->controllers &&
+            (controller->signature != result.signature || controller->num_leds != result.num_leds)) {
+            // cached packet is built again with the new number of LEDs
+            if (controller->data == NULL && controller->signature != 0)
+                connection->controllers_changed++;
+            if (connection->update_packets != NULL)
+                connection->update_packets[pkt_dev_idx].data = NULL;
+            if (connection->zone_maps != NULL)
+                connection->zone_maps[pkt_dev_idx] = NULL; // zone layout may differ
         }
-        if (openrgb_controllers[i].description) {
-            free(openrgb_controllers[i].description);
+        *controller = result;
+        pthread_mutex_unlock(&connection->send_mutex);
+        pthread_mutex_lock(&connection->response_mutex);
+        take_response(connection, &connection->controllers_pending[pkt_dev_idx]);
+        uint8_t all_parsed = --connection->controllers_missing == 0;
+        pthread_mutex_unlock(&connection->response_mutex);
+        if (all_parsed) {
+            pthread_mutex_lock(&connection->send_mutex);
+            connection->parsed_all_devices = 1;
+            pthread_mutex_unlock(&connection->send_mutex);
         }
-        if (openrgb_controllers[i].version) {
-            free(openrgb_controllers[i].version);
+        break;
+    }
+    case OPENRGB_NET_PACKET_ID_REQUEST_PROTOCOL_VERSION: {
+        logger_debug(OPENRGB, "NET_PACKET_ID_REQUEST_PROTOCOL_VERSION");
+        uint32_t openrgb_version = 0;
+        pthread_mutex_lock(&connection->response_mutex);
+        if (connection->version_pending && size >= 4) {
+            memcpy(&openrgb_version, data, 4);
+            connection->using_version =
+                openrgb_version <= OPENRGB_SUPPORTED_VERSION ? openrgb_version : OPENRGB_SUPPORTED_VERSION;
+            take_response(connection, &connection->version_pending);
+            logger_debug(OPENRGB, "OpenRGB Server's Version: %d, Client max supported version: %d, Using version: %d",
+                         openrgb_version, OPENRGB_SUPPORTED_VERSION, connection->using_version);
         }
-        if (openrgb_controllers[i].serial) {
-            free(openrgb_controllers[i].serial);
+        pthread_mutex_unlock(&connection->response_mutex);
+        break;
+    }
+    case OPENRGB_NET_PACKET_ID_REQUEST_CONTROLLER_COUNT: {
+        logger_debug(OPENRGB, "OPENRGB_NET_PACKET_ID_REQUEST_CONTROLLER_COUNT");
+        pthread_mutex_lock(&connection->response_mutex);
+        if (connection->count_pending && size >= 4) {
+            memcpy(&connection->reported_count, data, 4);
+            take_response(connection, &connection->count_pending);
+            logger_debug(OPENRGB, "Got OpenRGB devices: %d", connection->reported_count);
         }
-        if (openrgb_controllers[i].location) {
-            free(openrgb_controllers[i].location);
+        pthread_mutex_unlock(&connection->response_mutex);
+        break;
+    }
+    case OPENRGB_NET_PACKET_ID_DEVICE_LIST_UPDATED:
+        // controllers are fetched again by the connection thread, this thread has to receive them
+        logger(OPENRGB, "%s: OpenRGB device list was changed.", connection->name);
+        connection->needs_refresh = 1;
+        wake_connection(connection);
+        break;
+    default:
+        logger_debug(OPENRGB, "Skipping packet %u of %u bytes.", pkt_id, size);
+        break;
+    }
+}
+
+void *openrgb_recv_thread(void *arg) {
+    struct openrgb_connection *connection = arg;
+    logger(OPENRGB, "Started OpenRGB receive thread!");
+    // received bytes which don't make a whole packet yet, grows up to the size of the packet being received
+    size_t capacity = OPENRGB_RECV_BUFFER_SIZE, length = 0;
+    uint8_t *buffer = malloc(capacity);
+    uint8_t broken = buffer == NULL;
+
+    while (!openrgb_stop_server && !broken) {
+        struct pollfd fd = {connection->socket, POLLIN, 0};
+        int ready = poll(&fd, 1, -1); // close_connection() shuts the socket down to stop the thread
+        if (ready < 0 && errno != EINTR) {
+            logger(OPENRGB, "Failed to wait for data: %s", strerror(errno));
+            broken = 1;
+            break;
         }
+        if (ready <= 0)
+            continue;
 
-        if (openrgb_controllers[i].modes) {
-            for (int mode = 0; mode < openrgb_controllers[i].num_modes; mode++) {
-                if (openrgb_controllers[i].modes[mode].mode_name != NULL)
-                    free(openrgb_controllers[i].modes[mode].mode_name);
-                if (openrgb_controllers[i].modes[mode].mode_colors != NULL)
-                    free(openrgb_controllers[i].modes[mode].mode_colors);
+        ssize_t received = recv(connection->socket, buffer + length, capacity - length, MSG_DONTWAIT);
+        if (received < 0) {
+            if (errno == EWOULDBLOCK || errno == EAGAIN || errno == EINTR)
+                continue;
+            logger(OPENRGB, "Failed to receive data: %s", strerror(errno));
+            broken = 1;
+            break;
+        }
+        if (received == 0) {
+            if (!connection->closing)
+                logger(OPENRGB, "%s: Connection closed by peer", connection->name);
+            broken = 1;
+            break;
+        }
+        length += received;
+        // a server with Nagle's algorithm holds back its next response until this data is acknowledged
+        int quick_ack = 1;
+        setsockopt(connection->socket, IPPROTO_TCP, TCP_QUICKACK, &quick_ack, sizeof(quick_ack));
+
+        // handles all complete packets, the rest waits for more data
+        size_t parsed = 0, needed = 0, skipped = 0;
+        while (length - parsed >= 16) {
+            const uint8_t *header = buffer + parsed;
+            if (memcmp(header, "ORGB", 4) != 0) {
+                // not a packet start, skipping until the next magick
+                parsed++;
+                skipped++;
+                continue;
+            }
+            uint32_t pkt_dev_idx = 0, pkt_id = 0, pkt_size = 0;
+            memcpy(&pkt_dev_idx, header + 4, 4);
+            memcpy(&pkt_id, header + 8, 4);
+            memcpy(&pkt_size, header + 12, 4);
+            if (pkt_size > OPENRGB_MAX_PACKET_SIZE) {
+                logger(OPENRGB, "OpenRGB packet %u has %u bytes, it's too big, reconnecting.", pkt_id, pkt_size);
+                broken = 1;
+                break;
+            }
+            if (length - parsed < 16 + (size_t)pkt_size) {
+                needed = 16 + (size_t)pkt_size;
+                break;
             }
+            handle_packet(connection, pkt_dev_idx, pkt_id, header + 16, pkt_size);
+            parsed += 16 + pkt_size;
         }
-        free(openrgb_controllers[i].modes);
-
-        if (openrgb_controllers[i].zones) {
-            for (int zone = 0; zone < openrgb_controllers[i].num_zones; zone++) {
-                if (openrgb_controllers[i].zones[zone].zone_name)
-                    free(openrgb_controllers[i].zones[zone].zone_name);
-                if (openrgb_controllers[i].zones[zone].zone_matrix_data != NULL)
-                    free(openrgb_controllers[i].zones[zone].zone_matrix_data);
+        if (skipped > 0)
+            logger_debug(OPENRGB, "Magick wrong! Skipped %lu bytes which are not a OpenRGB package.", skipped);
+        memmove(buffer, buffer + parsed, length - parsed);
+        length -= parsed;
+
+        if (needed > capacity) {
+            uint8_t *grown = realloc(buffer, needed);
+            if (grown == NULL) {
+                logger(OPENRGB, "Failed to allocate %lu bytes for OpenRGB packet.", needed);
+                broken = 1;
+                break;
             }
+            buffer = grown;
+            capacity = needed;
         }
-        free(openrgb_controllers[i].zones);
+    }
+    free(buffer);
+
+    pthread_mutex_lock(&connection->response_mutex);
+    connection->connection_closed = 1;
+    pthread_cond_broadcast(&connection->response_cond);
+    pthread_mutex_unlock(&connection->response_mutex);
+    if (broken && !connection->closing && !openrgb_stop_server) {
+        connection->needs_reinit = 1;
+        wake_connection(connection);
+    }
+    return NULL;
+}
 
-        if (openrgb_controllers[i].leds) {
-            for (int led = 0; led < openrgb_controllers[i].num_leds; led++) {
-                if (openrgb_controllers[i].leds[led].led_name)
-                    free(openrgb_controllers[i].leds[led].led_name);
-            }
+// handles DEVICE_LIST_UPDATED: controllers are fetched into a new table which then replaces the old one at once.
+// Controllers with the same data keep their UPDATELEDS packets, even if their index changed. The new table and the
+// packets it keeps are made in a new generation of the arena, the old generation is freed after the swap.
+static void refresh_devices(struct openrgb_connection *connection) {
+    uint64_t start_us = get_time_us();
+    openrgb_request_controller_count(connection);
+    if (wait_response(connection, &connection->count_pending, 2000000) != 0 || connection->reported_count < 0) {
+        drop_responses(connection);
+        logger(OPENRGB, "%s: OpenRGB didn't report its controllers, reconnecting.", connection->name);
+        connection->needs_reinit = 1;
+        return;
+    }
+    int32_t count = connection->reported_count;
+    if (count > OPENRGB_MAX_CONTROLLERS) {
+        logger(OPENRGB, "%s: OpenRGB reported %d controllers, at most %d are supported, reconnecting.",
+               connection->name, count, OPENRGB_MAX_CONTROLLERS);
+        connection->needs_reinit = 1;
+        return;
+    }
+    struct openrgb_arena_block *old_blocks = arena_detach(connection);
+    struct openrgb_controller_data *table = start_fetch(connection, count);
+    struct openrgb_update_packet *packets = arena_calloc(connection, count * sizeof(struct openrgb_update_packet));
+    struct openrgb_zone_map **zone_maps = arena_calloc(connection, count * sizeof(struct openrgb_zone_map *));
+    if (table == NULL || packets == NULL || zone_maps == NULL) {
+        arena_attach(connection, old_blocks);
+        connection->needs_reinit = 1;
+        return;
+    }
+    for (int device = 0; device < count; device++) {
+        openrgb_request_controller_data(connection, device);
+    }
+    if (wait_response(connection, NULL, 4000000) != 0) {
+        // devices of a partial table would have no LEDs, the old one stays until the connection starts over
+        logger(OPENRGB, "%s: Not all controllers came after device list change, reconnecting.", connection->name);
+        drop_responses(connection);
+        arena_attach(connection, old_blocks);
+        connection->needs_reinit = 1;
+        return;
+    }
+
+    int changed = 0;
+    pthread_mutex_lock(&connection->send_mutex);
+    struct openrgb_controller_data *old_table = connection->controllers;
+    int32_t old_count = connection->devices_num;
+    for (int32_t device = 0; device < count; device++) {
+        int32_t old = -1;
+        for (int32_t index = 0; index < old_count && old < 0 && table[device].data != NULL; index++) {
+            // same index first, then anywhere
+            int32_t candidate = (device + index) % old_count;
+            if (old_table[candidate].signature == table[device].signature)
+                old = candidate;
         }
-        free(openrgb_controllers[i].leds);
+        if (old < 0) {
+            changed++;
+            continue;
+        }
+        // kept packets are copied, packets which don't fit anymore are built again on first use
+        const struct openrgb_update_packet *packet =
+            connection->update_packets != NULL ? &connection->update_packets[old] : NULL;
+        if (packet != NULL && packet->data != NULL) {
+            packets[device] = *packet;
+            packets[device].data = arena_copy(connection, packet->data, packet->size);
+            if (packets[device].data != NULL)
+                memcpy(packets[device].data + 4, &device, 4); // device index in header
+        }
+        if (connection->zone_maps != NULL && connection->zone_maps[old] != NULL)
+            zone_maps[device] = copy_zone_map(connection, connection->zone_maps[old], device);
     }
-    if (openrgb_controllers)
-        free(openrgb_controllers);
+    int removed = old_count - (count - changed);
+    connection->controllers = table;
+    connection->update_packets = packets;
+    connection->zone_maps = zone_maps;
+    connection->devices_num = count;
+    pthread_mutex_unlock(&connection->send_mutex);
+    arena_free(old_blocks);
+    size_t arena_used, arena_size;
+    arena_usage(connection, &arena_used, &arena_size);
+    logger(OPENRGB, "%s: Device list updated in %lu ms: %d controllers, %d new or changed, %d gone, %lu bytes used.",
+           connection->name, (get_time_us() - start_us) / 1000, count, changed, removed > 0 ? removed : 0,
+           arena_used);
+
+#ifndef ORGBCONFIGURATOR
+    resolve_devices(connection, 0);
+    openrgb_cache_save(connection, connection->controllers, count);
+    sync_all_devices(connection);
+#endif
+}
 
-    for (int i = 0; i < openrgb_using_devices_num; i++) {
-        if (openrgb_devices_to_change[i].name)
-            free(openrgb_devices_to_change[i].name);
+static void *connection_thread_func(void *arg) {
+    struct openrgb_connection *connection = arg;
+    uint8_t connected = openrgb_init(connection) == 0;
+    while (connected && !openrgb_stop_server) {
+        if (connection->needs_reinit) {
+            logger(OPENRGB, "%s: Connection to OpenRGB is lost, reconnecting.", connection->name);
+            close_connection(connection);
+            connected = establish_connection(connection, 1) == 0;
+        } else if (connection->needs_refresh) {
+            connection->needs_refresh = 0;
+            refresh_devices(connection);
+        } else {
+            wait_event(connection, -1);
+        }
     }
-    free(openrgb_devices_to_change);
+    close_connection(connection);
+    set_state(connection, OPENRGB_DISCONNECTED);
+    logger(OPENRGB, "%s: OpenRGB connection thread exiting.", connection->name);
+    return NULL;
 }
 
-void *openrgb_reconnect_thread(void *arg) {
-    logger(OPENRGB, "Started reconnect watcher thread...");
-    while (!openrgb_stop_server) {  // if not shut down
-        if (openrgb_needs_reinit) { // if connection was closed
-            openrgb_needs_reinit = 0;
+void openrgb_connection_destroy(struct openrgb_connection *connection) {
+    close_connection(connection);
+    set_state(connection, OPENRGB_DISCONNECTED);
+#ifndef ORGBCONFIGURATOR
+    openrgb_cache_free(connection);
+#endif
+    for (int end = 0; end < 2; end++) {
+        if (connection->wake_pipe[end] >= 0)
+            close(connection->wake_pipe[end]);
+        connection->wake_pipe[end] = -1;
+    }
+    pthread_cond_destroy(&connection->response_cond);
+    pthread_cond_destroy(&connection->sync_cond);
+}
 
-            logger(OPENRGB, "Connection to OpenRGB is closed, need to reinit OpenRGB.");
-            openrgb_shutdown();
+int openrgb_start() {
+    struct openrgb_connection *connections = calloc(OPENRGB_SERVERS_COUNT, sizeof(struct openrgb_connection));
+    if (connections == NULL) {
+        logger(OPENRGB, "Failed to allocate OpenRGB connections");
+        return -1;
+    }
+    for (int server = 0; server < OPENRGB_SERVERS_COUNT; server++) {
+        openrgb_connection_init(&connections[server], server);
+    }
+    // wake pipes are ready, a signal may use them from now on
+    openrgb_connections = connections;
+    openrgb_connections_count = OPENRGB_SERVERS_COUNT;
+
+    for (int server = 0; server < openrgb_connections_count; server++) {
+        struct openrgb_connection *connection = &openrgb_connections[server];
+        sync_start(connection);
+        if (pthread_create(&connection->connection_thread, NULL, connection_thread_func, connection) != 0) {
+            logger(OPENRGB, "%s: Failed to create OpenRGB connection thread", connection->name);
+            continue;
+        }
+        connection->connection_thread_started = 1;
+    }
+    return 0;
+}
 
-            usleep(500000);
-            logger(OPENRGB, "Initializing OpenRGB again");
-            openrgb_init();
+void openrgb_shutdown() {
+    openrgb_stop_server = 1;
+    openrgb_wake();
+    openrgb_sync_stop();
+    for (int server = 0; server < openrgb_connections_count; server++) {
+        struct openrgb_connection *connection = &openrgb_connections[server];
+        // a handshake in progress stops waiting for its responses
+        pthread_mutex_lock(&connection->response_mutex);
+        pthread_cond_broadcast(&connection->response_cond);
+        pthread_mutex_unlock(&connection->response_mutex);
+    }
+    for (int server = 0; server < openrgb_connections_count; server++) {
+        struct openrgb_connection *connection = &openrgb_connections[server];
+        if (connection->connection_thread_started) {
+            logger(OPENRGB, "Stopping OpenRGB connection thread of %s...", connection->name);
+            pthread_join(connection->connection_thread, NULL);
+            connection->connection_thread_started = 0;
         }
-        usleep(100000);
+        logger(OPENRGB, "Releasing memory, allocated for OpenRGB %s", connection->name);
+        openrgb_connection_destroy(connection);
+
+        struct openrgb_status status;
+        openrgb_get_status(connection, &status);
+        if (status.connections > 1)
+            logger(OPENRGB, "%s: Reconnected %lu times, the last reconnect took %lu ms, the longest %lu ms.",
+                   connection->name, status.connections - 1, status.last_reconnect_us / 1000,
+                   status.longest_reconnect_us / 1000);
     }
-    logger(OPENRGB, "Reconnect watcher thread exiting.");
-    return NULL;
-}
\ No newline at end of file
+    // a signal may still look at the connections, they stay allocated until exit
+    openrgb_connections_count = 0;
+}
@@ -1,6 +1,7 @@
 #ifndef OPENRGB_H
 #define OPENRGB_H
 
+#include "../globals/globals.h"
 #include "../utils/utils.h"
 #include <pthread.h>
 #include <signal.h>
@@ -26,100 +27,205 @@
 
 #define OPENRGB_SUPPORTED_VERSION 4
 
-extern int openrgb_socket;
-extern pthread_t openrgb_recv_thread_id;
-extern pthread_mutex_t openrgb_send_mutex;
-extern int8_t openrgb_using_version;
-extern int32_t openrgb_devices_num;
-extern struct openrgb_controller_data *openrgb_controllers;
-extern int8_t openrgb_parsed_all_devices;
-extern volatile sig_atomic_t openrgb_stop_server, openrgb_exit;
-
-struct openrgb_controller_data {
-    // NET_PACKET_ID_REQUEST_CONTROLLER_DATA response type for version 3 of OpenRGB SDK
-    uint32_t data_size; // size of all data in packet
-    int32_t type;       // RGBController type field value
-
-    uint16_t name_len; // Length of RGBController name field string, including null termination
-    uint8_t *name;     // RGBController name field string value, including null termination
-
-    uint16_t vendor_len; // Length of RGBController vendor field string, including null termination
-    uint8_t *vendor;     // RGBController vendor field string value, including null termination
-
-    uint16_t description_len; // Length of RGBController description field string, including null termination
-    uint8_t *description;     // RGBController description field string value, including null termination
-
-    uint16_t version_len; // Length of RGBController version field string, including null termination
-    uint8_t *version;     // RGBController version field string value, including null termination
-
-    uint16_t serial_len; // Length of RGBController serial field string, including null termination
-    uint8_t *serial;     // RGBController serial field string value, including null termination
-
-    uint16_t location_len; // Length of RGBController location field string, including null termination
-    uint8_t *location;     // RGBController location field string value, including null termination
+// Colors go to OpenRGB from a sync worker of each server, so the render engine never waits for a PC. The engine
+// leaves the latest color in a slot of every worker, colors a worker didn't get to are dropped. Every device gets at
+// most OPENRGB_MAX_RATE updates per second and no more than one per round-trip time of the connection. When more
+// than OPENRGB_MAX_QUEUED bytes wait in the socket for the PC, devices postpone their updates and the interval
+// between them doubles (up to OPENRGB_MAX_INTERVAL_US), then shrinks again while updates get through.
+#define OPENRGB_MAX_RATE 60
+#define OPENRGB_MAX_QUEUED 65536
+#define OPENRGB_MAX_INTERVAL_US 1000000
+#define OPENRGB_SYNC_MAX_DEVICES 64
+// UPDATELEDS packets are cached per device with their header and batched into one sendmsg, up to this many
+#define OPENRGB_BATCH_MAX 64
+
+// With OPENRGB_SPATIAL of the config the engine publishes a canvas instead of one color: a `width` x `height` grid
+// sampled onto the LEDs of every zone. Matrix zones spread their cells over the whole canvas, LEDs of other zones lie
+// along its middle row. The LED to pixel index maps are built once per zone and canvas size, frames only copy colors
+// through them, and zones whose colors didn't change are not sent again.
+#define OPENRGB_CANVAS_WIDTH 64 // of the canvas the engine renders effects on
+#define OPENRGB_CANVAS_MAX_PIXELS 1024
+#define OPENRGB_MAX_ZONES 64 // mapped zones of a device, the rest keeps its colors
+
+struct openrgb_canvas {
+    uint16_t width;
+    uint16_t height;
+    struct Color pixels[OPENRGB_CANVAS_MAX_PIXELS]; // row by row
+};
 
-    uint16_t num_modes;              // Number of modes in RGBController
-    uint8_t active_mode;             // RGBController active_mode field value
-    struct openrgb_mode_data *modes; // See Mode Data block format table.  Repeat num_modes times
+// Responses are framed in a receive buffer which starts at OPENRGB_RECV_BUFFER_SIZE and grows to the size of the
+// packet being received. Bigger packets than OPENRGB_MAX_PACKET_SIZE break the connection.
+#define OPENRGB_RECV_BUFFER_SIZE 4096
+#define OPENRGB_MAX_PACKET_SIZE (16 * 1024 * 1024)
+#define OPENRGB_MAX_REQUEST_PAYLOAD 16 // of requests sent by the client, UPDATELEDS aside
+#define OPENRGB_MAX_CONTROLLERS 4096    // a server reporting more is taken as broken
+
+// The connection is kept by a thread of its own, which sleeps until the recv thread reports a broken connection or a
+// changed device list. Failed attempts are repeated after a delay which doubles from OPENRGB_RECONNECT_MIN_MS up to
+// OPENRGB_RECONNECT_MAX of the config, randomized down to half of it. A connect which doesn't complete in
+// OPENRGB_CONNECT_TIMEOUT_MS counts as failed.
+#define OPENRGB_RECONNECT_MIN_MS 250
+#define OPENRGB_CONNECT_TIMEOUT_MS 3000
+
+// state of the connection
+#define OPENRGB_DISCONNECTED 0 // not started or stopped
+#define OPENRGB_CONNECTING 1
+#define OPENRGB_WAITING 2   // for the next attempt after a failed one
+#define OPENRGB_HANDSHAKE 3 // connected, fetching controllers
+#define OPENRGB_READY 4
+
+struct openrgb_status {
+    uint8_t state;
+    uint32_t failed_attempts;   // since the connection was lost
+    uint64_t next_attempt_us;   // get_time_us() of the next attempt while waiting
+    uint64_t connections;       // connections which got ready
+    uint64_t last_reconnect_us; // from losing the connection to being ready again, 0 before the first reconnect
+    uint64_t longest_reconnect_us;
+};
 
-    uint16_t num_zones;              // Number of zones in RGBController
-    struct openrgb_zone_data *zones; // See Zone Data block format table.  Repeat num_zones times
+// Devices picked by openrgb_configurator and the controller cache, see openrgb_cache.h. Files of the first server
+// have these names, files of other servers get ".<address>:<port>" appended.
+#define OPENRGB_CONFIG_FILE "/etc/piled/openrgb_config"
+#define OPENRGB_CACHE_FILE "/etc/piled/openrgb_cache"
 
-    uint16_t num_leds;             // Number of LEDs in RGBController
-    struct openrgb_led_data *leds; // See LED Data block format table.  Repeat num_leds times
+extern volatile sig_atomic_t openrgb_stop_server;
 
-    uint16_t num_colors; // Number of colors in RGBController
-    uint8_t *colors;     // RGBController colors field values
+// NET_PACKET_ID_REQUEST_CONTROLLER_DATA response, kept as received in the arena of the connection. Only num_leds
+// is decoded when it arrives, other fields are read on demand by openrgb_controller_*() with bounds checks.
+struct openrgb_controller_data {
+    const uint8_t *data;
+    uint32_t size;
+    int8_t version;     // protocol version the data was requested with
+    uint16_t num_leds;  // 0 if data is malformed
+    uint32_t signature; // FNV-1a of data, changes with anything about the controller
 };
 
-struct openrgb_mode_data {
-    uint16_t mode_name_len;       // Length of mode name string, including null termination
-    uint8_t *mode_name;           // Mode name string value, including null termination
-    uint32_t mode_value;          // Mode value field value
-    uint32_t mode_flags;          // Mode flags field value
-    uint32_t mode_speed_min;      // Mode speed_min field value
-    uint32_t mode_speed_max;      // Mode speed_max field value
-    uint32_t mode_brightness_min; // Mode brightness_min field value
-    uint32_t mode_brightness_max; // Mode brightness_max field value
-    uint32_t mode_colors_min;     // Mode colors_min field value
-    uint32_t mode_colors_max;     // Mode colors_max field value
-    uint32_t mode_speed;          // Mode speed value
-    uint32_t mode_brightness;     // Mode brightness value
-    uint32_t mode_direction;      // Mode direction value
-    uint32_t mode_color_mode;     // Mode color_mode value
-    uint32_t mode_num_colors;     // Mode number of colors
-    uint32_t *mode_colors;        // Mode color values
+// zone of controller data, pointers are into the data
+struct openrgb_zone {
+    const char *name;
+    uint32_t type;
+    uint32_t leds_count;
+    uint32_t matrix_height; // 0 without a matrix map
+    uint32_t matrix_width;
+    const uint8_t *matrix; // height * width LED indexes of 4 bytes, row by row, unaligned
 };
 
-struct openrgb_zone_data {
-    uint16_t zone_name_len;
-    uint8_t *zone_name;
-    uint32_t zone_type;
-    uint32_t zone_leds_min;
-    uint32_t zone_leds_max;
-    uint32_t zone_leds_count;
-    uint16_t zone_matrix_len;
-    uint32_t zone_matrix_height;
-    uint32_t zone_matrix_width;
-    uint32_t *zone_matrix_data;
+// Controller data and per-device buffers of a connection are taken from blocks of OPENRGB_ARENA_BLOCK_SIZE (or
+// bigger for bigger controllers), which are freed at once when the connection is closed. Controllers fetched again
+// after DEVICE_LIST_UPDATED start a new generation of blocks, the previous one is freed once they replace it.
+#define OPENRGB_ARENA_BLOCK_SIZE (64 * 1024)
+
+// state of devices in the sync worker, by position in devices_to_change
+struct openrgb_sync_device {
+    uint8_t sent; // `color` was sent
+    struct Color color;
+    uint64_t next_us;     // earliest time of the next update
+    uint64_t interval_us; // between updates, grows while the PC doesn't keep up
+    uint64_t updates;
+    uint64_t deferred; // updates postponed because the socket was full
+    uint32_t frame;    // sync_sequence of the last canvas sent
 };
 
-struct openrgb_led_data {
-    uint16_t led_name_len;
-    uint8_t *led_name;
-    uint32_t led_value;
+struct openrgb_update_packet;
+struct openrgb_zone_map;
+struct openrgb_arena_block;
+struct openrgb_cache;
+
+// One OpenRGB server of OPENRGB_SERVERS. Every connection has its own socket, controllers, threads and sync worker,
+// so a slow or offline PC never holds up the others.
+struct openrgb_connection {
+    char name[64]; // address:port, for logs
+    const char *address;
+    int port;
+    char config_file[128];
+    char cache_file[128];
+    struct openrgb_cache *cache; // loaded on first use
+
+    int socket;
+    pthread_mutex_t send_mutex; // socket, controllers, update packets and devices to change
+    int8_t using_version;
+    int32_t devices_num;
+    struct openrgb_controller_data *controllers;
+    int8_t parsed_all_devices;
+    struct openrgb_device *devices_to_change; // picked in config_file
+    int32_t using_devices_num;
+    struct openrgb_update_packet *update_packets; // by device index, devices_num of them
+    struct openrgb_zone_map **zone_maps;          // same, built by the first canvas sent to the device
+    pthread_mutex_t arena_mutex;
+    struct openrgb_arena_block *arena;
+
+    // requests waiting for their response, which is matched by packet ID and device index
+    pthread_mutex_t response_mutex;
+    pthread_cond_t response_cond; // waits on CLOCK_MONOTONIC
+    uint8_t version_pending, count_pending;
+    uint8_t *controllers_pending; // by device index
+    // table filled by controller data responses, controllers or the one replacing it after DEVICE_LIST_UPDATED
+    struct openrgb_controller_data *fetching;
+    int32_t fetching_count;
+    int32_t reported_count; // from the last controller count response
+    int responses_pending, controllers_missing;
+    int controllers_changed;   // controllers resumed from cache whose data turned out different
+    uint8_t connection_closed; // recv thread stopped, no more responses come
+
+    // the connection thread sleeps on wake_pipe until the recv thread, a signal or openrgb_shutdown() wakes it
+    pthread_t connection_thread, recv_thread;
+    uint8_t connection_thread_started, recv_thread_started;
+    volatile sig_atomic_t needs_reinit;  // connection broke
+    volatile sig_atomic_t needs_refresh; // server sent DEVICE_LIST_UPDATED
+    volatile sig_atomic_t closing;       // connection is closed by us, the recv thread doesn't report it
+    int wake_pipe[2];
+    unsigned int jitter_seed;
+    pthread_mutex_t status_mutex;
+    struct openrgb_status status;
+
+    pthread_mutex_t sync_mutex;
+    pthread_cond_t sync_cond; // waits on CLOCK_MONOTONIC
+    pthread_t sync_thread;
+    uint8_t sync_running;
+    struct Color sync_color; // latest color of the engine
+    uint8_t sync_spatial;    // sync_canvas is shown instead of sync_color
+    struct openrgb_canvas sync_canvas;
+    uint32_t sync_sequence, sync_colors, sync_dropped;
+    uint8_t sync_reset; // devices were fetched again, all of them need the color
+    uint64_t sync_zones_sent, sync_zones_unchanged;
+    struct openrgb_sync_device sync_devices[OPENRGB_SYNC_MAX_DEVICES];
 };
 
+extern struct openrgb_connection *openrgb_connections; // one for each of OPENRGB_SERVERS, made by openrgb_start()
+extern int openrgb_connections_count;
+
+// fields of controller data, "" if the field is missing or malformed
+const char *openrgb_controller_name(const struct openrgb_controller_data *controller);
+const char *openrgb_controller_vendor(const struct openrgb_controller_data *controller);
+const char *openrgb_controller_serial(const struct openrgb_controller_data *controller);
+const char *openrgb_controller_location(const struct openrgb_controller_data *controller);
+// fills first `max` zones, returns number of zones or -1 if data is malformed
+int openrgb_controller_zones(const struct openrgb_controller_data *controller, struct openrgb_zone *zones, int max);
+
 void openrgb_init_header(uint8_t *header, uint32_t pkt_dev_idx, uint32_t pkt_id, uint32_t pkg_size);
-void *openrgb_init();
+// prepares connection to OPENRGB_SERVERS[server] without connecting
+void openrgb_connection_init(struct openrgb_connection *connection, int server);
+void openrgb_connection_destroy(struct openrgb_connection *connection); // closes connection
+// connects, retrying with backoff, and fetches controllers. Returns 0 once ready, -1 if stopped before.
+int openrgb_init(struct openrgb_connection *connection);
+// connects to all OPENRGB_SERVERS, each connection keeps itself in its own thread: openrgb_init(), then reconnects
+// and device list updates. Colors are sent by a sync worker per connection.
+int openrgb_start();
 void openrgb_shutdown();
-void openrgb_request_protocol_version();
-void openrgb_set_client_name();
-void openrgb_request_controller_count();
-void openrgb_request_controller_data(uint32_t pkt_dev_idx);
-void openrgb_request_update_leds(uint32_t pkt_dev_idx, struct Color color);
-void openrgb_set_color_on_devices(struct Color color);
-void *openrgb_recv_thread(void *arg);
-void *openrgb_reconnect_thread(void *arg);
+void openrgb_wake(); // async-signal-safe, lets connection threads see openrgb_stop_server
+void openrgb_get_status(struct openrgb_connection *connection, struct openrgb_status *status);
+void openrgb_request_protocol_version(struct openrgb_connection *connection);
+void openrgb_set_client_name(struct openrgb_connection *connection);
+void openrgb_request_controller_count(struct openrgb_connection *connection);
+void openrgb_request_controller_data(struct openrgb_connection *connection, uint32_t pkt_dev_idx);
+// -1 if connection broke
+int openrgb_request_update_leds(struct openrgb_connection *connection, uint32_t pkt_dev_idx, struct Color color);
+int openrgb_request_update_leds_batch(struct openrgb_connection *connection, const uint32_t *devices, int count,
+                                      struct Color color);
+void openrgb_set_color_on_devices(struct openrgb_connection *connection, struct Color color);
+void openrgb_sync_stop(); // prints statistics
+void openrgb_sync_color(struct Color color); // returns immediately, color is sent by sync workers of all servers
+void openrgb_sync_canvas(const struct openrgb_canvas *canvas); // same, LEDs show the canvas mapped onto them
+void *openrgb_recv_thread(void *arg);        // `arg` is the connection
 
 #endif
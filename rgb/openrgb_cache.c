@@ -0,0 +1,259 @@
+#include "openrgb_cache.h"
+#include "../globals/globals.h"
+#include "../utils/utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define OPENRGB_CACHE_MAGIC "PLOC"
+#define OPENRGB_CACHE_VERSION 1
+#define OPENRGB_CACHE_MAX_ENTRIES 4096 // sanity limit for controllers and pins of a file
+
+// layout of the cache file: header, controllers and pins, fixed size fields in host byte order
+struct cache_header {
+    char magic[4];
+    uint32_t version;
+    uint32_t controllers;
+    uint32_t pins;
+    int64_t config_mtime; // of openrgb_config when pins were made
+};
+
+struct cache_identity {
+    char name[64]; // truncated strings, terminated
+    char serial[64];
+    char location[128];
+};
+
+struct cache_controller {
+    struct cache_identity identity;
+    uint32_t signature;
+    uint16_t num_leds;
+    uint16_t num_zones;
+    uint32_t zone_leds[OPENRGB_CACHE_MAX_ZONES];
+};
+
+struct cache_pin {
+    uint32_t config_index; // number of device in openrgb_config
+    struct cache_identity identity;
+};
+
+// cache of a connection, loaded from its file on first use
+struct openrgb_cache {
+    struct cache_controller *cached;
+    uint32_t cached_count;
+    struct cache_pin *pins;
+    uint32_t pins_count;
+};
+
+static int64_t config_mtime(const struct openrgb_connection *connection) {
+    struct stat st;
+    return stat(connection->config_file, &st) == 0 ? (int64_t)st.st_mtime : 0;
+}
+
+// returns cache of the connection, NULL if there is no memory for it
+static struct openrgb_cache *load_cache(struct openrgb_connection *connection) {
+    if (connection->cache != NULL)
+        return connection->cache;
+    struct openrgb_cache *cache = connection->cache = calloc(1, sizeof(struct openrgb_cache));
+    if (cache == NULL)
+        return NULL;
+    FILE *file = fopen(connection->cache_file, "rb");
+    if (file == NULL)
+        return cache;
+    struct cache_header header;
+    if (fread(&header, sizeof(header), 1, file) != 1 ||
+        memcmp(header.magic, OPENRGB_CACHE_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != OPENRGB_CACHE_VERSION || header.controllers > OPENRGB_CACHE_MAX_ENTRIES ||
+        header.pins > OPENRGB_CACHE_MAX_ENTRIES) {
+        logger(OPENRGB, "%s is not a controller cache of this PiLED version, ignoring it.", connection->cache_file);
+        fclose(file);
+        return cache;
+    }
+    cache->cached = calloc(header.controllers + 1, sizeof(struct cache_controller));
+    cache->pins = calloc(header.pins + 1, sizeof(struct cache_pin));
+    if (cache->cached == NULL || cache->pins == NULL ||
+        fread(cache->cached, sizeof(*cache->cached), header.controllers, file) != header.controllers ||
+        fread(cache->pins, sizeof(*cache->pins), header.pins, file) != header.pins) {
+        logger(OPENRGB, "Failed to read controller cache %s, ignoring it.", connection->cache_file);
+        free(cache->cached);
+        free(cache->pins);
+        cache->cached = NULL;
+        cache->pins = NULL;
+        fclose(file);
+        return cache;
+    }
+    fclose(file);
+    cache->cached_count = header.controllers;
+    cache->pins_count = header.pins;
+    if (header.config_mtime != config_mtime(connection)) {
+        // devices were picked again, old pins mean other devices now
+        cache->pins_count = 0;
+    }
+    logger(OPENRGB, "%s: Loaded %u cached controllers and %u pinned devices.", connection->name, cache->cached_count,
+           cache->pins_count);
+    return cache;
+}
+
+int openrgb_cache_resume(struct openrgb_connection *connection, struct openrgb_controller_data *controllers,
+                         int32_t count) {
+    struct openrgb_cache *cache = load_cache(connection);
+    if (cache == NULL || cache->cached == NULL || count <= 0 || cache->cached_count != (uint32_t)count)
+        return -1;
+    for (int32_t i = 0; i < count; i++) {
+        controllers[i].data = NULL; // comes with the fetch
+        controllers[i].size = 0;
+        controllers[i].num_leds = cache->cached[i].num_leds;
+        controllers[i].signature = cache->cached[i].signature;
+    }
+    return 0;
+}
+
+// identity of controller from its data, or from the cache while its data is not fetched yet
+static struct cache_identity identity_of(const struct openrgb_cache *cache,
+                                         const struct openrgb_controller_data *controllers, int32_t index) {
+    struct cache_identity identity = {0};
+    if (controllers[index].data != NULL) {
+        snprintf(identity.name, sizeof(identity.name), "%s", openrgb_controller_name(&controllers[index]));
+        snprintf(identity.serial, sizeof(identity.serial), "%s", openrgb_controller_serial(&controllers[index]));
+        snprintf(identity.location, sizeof(identity.location), "%s",
+                 openrgb_controller_location(&controllers[index]));
+    } else if (cache->cached != NULL && (uint32_t)index < cache->cached_count) {
+        identity = cache->cached[index].identity;
+    }
+    return identity;
+}
+
+static uint8_t same_identity(const struct cache_identity *a, const struct cache_identity *b) {
+    return a->name[0] != 0 && strcmp(a->name, b->name) == 0 && strcmp(a->serial, b->serial) == 0 &&
+           strcmp(a->location, b->location) == 0;
+}
+
+static struct cache_pin *find_pin(struct openrgb_cache *cache, uint32_t config_index) {
+    for (uint32_t pin = 0; pin < cache->pins_count; pin++) {
+        if (cache->pins[pin].config_index == config_index)
+            return &cache->pins[pin];
+    }
+    return NULL;
+}
+
+int openrgb_cache_resolve_devices(struct openrgb_connection *connection,
+                                  const struct openrgb_controller_data *controllers, int32_t count) {
+    struct openrgb_cache *cache = load_cache(connection);
+    int moved = 0;
+    for (int32_t device = 0; device < connection->using_devices_num && cache != NULL; device++) {
+        struct openrgb_device *configured = &connection->devices_to_change[device];
+        uint32_t key = configured->config_index;
+        struct cache_pin *pin = find_pin(cache, key);
+        if (pin == NULL) {
+            // first time the device is seen, it is what openrgb_config points to, if the name still fits
+            int32_t index = key < (uint32_t)count ? (int32_t)key : count;
+            struct cache_identity identity;
+            if (index < count)
+                identity = identity_of(cache, controllers, index);
+            if (configured->name != NULL && (index == count || strcmp(identity.name, (char *)configured->name) != 0)) {
+                for (index = 0; index < count; index++) {
+                    identity = identity_of(cache, controllers, index);
+                    if (strcmp(identity.name, (char *)configured->name) == 0)
+                        break;
+                }
+            }
+            if (index >= count)
+                continue;
+            configured->device_id = index;
+            struct cache_pin *grown = realloc(cache->pins, (cache->pins_count + 1) * sizeof(struct cache_pin));
+            if (identity.name[0] == 0 || grown == NULL)
+                continue;
+            cache->pins = grown;
+            cache->pins[cache->pins_count].config_index = key;
+            cache->pins[cache->pins_count++].identity = identity;
+            continue;
+        }
+
+        struct cache_identity identity;
+        if (configured->device_id < (uint32_t)count) {
+            identity = identity_of(cache, controllers, configured->device_id);
+            if (same_identity(&pin->identity, &identity))
+                continue;
+        }
+        int32_t found = -1;
+        for (int32_t index = 0; index < count && found < 0; index++) {
+            identity = identity_of(cache, controllers, index);
+            if (same_identity(&pin->identity, &identity))
+                found = index;
+        }
+        // serial and location may change with USB ports, the name is the last resort
+        for (int32_t index = 0; index < count && found < 0; index++) {
+            identity = identity_of(cache, controllers, index);
+            if (strcmp(pin->identity.name, identity.name) == 0)
+                found = index;
+        }
+        if (found < 0) {
+            logger(OPENRGB, "%s: Device \"%s\" of openrgb_config is not connected.", connection->name,
+                   pin->identity.name);
+        } else if ((uint32_t)found != configured->device_id) {
+            logger(OPENRGB, "%s: Device \"%s\" moved from #%u to #%d.", connection->name, pin->identity.name,
+                   configured->device_id, found);
+            configured->device_id = found;
+            moved++;
+        }
+    }
+    return moved;
+}
+
+void openrgb_cache_save(struct openrgb_connection *connection, const struct openrgb_controller_data *controllers,
+                        int32_t count) {
+    struct openrgb_cache *cache = load_cache(connection);
+    if (cache == NULL || count <= 0 || count > OPENRGB_CACHE_MAX_ENTRIES)
+        return;
+    struct cache_controller *entries = calloc(count, sizeof(struct cache_controller));
+    if (entries == NULL)
+        return;
+    for (int32_t i = 0; i < count; i++) {
+        if (controllers[i].data == NULL) {
+            // not fetched, what was cached about it is still the best guess
+            if (cache->cached != NULL && (uint32_t)i < cache->cached_count)
+                entries[i] = cache->cached[i];
+            continue;
+        }
+        entries[i].identity = identity_of(cache, controllers, i);
+        entries[i].signature = controllers[i].signature;
+        entries[i].num_leds = controllers[i].num_leds;
+        struct openrgb_zone zones[OPENRGB_CACHE_MAX_ZONES];
+        int num_zones = openrgb_controller_zones(&controllers[i], zones, OPENRGB_CACHE_MAX_ZONES);
+        entries[i].num_zones = num_zones > 0 ? num_zones : 0;
+        for (int zone = 0; zone < num_zones && zone < OPENRGB_CACHE_MAX_ZONES; zone++) {
+            entries[i].zone_leds[zone] = zones[zone].leds_count;
+        }
+    }
+    free(cache->cached);
+    cache->cached = entries;
+    cache->cached_count = count;
+
+    // written aside and renamed, so a crash leaves the old cache
+    struct cache_header header = {OPENRGB_CACHE_MAGIC, OPENRGB_CACHE_VERSION, cache->cached_count, cache->pins_count,
+                                  config_mtime(connection)};
+    char temporary[sizeof(connection->cache_file) + 4];
+    snprintf(temporary, sizeof(temporary), "%s.tmp", connection->cache_file);
+    FILE *file = fopen(temporary, "wb");
+    if (file == NULL) {
+        logger(OPENRGB, "Failed to write controller cache %s.", connection->cache_file);
+        return;
+    }
+    uint8_t written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+                      fwrite(cache->cached, sizeof(*cache->cached), cache->cached_count, file) == cache->cached_count &&
+                      fwrite(cache->pins, sizeof(*cache->pins), cache->pins_count, file) == cache->pins_count;
+    if (fclose(file) != 0 || !written || rename(temporary, connection->cache_file) != 0) {
+        logger(OPENRGB, "Failed to write controller cache %s.", connection->cache_file);
+        remove(temporary);
+    }
+}
+
+void openrgb_cache_free(struct openrgb_connection *connection) {
+    if (connection->cache == NULL)
+        return;
+    free(connection->cache->cached);
+    free(connection->cache->pins);
+    free(connection->cache);
+    connection->cache = NULL;
+}
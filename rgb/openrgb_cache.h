@@ -0,0 +1,26 @@
+#ifndef OPENRGB_CACHE_H
+#define OPENRGB_CACHE_H
+
+#include "openrgb.h"
+#include <stdint.h>
+
+// Controllers of the last connection to a server are kept in its cache file next to its openrgb_config: signature,
+// identity (name, serial, location), LED count and zone layout of each. After a reconnect updates resume from the
+// cache as soon as the server reports the same controller count, while controller data is fetched again in the
+// background and only controllers with another signature are replaced.
+// The cache also pins every device of openrgb_config to the identity it had, so the device is found again after
+// the PC reorders its controllers. Pins are dropped when openrgb_config changes.
+#define OPENRGB_CACHE_MAX_ZONES 16
+
+// fills controllers from the cache, returns -1 if there is no cache for `count` controllers
+int openrgb_cache_resume(struct openrgb_connection *connection, struct openrgb_controller_data *controllers,
+                         int32_t count);
+// maps devices of openrgb_config to controllers with their pinned identity, returns number of moved devices.
+// Called with send_mutex of the connection locked.
+int openrgb_cache_resolve_devices(struct openrgb_connection *connection,
+                                  const struct openrgb_controller_data *controllers, int32_t count);
+void openrgb_cache_save(struct openrgb_connection *connection, const struct openrgb_controller_data *controllers,
+                        int32_t count);
+void openrgb_cache_free(struct openrgb_connection *connection);
+
+#endif // OPENRGB_CACHE_H
@@ -10,33 +10,34 @@
 #include <termios.h>
 #include <unistd.h>
 
-void display_menu(bool selected[], int current_device) {
-    for (int i = 0; i < openrgb_devices_num; i++) {
+void display_menu(struct openrgb_connection *connection, bool selected[], int current_device) {
+    for (int i = 0; i < connection->devices_num; i++) {
         printf("%s  [%c] Name: %s, Vendor: %s\n", (i == current_device) ? "->" : "  ", selected[i] ? 'x' : ' ',
-               openrgb_controllers[i].name, openrgb_controllers[i].vendor);
+               openrgb_controller_name(&connection->controllers[i]),
+               openrgb_controller_vendor(&connection->controllers[i]));
     }
 }
 
-void save_selected_devices(bool selected[]) {
+void save_selected_devices(struct openrgb_connection *connection, bool selected[]) {
     struct stat st = {0};
     if (stat("/etc/piled", &st) == -1) {
         mkdir("/etc/piled", 0755);
     }
-    FILE *file = fopen("/etc/piled/openrgb_config", "w");
+    FILE *file = fopen(connection->config_file, "w");
     if (file == NULL) {
-        perror("Failed to open file at /etc/piled/openrgb_config, please run configurator with root.");
+        fprintf(stderr, "Failed to open file at %s, please run configurator with root.\n", connection->config_file);
         return;
     }
 
-    for (int i = 0; i < openrgb_devices_num; i++) {
+    for (int i = 0; i < connection->devices_num; i++) {
         if (selected[i]) {
-            fprintf(file, "#%d: %s\n", i, openrgb_controllers[i].name);
+            fprintf(file, "#%d: %s\n", i, openrgb_controller_name(&connection->controllers[i]));
         }
     }
-    chmod("/etc/piled/openrgb_config", strtol("0644", 0, 8));
+    chmod(connection->config_file, strtol("0644", 0, 8));
     fclose(file);
 
-    printf("Selected devices saved to '/etc/piled/openrgb_config'.\n");
+    printf("Selected devices saved to '%s'.\n", connection->config_file);
 }
 
 // https://stackoverflow.com/a/16361724
@@ -68,38 +69,45 @@ int main(int argc, char *argv[]) {
 
     parse_args(argc, argv);
 
-    if (OPENRGB_SERVER) {
-        openrgb_init();
-    } else {
+    if (OPENRGB_SERVERS_COUNT == 0) {
         logger(OPENRGB, "OpenRGB server ip not set! Aborting.");
         return -1;
     }
 
-    bool selected[openrgb_devices_num];
-    memset(selected, false, sizeof(selected));
-    int current_device = 0;
-    char input;
+    // devices of every server are picked one server after another
+    for (int server = 0; server < OPENRGB_SERVERS_COUNT; server++) {
+        struct openrgb_connection connection;
+        openrgb_connection_init(&connection, server);
+        if (openrgb_init(&connection) != 0)
+            return -1;
 
-    while (1) {
-        system("clear");
-        printf("Please, choose which devices PiLED need to set color too:\n");
-        display_menu(selected, current_device);
+        int32_t devices_num = connection.devices_num;
+        bool selected[devices_num];
+        memset(selected, false, sizeof(selected));
+        int current_device = 0;
+        char input;
 
-        printf("\nUse arrow keys to navigate, space to toggle, 'q' to quit and save.\n");
+        while (1) {
+            system("clear");
+            printf("Please, choose which devices of %s PiLED need to set color too:\n", connection.name);
+            display_menu(&connection, selected, current_device);
 
-        input = getch();
-        if (input == 'q') {
-            break;
-        } else if (input == ' ') {
-            selected[current_device] = !selected[current_device];
-        } else if (input == 'w' || input == 65) {
-            current_device = (current_device - 1 + openrgb_devices_num) % openrgb_devices_num;
-        } else if (input == 's' || input == 66) {
-            current_device = (current_device + 1) % openrgb_devices_num;
+            printf("\nUse arrow keys to navigate, space to toggle, 'q' to quit and save.\n");
+
+            input = getch();
+            if (input == 'q') {
+                break;
+            } else if (input == ' ') {
+                selected[current_device] = !selected[current_device];
+            } else if (input == 'w' || input == 65) {
+                current_device = (current_device - 1 + devices_num) % devices_num;
+            } else if (input == 's' || input == 66) {
+                current_device = (current_device + 1) % devices_num;
+            }
         }
-    }
 
-    save_selected_devices(selected);
+        save_selected_devices(&connection, selected);
 
-    openrgb_shutdown();
+        openrgb_connection_destroy(&connection);
+    }
 }
\ No newline at end of file
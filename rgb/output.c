@@ -0,0 +1,95 @@
+#include "output.h"
+#include "../globals/globals.h"
+#include "../utils/utils.h"
+#include "color.h"
+#include <stddef.h>
+#include <string.h>
+
+static const struct output_backend *output_backends[] = {
+    &output_pigpiod,
+    &output_sysfs,
+#ifdef PIGPIO_DIRECT
+    &output_pigpio,
+#endif
+    &output_spi,
+    &output_mock,
+    NULL,
+};
+
+const struct output_backend *output = &output_pigpiod;
+
+int output_select(const char *name) {
+    if (name == NULL) {
+        output = &output_pigpiod;
+        return 0;
+    }
+
+    for (int i = 0; output_backends[i] != NULL; i++) {
+        if (strcmp(output_backends[i]->name, name) == 0) {
+            output = output_backends[i];
+            logger_debug(GPIO, "Selected \"%s\" output backend", output->name);
+            return 0;
+        }
+    }
+
+    logger(GPIO, "Unknown output backend \"%s\"! Available backends:", name);
+    for (int i = 0; output_backends[i] != NULL; i++) {
+        logger(GPIO, "  %s", output_backends[i]->name);
+    }
+    return -1;
+}
+
+static int output_setup_pin(int pin) {
+    if (pin < 0 || pin >= OUTPUT_MAX_PINS) {
+        logger(GPIO, "Pin %d is out of range of supported pins (0-%d)!", pin, OUTPUT_MAX_PINS - 1);
+        return -1;
+    }
+    if (output->setup_pin(pin) != 0) {
+        logger(GPIO, "Failed to set up pin %d for output.", pin);
+        return -1;
+    }
+    int real_range = output->set_range(pin, PWM_RANGE);
+    if (real_range < 0) {
+        logger(GPIO, "Failed to set PWM range %d on pin %d.", PWM_RANGE, pin);
+        return -1;
+    }
+    if (real_range < PWM_RANGE) {
+        logger(GPIO, "Pin %d has only %d real PWM steps at current frequency, lower PWM_FREQUENCY to use range %d.",
+               pin, real_range, PWM_RANGE);
+    }
+    return 0;
+}
+
+int output_init() {
+    logger(GPIO, "Initializing \"%s\" output backend.", output->name);
+    if (output->init() != 0) {
+        logger(GPIO, "Failed to initialize \"%s\" output backend.", output->name);
+        return -1;
+    }
+
+    for (int strip = 0; strip < STRIPS_COUNT; strip++) {
+        if ((STRIPS[strip].pixels > 0) != (output->set_pixels != NULL)) {
+            logger(GPIO, "Output \"%s\" is %s, but \"%s\" backend is not.", STRIPS[strip].name,
+                   STRIPS[strip].pixels ? "addressable" : "PWM", output->name);
+            output->shutdown();
+            return -1;
+        }
+        if (STRIPS[strip].pixels)
+            continue; // pixels are checked by the backend
+        for (int i = 0; i < 4; i++) {
+            int pin = STRIPS[strip].pins[i];
+            if (pin == -1 && i == COLOR_WHITE)
+                continue; // plain RGB strip
+            if (output_setup_pin(pin) != 0) {
+                output->shutdown();
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+void output_shutdown() {
+    logger(GPIO, "Shutting down \"%s\" output backend.", output->name);
+    output->shutdown();
+}
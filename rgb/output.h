@@ -0,0 +1,57 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <stdint.h>
+
+#define OUTPUT_MAX_PINS 64
+#define OUTPUT_MAX_PIXELS 4096
+
+// LED output backend.
+// Everything that changes a duty cycle goes through the backend selected by OUTPUT_BACKEND in config,
+// so the same binary can drive pigpiod, kernel PWM, in-process pigpio or just record frames.
+struct output_backend {
+    const char *name;
+    int (*init)();                                  // connect to/open the device, 0 on success
+    void (*shutdown)();                             // release everything acquired at init
+    int (*setup_pin)(unsigned pin);                 // prepare pin (or PWM channel) for output
+    int (*set_range)(unsigned pin, unsigned range); // returns real range of the pin, negative on error
+    int (*set_duty)(unsigned pin, unsigned duty);   // duty in range 0..range
+    int (*get_duty)(unsigned pin);                  // last duty set on pin, negative on error
+    void (*commit)();                               // called once after all channels of one frame were set
+    // optional, NULL when not supported: loop `frame_count` frames of `pin_count` duty cycles each in hardware,
+    // `frame_us` per frame, until stop_waveform is called. Returns 0 when playing.
+    int (*play_waveform)(const unsigned *pins, uint8_t pin_count, const uint32_t *frames, uint32_t frame_count,
+                         uint32_t frame_us);
+    void (*stop_waveform)();
+    // addressable backends only, NULL for PWM ones: channels per pixel (3 or 4) and setting `count` pixels
+    // starting at `first` to the same RED, GREEN, BLUE (and WHITE) values
+    int (*pixel_channels)();
+    int (*set_pixels)(unsigned first, unsigned count, const uint8_t *values);
+};
+
+extern const struct output_backend output_pigpiod;
+extern const struct output_backend output_sysfs;
+#ifdef PIGPIO_DIRECT
+extern const struct output_backend output_pigpio;
+#endif
+extern const struct output_backend output_spi;
+extern const struct output_backend output_mock;
+
+extern const struct output_backend *output; // currently selected backend, pigpiod by default
+
+int output_select(const char *name);
+int output_init();
+void output_shutdown();
+
+// mock backend frame recording
+#define OUTPUT_MOCK_RING_SIZE 4096
+
+struct output_mock_frame {
+    uint64_t timestamp_us;
+    uint16_t duty[OUTPUT_MAX_PINS];
+};
+
+uint32_t output_mock_frames_count();
+int output_mock_get_frame(uint32_t index, struct output_mock_frame *frame);
+
+#endif // OUTPUT_H
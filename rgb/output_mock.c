@@ -0,0 +1,136 @@
+#include "../globals/globals.h"
+#include "../utils/utils.h"
+#include "output.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+// Mock backend: no hardware at all, every committed frame is timestamped and kept in a ring buffer
+// (or appended to MOCK_OUTPUT_FILE when set). Used for benchmarking and testing on any machine.
+
+static uint16_t mock_duty[OUTPUT_MAX_PINS];
+static uint8_t mock_pin_used[OUTPUT_MAX_PINS];
+static struct output_mock_frame mock_frames[OUTPUT_MOCK_RING_SIZE];
+static uint32_t mock_frames_total = 0;
+static FILE *mock_file = NULL;
+static pthread_mutex_t mock_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int mock_init() {
+    memset(mock_duty, 0, sizeof(mock_duty));
+    memset(mock_pin_used, 0, sizeof(mock_pin_used));
+    mock_frames_total = 0;
+    if (MOCK_OUTPUT_FILE) {
+        mock_file = fopen(MOCK_OUTPUT_FILE, "w");
+        if (mock_file == NULL) {
+            logger(GPIO, "mock: failed to open %s for writing", MOCK_OUTPUT_FILE);
+            return -1;
+        }
+        logger(GPIO, "mock: recording frames to %s", MOCK_OUTPUT_FILE);
+    } else {
+        logger(GPIO, "mock: recording last %d frames in memory", OUTPUT_MOCK_RING_SIZE);
+    }
+    return 0;
+}
+
+static void mock_shutdown() {
+    pthread_mutex_lock(&mock_mutex);
+    uint32_t count = mock_frames_total < OUTPUT_MOCK_RING_SIZE ? mock_frames_total : OUTPUT_MOCK_RING_SIZE;
+    if (count > 1) {
+        // frame interval statistics of what is still in the ring, handy for comparing engine changes
+        uint32_t first = mock_frames_total - count;
+        uint64_t min_interval = UINT64_MAX, max_interval = 0;
+        for (uint32_t i = first + 1; i < mock_frames_total; i++) {
+            uint64_t interval = mock_frames[i % OUTPUT_MOCK_RING_SIZE].timestamp_us -
+                                mock_frames[(i - 1) % OUTPUT_MOCK_RING_SIZE].timestamp_us;
+            if (interval < min_interval)
+                min_interval = interval;
+            if (interval > max_interval)
+                max_interval = interval;
+        }
+        uint64_t span = mock_frames[(mock_frames_total - 1) % OUTPUT_MOCK_RING_SIZE].timestamp_us -
+                        mock_frames[first % OUTPUT_MOCK_RING_SIZE].timestamp_us;
+        logger(GPIO, "mock: %u frames total; last %u: avg interval %lu us, min %lu us, max %lu us", mock_frames_total,
+               count, span / (count - 1), min_interval, max_interval);
+    } else {
+        logger(GPIO, "mock: %u frames total", mock_frames_total);
+    }
+    if (mock_file) {
+        fclose(mock_file);
+        mock_file = NULL;
+    }
+    pthread_mutex_unlock(&mock_mutex);
+}
+
+static int mock_setup_pin(unsigned pin) {
+    if (pin >= OUTPUT_MAX_PINS)
+        return -1;
+    mock_pin_used[pin] = 1;
+    return 0;
+}
+
+static int mock_set_range(unsigned pin, unsigned range) {
+    if (pin >= OUTPUT_MAX_PINS)
+        return -1;
+    return range;
+}
+
+static int mock_set_duty(unsigned pin, unsigned duty) {
+    if (pin >= OUTPUT_MAX_PINS)
+        return -1;
+    mock_duty[pin] = duty;
+    return 0;
+}
+
+static int mock_get_duty(unsigned pin) {
+    if (pin >= OUTPUT_MAX_PINS)
+        return -1;
+    return mock_duty[pin];
+}
+
+static void mock_commit() {
+    pthread_mutex_lock(&mock_mutex);
+    struct output_mock_frame *frame = &mock_frames[mock_frames_total % OUTPUT_MOCK_RING_SIZE];
+    frame->timestamp_us = get_time_us();
+    memcpy(frame->duty, mock_duty, sizeof(mock_duty));
+    mock_frames_total++;
+
+    if (mock_file) {
+        fprintf(mock_file, "%lu", frame->timestamp_us);
+        for (int pin = 0; pin < OUTPUT_MAX_PINS; pin++) {
+            if (mock_pin_used[pin])
+                fprintf(mock_file, " %d:%u", pin, frame->duty[pin]);
+        }
+        fprintf(mock_file, "\n");
+    }
+    pthread_mutex_unlock(&mock_mutex);
+}
+
+uint32_t output_mock_frames_count() {
+    pthread_mutex_lock(&mock_mutex);
+    uint32_t count = mock_frames_total;
+    pthread_mutex_unlock(&mock_mutex);
+    return count;
+}
+
+int output_mock_get_frame(uint32_t index, struct output_mock_frame *frame) {
+    pthread_mutex_lock(&mock_mutex);
+    // only the last OUTPUT_MOCK_RING_SIZE frames are kept
+    if (index >= mock_frames_total || mock_frames_total - index > OUTPUT_MOCK_RING_SIZE) {
+        pthread_mutex_unlock(&mock_mutex);
+        return -1;
+    }
+    *frame = mock_frames[index % OUTPUT_MOCK_RING_SIZE];
+    pthread_mutex_unlock(&mock_mutex);
+    return 0;
+}
+
+const struct output_backend output_mock = {
+    .name = "mock",
+    .init = mock_init,
+    .shutdown = mock_shutdown,
+    .setup_pin = mock_setup_pin,
+    .set_range = mock_set_range,
+    .set_duty = mock_set_duty,
+    .get_duty = mock_get_duty,
+    .commit = mock_commit,
+};
@@ -0,0 +1,79 @@
+#ifdef PIGPIO_DIRECT
+#include "../globals/globals.h"
+#include "../utils/utils.h"
+#include "output.h"
+#include "waveform.h"
+#include <pigpio.h>
+
+// in-process pigpio: no daemon round trip per duty change.
+// Needs root and can't be used while pigpiod is running, since both want the DMA channels.
+
+static int pigpio_direct_init() {
+    if (gpioInitialise() < 0) {
+        logger(GPIO, "pigpio: gpioInitialise failed, is pigpiod still running?");
+        return -1;
+    }
+    logger(GPIO, "pigpio: initialized in-process GPIO access.");
+    return 0;
+}
+
+static void pigpio_direct_shutdown() { gpioTerminate(); }
+
+static int pigpio_direct_setup_pin(unsigned pin) {
+    if (gpioSetMode(pin, PI_OUTPUT) != 0)
+        return -1;
+    if (PWM_FREQUENCY > 0 && gpioSetPWMfrequency(pin, PWM_FREQUENCY) < 0)
+        return -1;
+    return 0;
+}
+
+static int pigpio_direct_set_range(unsigned pin, unsigned range) {
+    if (gpioSetPWMrange(pin, range) < 0)
+        return -1;
+    return gpioGetPWMrealRange(pin);
+}
+
+static int pigpio_direct_set_duty(unsigned pin, unsigned duty) { return gpioPWM(pin, duty); }
+
+static int pigpio_direct_get_duty(unsigned pin) { return gpioGetPWMdutycycle(pin); }
+
+static void pigpio_direct_commit() {}
+
+static int pigpio_direct_wave_clear() { return gpioWaveClear(); }
+static int pigpio_direct_wave_create() { return gpioWaveCreate(); }
+
+static const struct waveform_ops pigpio_direct_waveform_ops = {
+    .clear = pigpio_direct_wave_clear,
+    .add_generic = gpioWaveAddGeneric,
+    .create = pigpio_direct_wave_create,
+    .chain = gpioWaveChain,
+};
+
+static int pigpio_direct_play_waveform(const unsigned *pins, uint8_t pin_count, const uint32_t *frames,
+                                       uint32_t frame_count, uint32_t frame_us) {
+    // hardware PWM would fight with the waveform for the pins
+    for (int i = 0; i < pin_count; i++) {
+        gpioPWM(pins[i], 0);
+    }
+    return waveform_play(&pigpio_direct_waveform_ops, pins, pin_count, frames, frame_count, frame_us);
+}
+
+static void pigpio_direct_stop_waveform() {
+    gpioWaveTxStop();
+    gpioWaveClear();
+}
+
+const struct output_backend output_pigpio = {
+    .name = "pigpio",
+    .init = pigpio_direct_init,
+    .shutdown = pigpio_direct_shutdown,
+    .setup_pin = pigpio_direct_setup_pin,
+    .set_range = pigpio_direct_set_range,
+    .set_duty = pigpio_direct_set_duty,
+    .get_duty = pigpio_direct_get_duty,
+    .commit = pigpio_direct_commit,
+    .play_waveform = pigpio_direct_play_waveform,
+    .stop_waveform = pigpio_direct_stop_waveform,
+};
+
+#endif
@@ -0,0 +1,79 @@
+#include "../globals/globals.h"
+#include "../utils/utils.h"
+#include "output.h"
+#include "pigpiod_if2.h"
+#include "waveform.h"
+
+// default backend: PWM through the pigpio daemon, local or over the network
+
+static int pigpiod_init() {
+    int handle = pigpio_start(PI_ADDR, PI_PORT);
+    if (handle < 0) {
+        logger(GPIO, "Pigpio initialization failed.");
+        return -1;
+    }
+    pi = handle;
+    logger(GPIO, "Connected to pigpio daemon successfully!");
+    return 0;
+}
+
+static void pigpiod_shutdown() { pigpio_stop(pi); }
+
+static int pigpiod_setup_pin(unsigned pin) {
+    if (set_mode(pi, pin, PI_OUTPUT) != 0)
+        return -1;
+    if (PWM_FREQUENCY > 0 && set_PWM_frequency(pi, pin, PWM_FREQUENCY) < 0)
+        return -1;
+    return 0;
+}
+
+static int pigpiod_set_range(unsigned pin, unsigned range) {
+    if (set_PWM_range(pi, pin, range) < 0)
+        return -1;
+    return get_PWM_real_range(pi, pin);
+}
+
+static int pigpiod_set_duty(unsigned pin, unsigned duty) { return set_PWM_dutycycle(pi, pin, duty); }
+
+static int pigpiod_get_duty(unsigned pin) { return get_PWM_dutycycle(pi, pin); }
+
+static void pigpiod_commit() {}
+
+static int pigpiod_wave_clear() { return wave_clear(pi); }
+static int pigpiod_wave_add_generic(unsigned count, gpioPulse_t *pulses) { return wave_add_generic(pi, count, pulses); }
+static int pigpiod_wave_create() { return wave_create(pi); }
+static int pigpiod_wave_chain(char *chain, unsigned length) { return wave_chain(pi, chain, length); }
+
+static const struct waveform_ops pigpiod_waveform_ops = {
+    .clear = pigpiod_wave_clear,
+    .add_generic = pigpiod_wave_add_generic,
+    .create = pigpiod_wave_create,
+    .chain = pigpiod_wave_chain,
+};
+
+static int pigpiod_play_waveform(const unsigned *pins, uint8_t pin_count, const uint32_t *frames, uint32_t frame_count,
+                                 uint32_t frame_us) {
+    // hardware PWM would fight with the waveform for the pins
+    for (int i = 0; i < pin_count; i++) {
+        set_PWM_dutycycle(pi, pins[i], 0);
+    }
+    return waveform_play(&pigpiod_waveform_ops, pins, pin_count, frames, frame_count, frame_us);
+}
+
+static void pigpiod_stop_waveform() {
+    wave_tx_stop(pi);
+    wave_clear(pi);
+}
+
+const struct output_backend output_pigpiod = {
+    .name = "pigpiod",
+    .init = pigpiod_init,
+    .shutdown = pigpiod_shutdown,
+    .setup_pin = pigpiod_setup_pin,
+    .set_range = pigpiod_set_range,
+    .set_duty = pigpiod_set_duty,
+    .get_duty = pigpiod_get_duty,
+    .commit = pigpiod_commit,
+    .play_waveform = pigpiod_play_waveform,
+    .stop_waveform = pigpiod_stop_waveform,
+};
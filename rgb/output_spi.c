@@ -0,0 +1,205 @@
+#include "../globals/globals.h"
+#include "../utils/utils.h"
+#include "output.h"
+#include <fcntl.h>
+#include <linux/spi/spidev.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#elif defined(__SSSE3__)
+#include <tmmintrin.h>
+#endif
+
+// Addressable WS2812/SK6812 strips on SPI MOSI (GPIO10 on Raspberry Pi).
+// Every LED bit is sent as 4 SPI bits at 3.2 MHz: 0 -> 1000, 1 -> 1110, so one SPI byte carries two LED bits
+// and one color byte becomes four SPI bytes. Whole frame goes to spidev with a single write().
+// SPI_DEVICE may also be a regular file, which is handy for benchmarking the encoder without hardware.
+
+#define SPI_SPEED_HZ 3200000
+#define SPI_RESET_BYTES 120 // 300 us of low level latches the frame, newer WS2812B need more than 280 us
+
+static const uint8_t spi_patterns[4] = {0x88, 0x8E, 0xE8, 0xEE}; // two LED bits -> one SPI byte
+static uint8_t spi_lut[256][4];
+
+static int spi_fd = -1;
+static uint8_t spi_is_file = 0;
+static uint8_t spi_channels = 3; // 3 for GRB (WS2812), 4 for GRBW (SK6812)
+static uint32_t spi_pixel_count = 0;
+static uint8_t *spi_pixels = NULL; // frame buffer in wire order, spi_channels bytes per pixel
+static uint8_t *spi_buffer = NULL; // encoded frame followed by reset bytes
+static size_t spi_buffer_size = 0;
+static uint8_t spi_dirty = 0;
+
+static uint64_t spi_frames = 0;
+static uint64_t spi_busy_us = 0; // time spent encoding and writing frames
+
+static void spi_encode(const uint8_t *in, size_t length, uint8_t *out) {
+    size_t i = 0;
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+    // 8 color bytes per iteration: every 2-bit field is looked up in spi_patterns, vst4 interleaves the results
+    const uint8x8_t table = vld1_u8((const uint8_t[8]){0x88, 0x8E, 0xE8, 0xEE, 0, 0, 0, 0});
+    const uint8x8_t mask = vdup_n_u8(3);
+    for (; i + 8 <= length; i += 8) {
+        uint8x8_t bytes = vld1_u8(in + i);
+        uint8x8x4_t spi;
+        spi.val[0] = vtbl1_u8(table, vshr_n_u8(bytes, 6));
+        spi.val[1] = vtbl1_u8(table, vand_u8(vshr_n_u8(bytes, 4), mask));
+        spi.val[2] = vtbl1_u8(table, vand_u8(vshr_n_u8(bytes, 2), mask));
+        spi.val[3] = vtbl1_u8(table, vand_u8(bytes, mask));
+        vst4_u8(out + i * 4, spi);
+    }
+#elif defined(__SSSE3__)
+    // same with pshufb, 16 color bytes per iteration
+    const __m128i table = _mm_setr_epi8((char)0x88, (char)0x8E, (char)0xE8, (char)0xEE, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+                                        0, 0);
+    const __m128i mask = _mm_set1_epi8(3);
+    for (; i + 16 <= length; i += 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i *)(in + i));
+        // there are no 8-bit shifts, bits shifted in from the neighbour byte are masked out
+        __m128i field3 = _mm_shuffle_epi8(table, _mm_and_si128(_mm_srli_epi16(bytes, 6), mask));
+        __m128i field2 = _mm_shuffle_epi8(table, _mm_and_si128(_mm_srli_epi16(bytes, 4), mask));
+        __m128i field1 = _mm_shuffle_epi8(table, _mm_and_si128(_mm_srli_epi16(bytes, 2), mask));
+        __m128i field0 = _mm_shuffle_epi8(table, _mm_and_si128(bytes, mask));
+        __m128i low32 = _mm_unpacklo_epi8(field3, field2);
+        __m128i high32 = _mm_unpackhi_epi8(field3, field2);
+        __m128i low10 = _mm_unpacklo_epi8(field1, field0);
+        __m128i high10 = _mm_unpackhi_epi8(field1, field0);
+        _mm_storeu_si128((__m128i *)(out + i * 4), _mm_unpacklo_epi16(low32, low10));
+        _mm_storeu_si128((__m128i *)(out + i * 4 + 16), _mm_unpackhi_epi16(low32, low10));
+        _mm_storeu_si128((__m128i *)(out + i * 4 + 32), _mm_unpacklo_epi16(high32, high10));
+        _mm_storeu_si128((__m128i *)(out + i * 4 + 48), _mm_unpackhi_epi16(high32, high10));
+    }
+#endif
+    for (; i < length; i++) {
+        memcpy(out + i * 4, spi_lut[in[i]], 4);
+    }
+}
+
+static void spi_shutdown();
+
+static int spi_init() {
+    struct stat st;
+    const char *device = SPI_DEVICE ? SPI_DEVICE : "/dev/spidev0.0";
+
+    spi_channels = SPI_LED_TYPE && strcmp(SPI_LED_TYPE, "sk6812") == 0 ? 4 : 3;
+    spi_pixel_count = 0;
+    for (int strip = 0; strip < STRIPS_COUNT; strip++) {
+        if (STRIPS[strip].first_pixel + STRIPS[strip].pixels > spi_pixel_count)
+            spi_pixel_count = STRIPS[strip].first_pixel + STRIPS[strip].pixels;
+    }
+    if (spi_pixel_count == 0 || spi_pixel_count > OUTPUT_MAX_PIXELS) {
+        logger(GPIO, "spi: outputs must have from 1 to %d PIXELS in total.", OUTPUT_MAX_PIXELS);
+        return -1;
+    }
+
+    for (int value = 0; value < 256; value++) {
+        for (int i = 0; i < 4; i++) {
+            spi_lut[value][i] = spi_patterns[(value >> (6 - 2 * i)) & 3];
+        }
+    }
+
+    spi_fd = open(device, O_WRONLY);
+    if (spi_fd < 0) {
+        logger(GPIO, "spi: failed to open %s", device);
+        return -1;
+    }
+    spi_is_file = fstat(spi_fd, &st) == 0 && S_ISREG(st.st_mode);
+    if (!spi_is_file) {
+        uint8_t mode = SPI_MODE_0;
+        uint8_t bits = 8;
+        uint32_t speed = SPI_SPEED_HZ;
+        if (ioctl(spi_fd, SPI_IOC_WR_MODE, &mode) < 0 || ioctl(spi_fd, SPI_IOC_WR_BITS_PER_WORD, &bits) < 0 ||
+            ioctl(spi_fd, SPI_IOC_WR_MAX_SPEED_HZ, &speed) < 0) {
+            logger(GPIO, "spi: failed to configure %s", device);
+            close(spi_fd);
+            spi_fd = -1;
+            return -1;
+        }
+    }
+
+    spi_pixels = calloc(spi_pixel_count, spi_channels);
+    spi_buffer_size = (size_t)spi_pixel_count * spi_channels * 4 + SPI_RESET_BYTES;
+    spi_buffer = calloc(1, spi_buffer_size); // reset bytes at the end stay zero forever
+    if (!spi_pixels || !spi_buffer) {
+        logger(GPIO, "spi: failed to allocate frame buffer");
+        spi_shutdown();
+        return -1;
+    }
+    spi_frames = spi_busy_us = 0;
+    spi_dirty = 1;
+
+    // addressable LEDs take 8-bit values and do PWM by themselves
+    PWM_RANGE = 255;
+    logger(GPIO, "spi: %u %s pixels on %s, %zu bytes per frame%s", spi_pixel_count, spi_channels == 4 ? "GRBW" : "GRB",
+           device, spi_buffer_size, spi_is_file ? " (regular file, benchmark mode)" : "");
+    return 0;
+}
+
+static void spi_shutdown() {
+    if (spi_frames) {
+        uint64_t frame_us = spi_busy_us / spi_frames;
+        logger(GPIO, "spi: %lu frames, %lu us per frame to encode and write, up to %lu frames per second", spi_frames,
+               frame_us, frame_us ? 1000000 / frame_us : 0);
+    }
+    if (spi_fd >= 0)
+        close(spi_fd);
+    spi_fd = -1;
+    free(spi_pixels);
+    free(spi_buffer);
+    spi_pixels = spi_buffer = NULL;
+}
+
+static int spi_setup_pin(unsigned pin) { return -1; }
+
+static int spi_set_range(unsigned pin, unsigned range) { return -1; }
+
+static int spi_set_duty(unsigned pin, unsigned duty) { return -1; }
+
+static int spi_get_duty(unsigned pin) { return -1; }
+
+static int spi_pixel_channels() { return spi_channels; }
+
+static int spi_set_pixels(unsigned first, unsigned count, const uint8_t *values) {
+    if (first + count > spi_pixel_count)
+        return -1;
+    // wire order is GRB(W)
+    uint8_t pixel[4] = {values[1], values[0], values[2], spi_channels == 4 ? values[3] : 0};
+    uint8_t *out = spi_pixels + (size_t)first * spi_channels;
+    for (unsigned i = 0; i < count; i++, out += spi_channels) {
+        memcpy(out, pixel, spi_channels);
+    }
+    spi_dirty = 1;
+    return 0;
+}
+
+static void spi_commit() {
+    if (!spi_dirty)
+        return;
+    uint64_t start_us = get_time_us();
+    spi_encode(spi_pixels, (size_t)spi_pixel_count * spi_channels, spi_buffer);
+    ssize_t written = spi_is_file ? pwrite(spi_fd, spi_buffer, spi_buffer_size, 0)
+                                  : write(spi_fd, spi_buffer, spi_buffer_size);
+    if (written != (ssize_t)spi_buffer_size)
+        logger_debug(GPIO, "spi: frame write failed, is spidev.bufsiz big enough for %zu bytes?", spi_buffer_size);
+    spi_busy_us += get_time_us() - start_us;
+    spi_frames++;
+    spi_dirty = 0;
+}
+
+const struct output_backend output_spi = {
+    .name = "spi",
+    .init = spi_init,
+    .shutdown = spi_shutdown,
+    .setup_pin = spi_setup_pin,
+    .set_range = spi_set_range,
+    .set_duty = spi_set_duty,
+    .get_duty = spi_get_duty,
+    .commit = spi_commit,
+    .pixel_channels = spi_pixel_channels,
+    .set_pixels = spi_set_pixels,
+};
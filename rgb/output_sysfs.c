@@ -0,0 +1,139 @@
+#include "../globals/globals.h"
+#include "../utils/utils.h"
+#include "output.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Linux kernel PWM through /sys/class/pwm/pwmchipN.
+// Pins are PWM channel numbers of chip SYSFS_PWM_CHIP (e.g. with dtoverlay=pwm-2chan: 0 -> GPIO18, 1 -> GPIO19).
+// duty_cycle files are kept open, so every duty change is a single pwrite().
+
+static int sysfs_duty_fds[OUTPUT_MAX_PINS];
+static uint16_t sysfs_duty[OUTPUT_MAX_PINS];
+static uint16_t sysfs_range[OUTPUT_MAX_PINS];
+
+static int sysfs_write_file(const char *path, const char *value) {
+    int fd = open(path, O_WRONLY);
+    if (fd < 0) {
+        logger_debug(GPIO, "sysfs: failed to open %s", path);
+        return -1;
+    }
+    ssize_t written = write(fd, value, strlen(value));
+    close(fd);
+    return written < 0 ? -1 : 0;
+}
+
+static int sysfs_write_channel_attr(unsigned channel, const char *attr, unsigned long value) {
+    char path[128];
+    char buffer[32];
+    snprintf(path, sizeof(path), "/sys/class/pwm/pwmchip%d/pwm%u/%s", SYSFS_PWM_CHIP, channel, attr);
+    snprintf(buffer, sizeof(buffer), "%lu", value);
+    return sysfs_write_file(path, buffer);
+}
+
+static int sysfs_init() {
+    char path[64];
+    struct stat st;
+    snprintf(path, sizeof(path), "/sys/class/pwm/pwmchip%d", SYSFS_PWM_CHIP);
+    if (stat(path, &st) != 0) {
+        logger(GPIO, "sysfs: %s does not exist, is PWM overlay enabled?", path);
+        return -1;
+    }
+    for (int i = 0; i < OUTPUT_MAX_PINS; i++) {
+        sysfs_duty_fds[i] = -1;
+        sysfs_duty[i] = 0;
+        sysfs_range[i] = 255;
+    }
+    logger(GPIO, "sysfs: using %s with period %d ns", path, SYSFS_PWM_PERIOD);
+    return 0;
+}
+
+static void sysfs_shutdown() {
+    for (int i = 0; i < OUTPUT_MAX_PINS; i++) {
+        if (sysfs_duty_fds[i] >= 0) {
+            close(sysfs_duty_fds[i]);
+            sysfs_duty_fds[i] = -1;
+        }
+    }
+}
+
+static int sysfs_setup_pin(unsigned pin) {
+    char path[128];
+    struct stat st;
+    snprintf(path, sizeof(path), "/sys/class/pwm/pwmchip%d/pwm%u", SYSFS_PWM_CHIP, pin);
+    if (stat(path, &st) != 0) {
+        char export_path[64];
+        char channel[16];
+        snprintf(export_path, sizeof(export_path), "/sys/class/pwm/pwmchip%d/export", SYSFS_PWM_CHIP);
+        snprintf(channel, sizeof(channel), "%u", pin);
+        if (sysfs_write_file(export_path, channel) != 0) {
+            logger(GPIO, "sysfs: failed to export PWM channel %u", pin);
+            return -1;
+        }
+        // udev needs some time to apply permissions on freshly exported channel
+        for (int tries = 0; tries < 10 && stat(path, &st) != 0; tries++) {
+            usleep(10000);
+        }
+    }
+
+    // duty cycle may not exceed period, so reset it before changing period
+    sysfs_write_channel_attr(pin, "duty_cycle", 0);
+    if (sysfs_write_channel_attr(pin, "period", SYSFS_PWM_PERIOD) != 0 ||
+        sysfs_write_channel_attr(pin, "enable", 1) != 0) {
+        logger(GPIO, "sysfs: failed to configure PWM channel %u", pin);
+        return -1;
+    }
+
+    char duty_path[160];
+    snprintf(duty_path, sizeof(duty_path), "%s/duty_cycle", path);
+    sysfs_duty_fds[pin] = open(duty_path, O_WRONLY);
+    if (sysfs_duty_fds[pin] < 0) {
+        logger(GPIO, "sysfs: failed to open %s", duty_path);
+        return -1;
+    }
+    return 0;
+}
+
+static int sysfs_set_range(unsigned pin, unsigned range) {
+    if (pin >= OUTPUT_MAX_PINS || range == 0)
+        return -1;
+    sysfs_range[pin] = range;
+    // kernel PWM is set in nanoseconds, so period in ns is the real number of steps
+    return range < (unsigned)SYSFS_PWM_PERIOD ? (int)range : SYSFS_PWM_PERIOD;
+}
+
+static int sysfs_set_duty(unsigned pin, unsigned duty) {
+    if (pin >= OUTPUT_MAX_PINS || sysfs_duty_fds[pin] < 0)
+        return -1;
+    char buffer[32];
+    unsigned long long duty_ns = (unsigned long long)SYSFS_PWM_PERIOD * duty / sysfs_range[pin];
+    int len = snprintf(buffer, sizeof(buffer), "%llu", duty_ns);
+    if (pwrite(sysfs_duty_fds[pin], buffer, len, 0) < 0) {
+        logger_debug(GPIO, "sysfs: failed to set duty cycle on channel %u", pin);
+        return -1;
+    }
+    sysfs_duty[pin] = duty;
+    return 0;
+}
+
+static int sysfs_get_duty(unsigned pin) {
+    if (pin >= OUTPUT_MAX_PINS)
+        return -1;
+    return sysfs_duty[pin];
+}
+
+static void sysfs_commit() {}
+
+const struct output_backend output_sysfs = {
+    .name = "sysfs",
+    .init = sysfs_init,
+    .shutdown = sysfs_shutdown,
+    .setup_pin = sysfs_setup_pin,
+    .set_range = sysfs_set_range,
+    .set_duty = sysfs_set_duty,
+    .get_duty = sysfs_get_duty,
+    .commit = sysfs_commit,
+};
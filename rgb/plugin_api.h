@@ -0,0 +1,40 @@
+#ifndef PILED_PLUGIN_API_H
+#define PILED_PLUGIN_API_H
+
+// Effect plugin interface of PiLED. This header is all a plugin needs and is installed with piled.
+// A plugin is a shared object in PLUGIN_DIR exporting `const struct piled_plugin piled_plugin`.
+// Only fixed-size types are used and structures only ever grow at the end, so plugins built against older
+// versions keep working as long as PILED_PLUGIN_API_VERSION is the same.
+
+#include <stdint.h>
+
+#define PILED_PLUGIN_API_VERSION 1
+#define PILED_PLUGIN_SYMBOL "piled_plugin"
+#define PILED_PLUGIN_OP_MIN 128 // plugins are started by protocol OPs 128-255
+
+// frame is one output color: red, green and blue, 8.16 fixed point (0 .. 255 << 16)
+#define PILED_FRAME_CHANNELS 3
+
+struct piled_plugin_args {
+    uint32_t size; // sizeof(struct piled_plugin_args) of piled, new fields are only read if they fit
+    uint8_t red, green, blue;
+    uint8_t speed;
+    uint8_t duration;
+};
+
+struct piled_plugin {
+    uint32_t api_version; // PILED_PLUGIN_API_VERSION
+    const char *name;
+    uint8_t op; // protocol OP starting the effect, PILED_PLUGIN_OP_MIN or above
+
+    // Called when the effect is started by a client, may allocate. Returns state passed to other functions,
+    // NULL on failure.
+    void *(*init)(const struct piled_plugin_args *args);
+    // Called by the render engine every tick, `time_us` is time since start. Must not block or allocate,
+    // it delays every output. Returns 0 when the effect has ended, its last frame stays on the output then.
+    int (*render)(void *state, uint64_t time_us, int32_t frame[PILED_FRAME_CHANNELS]);
+    // Called once the effect is no longer shown on any output.
+    void (*destroy)(void *state);
+};
+
+#endif // PILED_PLUGIN_API_H
@@ -0,0 +1,172 @@
+#include "plugins.h"
+#include "../globals/globals.h"
+#include "color.h"
+#include "engine.h"
+#include <dirent.h>
+#include <dlfcn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+struct loaded_plugin {
+    void *handle;
+    const struct piled_plugin *plugin;
+    // render statistics, only touched by the render engine
+    uint64_t renders;
+    uint64_t total_ns;
+    uint64_t max_ns;
+    uint64_t slow_renders;
+};
+
+// one started effect, shared by all strips it was started on
+struct plugin_instance {
+    struct loaded_plugin *loaded;
+    void *state;
+};
+
+static struct loaded_plugin plugins[PLUGINS_MAX];
+static int plugin_count = 0;
+
+static uint64_t get_time_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int plugin_load(const char *path) {
+    void *handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if (handle == NULL) {
+        logger(ANIM, "Failed to load plugin %s: %s", path, dlerror());
+        return -1;
+    }
+    const struct piled_plugin *plugin = dlsym(handle, PILED_PLUGIN_SYMBOL);
+    const char *error = NULL;
+    if (plugin == NULL)
+        error = "no " PILED_PLUGIN_SYMBOL " symbol";
+    else if (plugin->api_version != PILED_PLUGIN_API_VERSION)
+        error = "built for another plugin API version";
+    else if (plugin->name == NULL || plugin->render == NULL)
+        error = "no name or render function";
+    else if (plugin->op < PILED_PLUGIN_OP_MIN || plugin_by_op(plugin->op) != NULL)
+        error = "OP is out of plugin range or already taken";
+    if (error != NULL) {
+        logger(ANIM, "Plugin %s is not loaded: %s.", path, error);
+        dlclose(handle);
+        return -1;
+    }
+
+    plugins[plugin_count++] = (struct loaded_plugin){.handle = handle, .plugin = plugin};
+    logger(ANIM, "Loaded plugin \"%s\" with OP %d from %s", plugin->name, plugin->op, path);
+    return 0;
+}
+
+void plugins_load() {
+    if (PLUGIN_DIR == NULL)
+        return;
+    DIR *dir = opendir(PLUGIN_DIR);
+    if (dir == NULL) {
+        logger(ANIM, "Failed to open plugin directory %s", PLUGIN_DIR);
+        return;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL && plugin_count < PLUGINS_MAX) {
+        size_t length = strlen(entry->d_name);
+        if (length < 4 || strcmp(entry->d_name + length - 3, ".so") != 0)
+            continue;
+        char path[strlen(PLUGIN_DIR) + length + 2];
+        snprintf(path, sizeof(path), "%s/%s", PLUGIN_DIR, entry->d_name);
+        plugin_load(path);
+    }
+    closedir(dir);
+}
+
+// must be called after the engine is stopped, no instance may be alive
+void plugins_unload() {
+    for (int i = 0; i < plugin_count; i++) {
+        struct loaded_plugin *loaded = &plugins[i];
+        if (loaded->renders) {
+            logger(ANIM, "Plugin \"%s\": %lu frames, %lu us average, %lu us max, %lu slower than %d us.",
+                   loaded->plugin->name, loaded->renders, loaded->total_ns / loaded->renders / 1000,
+                   loaded->max_ns / 1000, loaded->slow_renders, PLUGIN_SLOW_RENDER_US);
+        }
+        dlclose(loaded->handle);
+    }
+    plugin_count = 0;
+}
+
+const struct piled_plugin *plugin_by_op(uint8_t op) {
+    for (int i = 0; i < plugin_count; i++) {
+        if (plugins[i].plugin->op == op)
+            return plugins[i].plugin;
+    }
+    return NULL;
+}
+
+static uint8_t render_plugin(const struct engine_animation *animation, uint64_t elapsed_us,
+                             int32_t color_q16[COLOR_CHANNELS]) {
+    struct plugin_instance *instance = (struct plugin_instance *)animation->params;
+    struct loaded_plugin *loaded = instance->loaded;
+
+    uint64_t start_ns = get_time_ns();
+    int running = loaded->plugin->render(instance->state, elapsed_us, color_q16);
+    uint64_t render_ns = get_time_ns() - start_ns;
+
+    loaded->renders++;
+    loaded->total_ns += render_ns;
+    if (render_ns > loaded->max_ns)
+        loaded->max_ns = render_ns;
+    if (render_ns > PLUGIN_SLOW_RENDER_US * 1000) {
+        // first slow frame and then every 100th, so a slow plugin doesn't flood the log
+        if (loaded->slow_renders++ % 100 == 0)
+            logger(ANIM, "Plugin \"%s\" took %lu us to render a frame!", loaded->plugin->name, render_ns / 1000);
+    }
+
+    // frame goes straight to the color pipeline, don't trust it
+    for (int channel = 0; channel < COLOR_CHANNELS; channel++) {
+        if (color_q16[channel] < 0)
+            color_q16[channel] = 0;
+        if (color_q16[channel] > COLOR_Q16(255))
+            color_q16[channel] = COLOR_Q16(255);
+    }
+    return running != 0;
+}
+
+static void release_plugin(const struct engine_animation *animation) {
+    struct plugin_instance *instance = (struct plugin_instance *)animation->params;
+    if (instance->loaded->plugin->destroy)
+        instance->loaded->plugin->destroy(instance->state);
+    free(instance);
+}
+
+int plugin_start_animation(const struct piled_plugin *plugin, uint32_t strips, struct Color color, uint8_t speed,
+                           uint8_t duration) {
+    struct loaded_plugin *loaded = NULL;
+    for (int i = 0; i < plugin_count; i++) {
+        if (plugins[i].plugin == plugin)
+            loaded = &plugins[i];
+    }
+    if (loaded == NULL)
+        return -1;
+
+    struct piled_plugin_args args = {sizeof(args), color.RED, color.GREEN, color.BLUE, speed, duration};
+    struct plugin_instance *instance = malloc(sizeof(struct plugin_instance));
+    if (instance == NULL)
+        return -1;
+    instance->loaded = loaded;
+    instance->state = plugin->init ? plugin->init(&args) : NULL;
+    if (plugin->init && instance->state == NULL) {
+        logger(ANIM, "Plugin \"%s\" failed to initialize.", plugin->name);
+        free(instance);
+        return -1;
+    }
+
+    struct engine_animation animation = {.render = render_plugin,
+                                         .release = release_plugin,
+                                         .params = instance,
+                                         .color = color,
+                                         .speed = speed,
+                                         .duration = duration};
+    engine_start_animation(strips, &animation);
+    return 0;
+}
@@ -0,0 +1,20 @@
+#ifndef PLUGINS_H
+#define PLUGINS_H
+
+#include "../utils/utils.h"
+#include "plugin_api.h"
+#include <stdint.h>
+
+// Effect plugins loaded from PLUGIN_DIR at startup, see plugin_api.h.
+// Render time of every plugin is measured; slow renders are logged when they happen and totals at shutdown.
+#define PLUGINS_MAX 32
+#define PLUGIN_SLOW_RENDER_US 1000 // a tick at 100 Hz is 10 ms, everything else has to fit into it too
+
+void plugins_load();
+void plugins_unload();
+const struct piled_plugin *plugin_by_op(uint8_t op); // NULL if no plugin has this OP
+// starts plugin effect on strips, returns -1 if plugin failed to initialize
+int plugin_start_animation(const struct piled_plugin *plugin, uint32_t strips, struct Color color, uint8_t speed,
+                           uint8_t duration);
+
+#endif // PLUGINS_H
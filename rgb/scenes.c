@@ -0,0 +1,214 @@
+#include "scenes.h"
+#include "../globals/globals.h"
+#include "effects.h"
+#include "gpio.h"
+#include "plugins.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SCENE_FILE_MAGIC "PLSC"
+#define SCENE_FILE_VERSION 1
+
+// layout of SCENE_FILE, it only has fixed size fields in host byte order
+struct scene_command {
+    uint8_t used;
+    uint8_t op;
+    uint8_t red;
+    uint8_t green;
+    uint8_t blue;
+    uint8_t speed;
+    uint8_t duration;
+    uint8_t reserved;
+};
+
+struct scene {
+    char name[SCENE_NAME_SIZE]; // not terminated if it takes the whole field
+    uint8_t used;
+    uint8_t reserved;
+    struct scene_command commands[MAX_STRIPS]; // by strip number
+};
+
+struct scene_file {
+    char magic[4];
+    uint32_t version;
+    uint32_t scenes_max; // SCENES_MAX and MAX_STRIPS of the build which created the file
+    uint32_t strips_max;
+    struct scene scenes[SCENES_MAX];
+};
+
+static pthread_mutex_t scenes_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct scene_file *store = NULL;
+
+static int open_file() {
+    int fd = open(SCENE_FILE, O_RDWR | O_CREAT, 0644);
+    if (fd < 0 && errno == ENOENT) {
+        // directory is created like openrgb_configurator does for /etc/piled
+        char dir[256];
+        snprintf(dir, sizeof(dir), "%s", SCENE_FILE);
+        char *slash = strrchr(dir, '/');
+        if (slash != NULL && slash != dir) {
+            *slash = 0;
+            mkdir(dir, 0755);
+            fd = open(SCENE_FILE, O_RDWR | O_CREAT, 0644);
+        }
+    }
+    return fd;
+}
+
+int scenes_open() {
+    int fd = open_file();
+    if (fd < 0) {
+        logger(SCENES, "Failed to open scene file %s, scenes are disabled.", SCENE_FILE);
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (st.st_size != 0 && st.st_size != sizeof(struct scene_file))) {
+        logger(SCENES, "%s is not a scene file of this PiLED version, scenes are disabled.", SCENE_FILE);
+        close(fd);
+        return -1;
+    }
+    uint8_t created = st.st_size == 0;
+    if (created && ftruncate(fd, sizeof(struct scene_file)) != 0) {
+        logger(SCENES, "Failed to resize scene file %s, scenes are disabled.", SCENE_FILE);
+        close(fd);
+        return -1;
+    }
+    struct scene_file *file = mmap(NULL, sizeof(struct scene_file), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (file == MAP_FAILED) {
+        logger(SCENES, "Failed to map scene file %s, scenes are disabled.", SCENE_FILE);
+        return -1;
+    }
+
+    if (created) {
+        // new file is zeroed, so all scenes are empty
+        file->version = SCENE_FILE_VERSION;
+        file->scenes_max = SCENES_MAX;
+        file->strips_max = MAX_STRIPS;
+        memcpy(file->magic, SCENE_FILE_MAGIC, sizeof(file->magic));
+        msync(file, sizeof(struct scene_file), MS_SYNC);
+    } else if (memcmp(file->magic, SCENE_FILE_MAGIC, sizeof(file->magic)) != 0 ||
+               file->version != SCENE_FILE_VERSION || file->scenes_max != SCENES_MAX ||
+               file->strips_max != MAX_STRIPS) {
+        logger(SCENES, "%s is not a scene file of this PiLED version, scenes are disabled.", SCENE_FILE);
+        munmap(file, sizeof(struct scene_file));
+        return -1;
+    }
+
+    int used = 0;
+    for (int id = 0; id < SCENES_MAX; id++) {
+        used += file->scenes[id].used;
+    }
+    logger(SCENES, "%s %s, %d scenes saved.", created ? "Created" : "Opened", SCENE_FILE, used);
+    pthread_mutex_lock(&scenes_mutex);
+    store = file;
+    pthread_mutex_unlock(&scenes_mutex);
+    return 0;
+}
+
+void scenes_close() {
+    pthread_mutex_lock(&scenes_mutex);
+    if (store != NULL) {
+        munmap(store, sizeof(struct scene_file));
+        store = NULL;
+    }
+    pthread_mutex_unlock(&scenes_mutex);
+}
+
+// writes scene back to the file, saves are rare and should survive a power cut right after them
+static void sync_scene(const struct scene *scene) {
+    uintptr_t page_size = sysconf(_SC_PAGESIZE);
+    uintptr_t start = (uintptr_t)scene & ~(page_size - 1);
+    msync((void *)start, (uintptr_t)(scene + 1) - start, MS_SYNC);
+}
+
+int scene_save(uint8_t id, const char *name, uint32_t strips, uint8_t op, struct Color color, uint8_t speed,
+               uint8_t duration) {
+    if (op != LED_SET_COLOR && op != ANIM_AUDIO && effect_by_op(op) == NULL && plugin_by_op(op) == NULL) {
+        logger(SCENES, "OP %d can't be saved in a scene.", op);
+        return -1;
+    }
+    struct scene_command command = {1, op, color.RED, color.GREEN, color.BLUE, speed, duration, 0};
+
+    pthread_mutex_lock(&scenes_mutex);
+    if (store == NULL) {
+        pthread_mutex_unlock(&scenes_mutex);
+        return -1;
+    }
+    struct scene *scene = &store->scenes[id];
+    if (!scene->used)
+        memset(scene->commands, 0, sizeof(scene->commands));
+    for (int strip = 0; strip < STRIPS_COUNT; strip++) {
+        if (strips & (1u << strip))
+            scene->commands[strip] = command;
+    }
+    memcpy(scene->name, name, SCENE_NAME_SIZE);
+    scene->used = 1;
+    sync_scene(scene);
+    pthread_mutex_unlock(&scenes_mutex);
+    logger(SCENES, "Saved OP %d on strips 0x%x to scene %d \"%.*s\".", op, strips, id, SCENE_NAME_SIZE, name);
+    return 0;
+}
+
+int scene_delete(uint8_t id) {
+    pthread_mutex_lock(&scenes_mutex);
+    if (store == NULL || !store->scenes[id].used) {
+        pthread_mutex_unlock(&scenes_mutex);
+        return -1;
+    }
+    memset(&store->scenes[id], 0, sizeof(struct scene));
+    sync_scene(&store->scenes[id]);
+    pthread_mutex_unlock(&scenes_mutex);
+    logger(SCENES, "Deleted scene %d.", id);
+    return 0;
+}
+
+static void run_command(uint32_t strips, const struct scene_command *command) {
+    struct Color color = {command->red, command->green, command->blue};
+    const struct effect *effect;
+    const struct piled_plugin *plugin;
+    if (command->op == LED_SET_COLOR) {
+        set_color_duration(pi, strips, color, command->duration);
+    } else if (command->op == ANIM_AUDIO) {
+        start_audio(pi, strips, color, command->speed);
+    } else if ((effect = effect_by_op(command->op)) != NULL) {
+        start_effect(pi, strips, effect, color, command->speed, command->duration);
+    } else if ((plugin = plugin_by_op(command->op)) != NULL) {
+        start_plugin(pi, strips, plugin, color, command->speed, command->duration);
+    } else {
+        logger(SCENES, "OP %d of scene is not available anymore, skipping it.", command->op);
+    }
+}
+
+int scene_recall(uint8_t id) {
+    pthread_mutex_lock(&scenes_mutex);
+    if (store == NULL || !store->scenes[id].used) {
+        pthread_mutex_unlock(&scenes_mutex);
+        return -1;
+    }
+    struct scene scene = store->scenes[id];
+    pthread_mutex_unlock(&scenes_mutex);
+    logger(SCENES, "Recalling scene %d \"%.*s\".", id, SCENE_NAME_SIZE, scene.name);
+
+    // strips with the same command get it at once, so their animations stay in sync
+    uint32_t done = 0;
+    for (int strip = 0; strip < STRIPS_COUNT; strip++) {
+        const struct scene_command *command = &scene.commands[strip];
+        if (!command->used || (done & (1u << strip)))
+            continue;
+        uint32_t strips = 0;
+        for (int other = strip; other < STRIPS_COUNT; other++) {
+            if (memcmp(&scene.commands[other], command, sizeof(*command)) == 0)
+                strips |= 1u << other;
+        }
+        done |= strips;
+        run_command(strips, command);
+    }
+    return 0;
+}
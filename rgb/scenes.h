@@ -0,0 +1,27 @@
+#ifndef SCENES_H
+#define SCENES_H
+
+#include "../utils/utils.h"
+#include <stdint.h>
+
+// Scenes saved by clients (SCENE_SAVE) and recalled by ID (SCENE_RECALL) instead of sending colors and effects
+// every time. SCENE_FILE is mapped to memory as it is: a scene is found by indexing the table with its ID and
+// saved scenes are simply there after a restart. Every scene holds one command for every strip.
+#define SCENES_MAX 256 // IDs are 0-255
+#define SCENE_NAME_SIZE 22
+
+// SCENE_SAVE data following the payload: id(1), OP(1) of the command and name(SCENE_NAME_SIZE), padded with zeros.
+// SCENE_DELETE and SCENE_RECALL are followed only by id(1).
+#define SCENE_SAVE_DATA_SIZE (2 + SCENE_NAME_SIZE)
+#define SCENE_ID_DATA_SIZE 1
+
+int scenes_open(); // maps SCENE_FILE, creating it if needed. Scene OPs are ignored if it fails.
+void scenes_close();
+// sets command of scene `id` on strips, keeps commands of other strips. OP is LED_SET_COLOR, an effect, a plugin
+// or ANIM_AUDIO. Returns -1 if OP can't be saved or there is no scene file.
+int scene_save(uint8_t id, const char *name, uint32_t strips, uint8_t op, struct Color color, uint8_t speed,
+               uint8_t duration);
+int scene_delete(uint8_t id);
+int scene_recall(uint8_t id); // returns -1 if scene is empty
+
+#endif // SCENES_H
@@ -0,0 +1,311 @@
+#include "scheduler.h"
+#include "../globals/globals.h"
+#include "../server/server.h"
+#include "../utils/timer_wheel.h"
+#include "engine.h"
+#include "gpio.h"
+#include "state.h"
+#include <pthread.h>
+#include <string.h>
+#include <strings.h>
+
+struct scheduled {
+    struct timer timer; // must be first, expired timers are cast back to their command
+    struct scheduled_command command;
+    uint8_t used;
+    int daily_time; // seconds since local midnight for daily commands, -1 otherwise
+    uint32_t repeat_s;
+    uint8_t step;       // sunrise and sunset: step run next time, 0 for the command starting the scene
+    time_t scene_start; // when step 0 ran
+};
+
+// sunrise and sunset go through these colors, every step ends at `end_percent` of the ramp
+#define SCENE_STEPS 3
+struct scene_step {
+    uint8_t end_percent;
+    struct Color color;
+};
+static const struct scene_step sunrise[SCENE_STEPS] = {{30, {64, 6, 0}}, {70, {255, 80, 8}}, {100, {255, 180, 100}}};
+static const struct scene_step sunset[SCENE_STEPS] = {{30, {255, 80, 8}}, {70, {64, 6, 0}}, {100, {0, 0, 0}}};
+
+static pthread_mutex_t scheduler_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t scheduler_cond = PTHREAD_COND_INITIALIZER; // CLOCK_REALTIME, schedule follows the wall clock
+static pthread_t scheduler_thread;
+static uint8_t scheduler_running = 0;
+static struct timer_wheel wheel; // ticks are unix time in seconds
+static struct scheduled commands[SCHEDULER_MAX_COMMANDS];
+
+static struct scheduled *alloc_command() {
+    for (int i = 0; i < SCHEDULER_MAX_COMMANDS; i++) {
+        if (!commands[i].used) {
+            memset(&commands[i], 0, sizeof(commands[i]));
+            commands[i].used = 1;
+            commands[i].daily_time = -1;
+            return &commands[i];
+        }
+    }
+    logger(SCHED, "Too many scheduled commands, max is %d.", SCHEDULER_MAX_COMMANDS);
+    return NULL;
+}
+
+// first time of day `daily_time` after `after`, local time so it stays put over DST changes
+static time_t next_daily(int daily_time, time_t after) {
+    struct tm tm;
+    localtime_r(&after, &tm);
+    for (int day = 0; day < 2; day++) {
+        tm.tm_hour = daily_time / 3600;
+        tm.tm_min = daily_time / 60 % 60;
+        tm.tm_sec = daily_time % 60;
+        tm.tm_isdst = -1;
+        time_t at = mktime(&tm);
+        if (at > after)
+            return at;
+        tm.tm_mday++;
+    }
+    return after + 86400;
+}
+
+// last time of day `daily_time` not after `now`
+static time_t last_daily(int daily_time, time_t now) {
+    struct tm tm;
+    localtime_r(&now, &tm);
+    for (int day = 0; day < 2; day++) {
+        tm.tm_hour = daily_time / 3600;
+        tm.tm_min = daily_time / 60 % 60;
+        tm.tm_sec = daily_time % 60;
+        tm.tm_isdst = -1;
+        time_t at = mktime(&tm);
+        if (at <= now)
+            return at;
+        tm.tm_mday--;
+    }
+    return now - 86400;
+}
+
+// A forward clock jump may skip several runs of a daily or repeating command, only the latest of them is run and
+// it's ordered among the other expired commands by that time, so the state ends as if the clock had run normally.
+static void latest_missed_run(struct scheduled *scheduled, time_t now) {
+    uint64_t expires = scheduled->timer.expires;
+    if (scheduled->step || expires >= (uint64_t)now)
+        return;
+    if (scheduled->daily_time >= 0) {
+        time_t latest = last_daily(scheduled->daily_time, now);
+        if ((uint64_t)latest > expires)
+            scheduled->timer.expires = latest;
+    } else if (scheduled->repeat_s) {
+        scheduled->timer.expires = expires + (now - expires) / scheduled->repeat_s * scheduled->repeat_s;
+    }
+}
+
+static uint32_t scene_step_end_s(const struct scheduled *scheduled, uint8_t step, const struct scene_step *steps) {
+    return step ? scheduled->command.ramp_s * steps[step - 1].end_percent / 100 : 0;
+}
+
+// runs step of sunrise or sunset and schedules the next one
+static void run_scene_step(struct scheduled *scheduled, time_t now) {
+    const struct scheduled_command *command = &scheduled->command;
+    const struct scene_step *steps = command->action == SCHEDULE_SUNRISE ? sunrise : sunset;
+    uint8_t step = scheduled->step;
+    if (step == 0)
+        scheduled->scene_start = now;
+
+    struct Color color = steps[step].color;
+    uint8_t black = !command->color.RED && !command->color.GREEN && !command->color.BLUE;
+    if (command->action == SCHEDULE_SUNRISE && step == SCENE_STEPS - 1 && !black)
+        color = command->color;
+    uint32_t duration_s = scene_step_end_s(scheduled, step + 1, steps) - scene_step_end_s(scheduled, step, steps);
+    logger_debug(SCHED, "Scene step %d: %d %d %d in %u seconds.", step, color.RED, color.GREEN, color.BLUE,
+                 duration_s);
+    engine_set_color(command->strips, color, duration_s * 1000);
+    state_record_color(command->strips, color);
+    if (step == SCENE_STEPS - 1)
+        return;
+
+    // scene goes on by itself, the command that started it keeps its own schedule
+    struct scheduled *next = step == 0 ? alloc_command() : scheduled;
+    if (next == NULL)
+        return;
+    if (next != scheduled) {
+        next->command = *command;
+        next->scene_start = scheduled->scene_start;
+    }
+    next->step = step + 1;
+    next->timer.expires = next->scene_start + scene_step_end_s(next, next->step, steps);
+    timer_wheel_add(&wheel, &next->timer);
+}
+
+static void run_command(struct scheduled *scheduled, time_t now) {
+    const struct scheduled_command *command = &scheduled->command;
+    if (is_suspended) {
+        logger(SCHED, "PiLED is suspended, skipping scheduled command.");
+        return;
+    }
+    switch (command->action) {
+    case SCHEDULE_COLOR:
+        logger(SCHED, "Changing color to %d %d %d in %u seconds.", command->color.RED, command->color.GREEN,
+               command->color.BLUE, command->ramp_s);
+        engine_set_color(command->strips, command->color, command->ramp_s * 1000);
+        state_record_color(command->strips, command->color);
+        break;
+    case SCHEDULE_SUNRISE:
+    case SCHEDULE_SUNSET:
+        if (scheduled->step == 0)
+            logger(SCHED, "Starting %s of %u seconds.", command->action == SCHEDULE_SUNRISE ? "sunrise" : "sunset",
+                   command->ramp_s);
+        run_scene_step(scheduled, now);
+        break;
+    case SCHEDULE_EFFECT:
+        logger(SCHED, "Starting %s effect.", command->effect->name);
+        start_effect(pi, command->strips, command->effect, command->color, command->speed, command->duration);
+        break;
+    }
+}
+
+// scheduler lock is held
+static void expire(struct scheduled *scheduled, time_t now) {
+    uint64_t expired_at = scheduled->timer.expires;
+    uint8_t scene_step = scheduled->step;
+    run_command(scheduled, now);
+    if (scene_step) {
+        // further steps were scheduled by the step itself
+        if (scheduled->step == scene_step)
+            scheduled->used = 0;
+        return;
+    }
+    if (scheduled->daily_time >= 0) {
+        scheduled->timer.expires = next_daily(scheduled->daily_time, now);
+    } else if (scheduled->repeat_s) {
+        // next run after now, missed ones were folded into this one
+        scheduled->timer.expires = expired_at + ((now - expired_at) / scheduled->repeat_s + 1) * scheduled->repeat_s;
+    } else {
+        scheduled->used = 0;
+        return;
+    }
+    timer_wheel_add(&wheel, &scheduled->timer);
+}
+
+static void *scheduler_thread_func(void *arg) {
+    pthread_mutex_lock(&scheduler_mutex);
+    while (scheduler_running) {
+        time_t now = time(NULL);
+        struct timer *expired = timer_wheel_advance(&wheel, now);
+        for (struct timer *timer = expired; timer != NULL; timer = timer->next)
+            latest_missed_run((struct scheduled *)timer, now);
+        expired = timer_list_sort(expired);
+        while (expired != NULL) {
+            struct scheduled *scheduled = (struct scheduled *)expired;
+            expired = expired->next;
+            expire(scheduled, now);
+        }
+
+        uint64_t next = timer_wheel_next(&wheel);
+        if (next == TIMER_WHEEL_NEVER) {
+            pthread_cond_wait(&scheduler_cond, &scheduler_mutex);
+        } else {
+            struct timespec deadline = {next, 0};
+            pthread_cond_timedwait(&scheduler_cond, &scheduler_mutex, &deadline);
+        }
+    }
+    pthread_mutex_unlock(&scheduler_mutex);
+    return NULL;
+}
+
+static int add_config_entry(const struct schedule_config *entry, time_t now) {
+    struct scheduled_command command = {.strips = target_strips(entry->target),
+                                        .color = {entry->red, entry->green, entry->blue},
+                                        .ramp_s = entry->ramp,
+                                        .speed = entry->speed,
+                                        .duration = entry->duration};
+    if (!command.strips) {
+        logger(SCHED, "Unknown target %d of scheduled %s, skipping it.", entry->target, entry->action);
+        return -1;
+    }
+    if (strcasecmp(entry->action, "color") == 0) {
+        command.action = SCHEDULE_COLOR;
+    } else if (strcasecmp(entry->action, "sunrise") == 0) {
+        command.action = SCHEDULE_SUNRISE;
+    } else if (strcasecmp(entry->action, "sunset") == 0) {
+        command.action = SCHEDULE_SUNSET;
+    } else if ((command.effect = effect_by_name(entry->action)) != NULL) {
+        command.action = SCHEDULE_EFFECT;
+    } else {
+        logger(SCHED, "Unknown scheduled action \"%s\", skipping it.", entry->action);
+        return -1;
+    }
+
+    struct scheduled *scheduled = alloc_command();
+    if (scheduled == NULL)
+        return -1;
+    scheduled->command = command;
+    scheduled->daily_time = entry->time;
+    scheduled->timer.expires = next_daily(entry->time, now);
+    timer_wheel_add(&wheel, &scheduled->timer);
+    return 0;
+}
+
+int scheduler_start() {
+    time_t now = time(NULL);
+    timer_wheel_init(&wheel, now);
+    for (int i = 0; i < SCHEDULE_COUNT; i++) {
+        add_config_entry(&SCHEDULE[i], now);
+    }
+
+    scheduler_running = 1;
+    if (pthread_create(&scheduler_thread, NULL, scheduler_thread_func, NULL) != 0) {
+        logger(SCHED, "Failed to create scheduler thread");
+        scheduler_running = 0;
+        return -1;
+    }
+    return 0;
+}
+
+void scheduler_stop() {
+    pthread_mutex_lock(&scheduler_mutex);
+    if (!scheduler_running) {
+        pthread_mutex_unlock(&scheduler_mutex);
+        return;
+    }
+    scheduler_running = 0;
+    pthread_cond_signal(&scheduler_cond);
+    pthread_mutex_unlock(&scheduler_mutex);
+    pthread_join(scheduler_thread, NULL);
+}
+
+int scheduler_add(time_t at, uint32_t repeat_s, const struct scheduled_command *command) {
+    pthread_mutex_lock(&scheduler_mutex);
+    struct scheduled *scheduled = alloc_command();
+    if (scheduled == NULL) {
+        pthread_mutex_unlock(&scheduler_mutex);
+        return -1;
+    }
+    scheduled->command = *command;
+    scheduled->repeat_s = repeat_s;
+    scheduled->timer.expires = at;
+    timer_wheel_add(&wheel, &scheduled->timer);
+    pthread_cond_signal(&scheduler_cond);
+    pthread_mutex_unlock(&scheduler_mutex);
+    return 0;
+}
+
+static uint32_t read_u32(const uint8_t *data) {
+    return (uint32_t)data[0] << 24 | (uint32_t)data[1] << 16 | (uint32_t)data[2] << 8 | data[3];
+}
+
+int scheduler_add_packet(const uint8_t data[SCHEDULE_DATA_SIZE], uint32_t strips, struct Color color, uint8_t speed,
+                         uint8_t duration) {
+    struct scheduled_command command = {.action = data[12],
+                                        .strips = strips,
+                                        .color = color,
+                                        .ramp_s = read_u32(&data[8]),
+                                        .speed = speed,
+                                        .duration = duration};
+    if (command.action > SCHEDULE_EFFECT || command.ramp_s > SCHEDULER_MAX_RAMP) {
+        logger(SCHED, "Unknown scheduled action %d or ramp over %d seconds.", command.action, SCHEDULER_MAX_RAMP);
+        return -1;
+    }
+    if (command.action == SCHEDULE_EFFECT && (command.effect = effect_by_op(data[13])) == NULL) {
+        logger(SCHED, "Scheduled OP %d is not an effect.", data[13]);
+        return -1;
+    }
+    return scheduler_add(read_u32(data), read_u32(&data[4]), &command);
+}
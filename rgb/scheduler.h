@@ -0,0 +1,44 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include "../utils/utils.h"
+#include "effects.h"
+#include <stdint.h>
+#include <time.h>
+
+// Commands run at given wall-clock times: daily entries of SCHEDULE in config and commands sent by clients with
+// SYS_SCHEDULE. Pending commands wait in a timer wheel with one second ticks, the scheduler thread sleeps until
+// the next of them is due and doesn't wake up otherwise.
+// Ramps are handed to the render engine as one long transition, sunrise and sunset as a chain of three of them.
+#define SCHEDULER_MAX_COMMANDS 128 // pending at once, next steps of running sunrises and sunsets included
+#define SCHEDULER_MAX_RAMP 86400   // seconds
+
+#define SCHEDULE_COLOR 0   // change to color during ramp
+#define SCHEDULE_SUNRISE 1 // from current color through deep red and orange to color, warm white if it's black
+#define SCHEDULE_SUNSET 2  // from current color through orange and deep red to black
+#define SCHEDULE_EFFECT 3  // start effect, ramp is not used
+
+// SYS_SCHEDULE data following the payload, numbers are big-endian:
+// time(4) unix time, repeat(4) seconds or 0, ramp(4) seconds, action(1) SCHEDULE_*, effect(1) OP of the effect
+#define SCHEDULE_DATA_SIZE 14
+
+struct scheduled_command {
+    uint8_t action;  // SCHEDULE_*
+    uint32_t strips; // bitmask of STRIPS
+    struct Color color;
+    uint32_t ramp_s;
+    const struct effect *effect; // SCHEDULE_EFFECT only
+    uint8_t speed;
+    uint8_t duration;
+};
+
+int scheduler_start(); // also schedules SCHEDULE entries of config
+void scheduler_stop();
+// runs command at unix time `at` (at once if it has passed) and then every `repeat_s` seconds unless it's 0.
+// Returns -1 if too many commands are pending.
+int scheduler_add(time_t at, uint32_t repeat_s, const struct scheduled_command *command);
+// adds command of SYS_SCHEDULE packet, returns -1 if data is invalid or too many commands are pending
+int scheduler_add_packet(const uint8_t data[SCHEDULE_DATA_SIZE], uint32_t strips, struct Color color, uint8_t speed,
+                         uint8_t duration);
+
+#endif // SCHEDULER_H
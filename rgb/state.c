@@ -0,0 +1,340 @@
+#include "state.h"
+#include "../globals/globals.h"
+#include "../server/server.h"
+#include "effects.h"
+#include "gpio.h"
+#include "plugins.h"
+#include "vm.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define STATE_FILE_MAGIC "PLST"
+#define STATE_FILE_VERSION 1
+
+// layout of STATE_FILE, it only has fixed size fields in host byte order
+struct strip_state {
+    uint8_t red; // base color
+    uint8_t green;
+    uint8_t blue;
+    uint8_t animating;
+    uint8_t op; // OP which started the animation
+    uint8_t animation_red;
+    uint8_t animation_green;
+    uint8_t animation_blue;
+    uint8_t speed;
+    uint8_t duration;
+    uint8_t program_length; // ANIM_RUN_PROGRAM only
+    uint8_t program[VM_MAX_PROGRAM];
+};
+
+struct saved_state {
+    uint8_t suspended;
+    uint8_t strips_count;
+    struct strip_state strips[MAX_STRIPS];
+};
+
+struct state_slot {
+    uint32_t sequence; // slot with higher sequence is newer
+    uint32_t checksum; // of sequence and state, slot with wrong checksum was torn by a crash
+    struct saved_state state;
+};
+
+struct state_file {
+    char magic[4];
+    uint32_t version;
+    uint32_t strips_max;
+    struct state_slot slots[2];
+};
+
+static pthread_mutex_t state_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t state_cond; // waits on CLOCK_MONOTONIC, initialized in state_open()
+static pthread_t state_thread;
+static uint8_t state_running = 0;
+static struct state_file *journal = NULL;
+static uint32_t sequence = 0;      // of the newest slot
+static struct saved_state current; // updated by commands, flushed to the journal
+static uint8_t dirty = 0;
+static uint64_t changes = 0, flushes = 0;
+
+static uint32_t checksum(const struct state_slot *slot) {
+    // FNV-1a
+    const uint8_t *bytes = (const uint8_t *)&slot->state;
+    uint32_t hash = 2166136261u ^ slot->sequence;
+    for (size_t i = 0; i < sizeof(slot->state); i++) {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
+}
+
+// writes state to the older slot and waits until it's on disk. Only the state thread writes slots.
+static void flush(const struct saved_state *state) {
+    struct state_slot *slot = &journal->slots[(sequence + 1) & 1];
+    slot->sequence = sequence + 1;
+    slot->state = *state;
+    slot->checksum = checksum(slot);
+    uintptr_t page_size = sysconf(_SC_PAGESIZE);
+    uintptr_t start = (uintptr_t)slot & ~(page_size - 1);
+    msync((void *)start, (uintptr_t)(slot + 1) - start, MS_SYNC);
+    sequence++;
+    flushes++;
+}
+
+static void *state_thread_func(void *arg) {
+    pthread_mutex_lock(&state_mutex);
+    while (state_running) {
+        if (!dirty) {
+            pthread_cond_wait(&state_cond, &state_mutex);
+            continue;
+        }
+        struct saved_state state = current;
+        dirty = 0;
+        pthread_mutex_unlock(&state_mutex);
+        flush(&state);
+        pthread_mutex_lock(&state_mutex);
+
+        // changes made meanwhile wait for the next flush
+        uint64_t next_us = get_time_us() + STATE_FLUSH_INTERVAL_MS * 1000;
+        struct timespec deadline = {next_us / 1000000, (next_us % 1000000) * 1000};
+        while (state_running && pthread_cond_timedwait(&state_cond, &state_mutex, &deadline) != ETIMEDOUT)
+            ;
+    }
+    pthread_mutex_unlock(&state_mutex);
+    return NULL;
+}
+
+// maps journal, it's created or reset if it doesn't match this build. Returns NULL if it can't be used.
+static struct state_file *map_file() {
+    int fd = open(STATE_FILE, O_RDWR | O_CREAT, 0644);
+    if (fd < 0 && errno == ENOENT) {
+        char dir[256];
+        snprintf(dir, sizeof(dir), "%s", STATE_FILE);
+        char *slash = strrchr(dir, '/');
+        if (slash != NULL && slash != dir) {
+            *slash = 0;
+            mkdir(dir, 0755);
+            fd = open(STATE_FILE, O_RDWR | O_CREAT, 0644);
+        }
+    }
+    if (fd < 0)
+        return NULL;
+    struct stat st;
+    uint8_t reset = fstat(fd, &st) != 0 || st.st_size != sizeof(struct state_file);
+    if (reset && (ftruncate(fd, 0) != 0 || ftruncate(fd, sizeof(struct state_file)) != 0)) {
+        close(fd);
+        return NULL;
+    }
+    struct state_file *file = mmap(NULL, sizeof(struct state_file), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (file != MAP_FAILED && !reset &&
+        (memcmp(file->magic, STATE_FILE_MAGIC, sizeof(file->magic)) != 0 || file->version != STATE_FILE_VERSION ||
+         file->strips_max != MAX_STRIPS)) {
+        logger(MAIN, "%s was written by another PiLED version, starting with a new state.", STATE_FILE);
+        memset(file, 0, sizeof(struct state_file));
+        reset = 1;
+    }
+    close(fd);
+    if (file == MAP_FAILED)
+        return NULL;
+    if (reset) {
+        file->version = STATE_FILE_VERSION;
+        file->strips_max = MAX_STRIPS;
+        memcpy(file->magic, STATE_FILE_MAGIC, sizeof(file->magic));
+        msync(file, sizeof(struct state_file), MS_SYNC);
+    }
+    return file;
+}
+
+int state_open() {
+    struct state_file *file = map_file();
+    if (file == NULL) {
+        logger(MAIN, "Failed to open state file %s, state won't be restored after restart.", STATE_FILE);
+        return -1;
+    }
+
+    pthread_condattr_t cond_attr;
+    pthread_condattr_init(&cond_attr);
+    pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC); // same clock as get_time_us()
+    pthread_cond_init(&state_cond, &cond_attr);
+    pthread_condattr_destroy(&cond_attr);
+
+    pthread_mutex_lock(&state_mutex);
+    journal = file;
+    int newest = -1;
+    for (int i = 0; i < 2; i++) {
+        const struct state_slot *slot = &journal->slots[i];
+        if (slot->checksum == checksum(slot) && (newest < 0 || slot->sequence > journal->slots[newest].sequence))
+            newest = i;
+    }
+    sequence = newest >= 0 ? journal->slots[newest].sequence : 0;
+    dirty = 0;
+    state_running = 1;
+    if (pthread_create(&state_thread, NULL, state_thread_func, NULL) != 0) {
+        logger(MAIN, "Failed to create state thread");
+        state_running = 0;
+        journal = NULL;
+        pthread_mutex_unlock(&state_mutex);
+        munmap(file, sizeof(struct state_file));
+        return -1;
+    }
+    pthread_mutex_unlock(&state_mutex);
+    return 0;
+}
+
+void state_close() {
+    pthread_mutex_lock(&state_mutex);
+    if (!state_running) {
+        pthread_mutex_unlock(&state_mutex);
+        return;
+    }
+    state_running = 0;
+    pthread_cond_signal(&state_cond);
+    pthread_mutex_unlock(&state_mutex);
+    pthread_join(state_thread, NULL);
+
+    if (dirty)
+        flush(&current);
+    logger(MAIN, "State: %lu changes journaled in %lu flushes.", changes, flushes);
+    munmap(journal, sizeof(struct state_file));
+    journal = NULL;
+}
+
+// returns 0 if journal has a valid state
+static int load(struct saved_state *state) {
+    if (journal == NULL || sequence == 0)
+        return -1;
+    const struct state_slot *slot = &journal->slots[sequence & 1];
+    if (slot->sequence != sequence || slot->checksum != checksum(slot))
+        return -1;
+    *state = slot->state;
+    return 0;
+}
+
+static void restore_animation(uint32_t strips, const struct strip_state *strip) {
+    struct Color color = {strip->animation_red, strip->animation_green, strip->animation_blue};
+    const struct effect *effect;
+    const struct piled_plugin *plugin;
+    if (strip->op == ANIM_RUN_PROGRAM) {
+        start_program(pi, strips, strip->program, strip->program_length, color, strip->speed);
+    } else if (strip->op == ANIM_AUDIO) {
+        start_audio(pi, strips, color, strip->speed);
+    } else if ((effect = effect_by_op(strip->op)) != NULL) {
+        start_effect(pi, strips, effect, color, strip->speed, strip->duration);
+    } else if ((plugin = plugin_by_op(strip->op)) != NULL) {
+        start_plugin(pi, strips, plugin, color, strip->speed, strip->duration);
+    } else {
+        logger(MAIN, "OP %d of saved animation is not available anymore, skipping it.", strip->op);
+    }
+}
+
+void state_restore() {
+    uint64_t start_us = get_time_us();
+    struct saved_state saved;
+    pthread_mutex_lock(&state_mutex);
+    int found = load(&saved);
+    pthread_mutex_unlock(&state_mutex);
+    if (found != 0) {
+        set_color(pi, (struct Color){0, 0, 0});
+        return;
+    }
+
+    // outputs are restored by number, extra ones of a longer config stay black
+    int count = saved.strips_count < STRIPS_COUNT ? saved.strips_count : STRIPS_COUNT;
+    for (int strip = 0; strip < count; strip++) {
+        const struct strip_state *state = &saved.strips[strip];
+        set_color_duration(pi, 1u << strip, (struct Color){state->red, state->green, state->blue}, 0);
+    }
+    // strips with the same animation get it at once, so they stay in sync
+    uint32_t done = 0;
+    for (int strip = 0; strip < count; strip++) {
+        const struct strip_state *state = &saved.strips[strip];
+        if (!state->animating || (done & (1u << strip)))
+            continue;
+        uint32_t strips = 0;
+        for (int other = strip; other < count; other++) {
+            const struct strip_state *other_state = &saved.strips[other];
+            if (other_state->animating && other_state->op == state->op &&
+                memcmp(&other_state->animation_red, &state->animation_red,
+                       sizeof(*state) - offsetof(struct strip_state, animation_red)) == 0)
+                strips |= 1u << other;
+        }
+        done |= strips;
+        restore_animation(strips, state);
+    }
+    is_suspended = saved.suspended;
+    state_record_suspend(saved.suspended);
+    logger(MAIN, "Restored state of %d outputs%s in %lu us.", count, saved.suspended ? ", suspended," : "",
+           get_time_us() - start_us);
+}
+
+static void changed() {
+    changes++;
+    dirty = 1;
+    if (state_running)
+        pthread_cond_signal(&state_cond);
+}
+
+void state_record_color(uint32_t strips, struct Color color) {
+    pthread_mutex_lock(&state_mutex);
+    for (int strip = 0; strip < STRIPS_COUNT; strip++) {
+        if (strips & (1u << strip)) {
+            current.strips[strip].red = color.RED;
+            current.strips[strip].green = color.GREEN;
+            current.strips[strip].blue = color.BLUE;
+            current.strips[strip].animating = 0; // every color replaces the animation
+        }
+    }
+    current.strips_count = STRIPS_COUNT;
+    changed();
+    pthread_mutex_unlock(&state_mutex);
+}
+
+void state_record_animation(uint32_t strips, uint8_t op, struct Color color, uint8_t speed, uint8_t duration,
+                            const uint8_t *program, uint8_t length) {
+    struct strip_state animation = {.animating = 1,
+                                    .op = op,
+                                    .animation_red = color.RED,
+                                    .animation_green = color.GREEN,
+                                    .animation_blue = color.BLUE,
+                                    .speed = speed,
+                                    .duration = duration,
+                                    .program_length = program ? length : 0};
+    if (program)
+        memcpy(animation.program, program, length);
+    pthread_mutex_lock(&state_mutex);
+    for (int strip = 0; strip < STRIPS_COUNT; strip++) {
+        if (strips & (1u << strip)) {
+            struct strip_state *state = &current.strips[strip];
+            animation.red = state->red;
+            animation.green = state->green;
+            animation.blue = state->blue;
+            *state = animation;
+        }
+    }
+    current.strips_count = STRIPS_COUNT;
+    changed();
+    pthread_mutex_unlock(&state_mutex);
+}
+
+void state_record_stop(uint32_t strips) {
+    pthread_mutex_lock(&state_mutex);
+    for (int strip = 0; strip < STRIPS_COUNT; strip++) {
+        if (strips & (1u << strip))
+            current.strips[strip].animating = 0;
+    }
+    changed();
+    pthread_mutex_unlock(&state_mutex);
+}
+
+void state_record_suspend(uint8_t suspended) {
+    pthread_mutex_lock(&state_mutex);
+    current.suspended = suspended;
+    changed();
+    pthread_mutex_unlock(&state_mutex);
+}
@@ -0,0 +1,26 @@
+#ifndef STATE_H
+#define STATE_H
+
+#include "../utils/utils.h"
+#include <stdint.h>
+
+// Warm start: colors, animations and suspend flag set by commands are journaled to STATE_FILE and restored at
+// startup. The file is mapped to memory and holds two copies of the state with a sequence number and checksum,
+// a flush overwrites the older one, so a crash or power cut during it leaves the previous state intact.
+// Commands only update state in memory, it is flushed by its own thread at most once per STATE_FLUSH_INTERVAL_MS.
+#define STATE_FLUSH_INTERVAL_MS 1000
+
+int state_open(); // maps STATE_FILE, creating it if needed. State isn't journaled if it fails.
+void state_close(); // flushes pending changes
+// restores journaled state, black on all strips if there is none. Effects, plugins and audio must be ready,
+// the engine initialized but not started yet.
+void state_restore();
+
+void state_record_color(uint32_t strips, struct Color color); // also ends animations of strips
+// animation started on strips by OP, `program` is the program of ANIM_RUN_PROGRAM and NULL otherwise
+void state_record_animation(uint32_t strips, uint8_t op, struct Color color, uint8_t speed, uint8_t duration,
+                            const uint8_t *program, uint8_t length);
+void state_record_stop(uint32_t strips); // animation stopped
+void state_record_suspend(uint8_t suspended);
+
+#endif // STATE_H
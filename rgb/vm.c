@@ -0,0 +1,240 @@
+#include "vm.h"
+#include "../globals/globals.h"
+#include "color.h"
+#include <pthread.h>
+#include <string.h>
+
+struct vm {
+    uint8_t code[VM_MAX_PROGRAM];
+    uint8_t length;
+    int32_t initial[VM_REGISTERS];
+    uint32_t seed;
+
+    // state, rebuilt from the start if animation time ever goes back
+    uint8_t started;
+    uint8_t halted;
+    uint16_t pc;
+    uint16_t steps; // instructions since time was last taken
+    int32_t reg[VM_REGISTERS];
+    uint32_t random;
+    uint8_t loop_depth;
+    uint16_t loop_pc[VM_MAX_LOOPS];
+    uint16_t loop_left[VM_MAX_LOOPS]; // 0 for endless loops
+    uint64_t time_us;                 // animation time of the instruction being executed
+    uint8_t waiting;                  // SHOW or WAIT runs until wait_end_us
+    uint8_t easing;
+    uint64_t wait_end_us;
+    int32_t from_q16[COLOR_CHANNELS];
+    int32_t to_q16[COLOR_CHANNELS];
+};
+
+// every running program holds one slot, MAX_STRIPS of them can run at once and one more is being started
+static struct vm vms[MAX_STRIPS + 1];
+static pthread_mutex_t vm_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// operand bytes of every opcode
+static const uint8_t operand_sizes[VM_OPCODES] = {
+    [VM_END] = 0, [VM_COLOR] = 3, [VM_SHOW] = 3, [VM_WAIT] = 2, [VM_LOOP] = 1, [VM_NEXT] = 0,
+    [VM_SET] = 2, [VM_RANDOM] = 2, [VM_ADD] = 2, [VM_SUB] = 2, [VM_SCALE] = 2,
+};
+
+static int vm_check(const uint8_t *code, uint8_t length) {
+    int depth = 0;
+    for (int pc = 0; pc < length; pc += 1 + operand_sizes[code[pc]]) {
+        uint8_t op = code[pc];
+        if (op >= VM_OPCODES) {
+            logger(ANIM, "Program: unknown opcode 0x%x at %d.", op, pc);
+            return -1;
+        }
+        if (pc + operand_sizes[op] >= length) {
+            logger(ANIM, "Program: operands of opcode 0x%x at %d are cut off.", op, pc);
+            return -1;
+        }
+        if (op >= VM_SET && (code[pc + 1] >= VM_REGISTERS || (op >= VM_ADD && code[pc + 2] >= VM_REGISTERS))) {
+            logger(ANIM, "Program: bad register at %d.", pc);
+            return -1;
+        }
+        if (op == VM_SHOW && code[pc + 3] > VM_EASE_IN_OUT) {
+            logger(ANIM, "Program: unknown easing at %d.", pc);
+            return -1;
+        }
+        if (op == VM_LOOP && ++depth > VM_MAX_LOOPS) {
+            logger(ANIM, "Program: more than %d nested loops at %d.", VM_MAX_LOOPS, pc);
+            return -1;
+        }
+        if (op == VM_NEXT && --depth < 0) {
+            logger(ANIM, "Program: NEXT without LOOP at %d.", pc);
+            return -1;
+        }
+    }
+    if (depth != 0) {
+        logger(ANIM, "Program: LOOP without NEXT.");
+        return -1;
+    }
+    return 0;
+}
+
+static void vm_reset(struct vm *vm, struct Color start_color) {
+    vm->started = 1;
+    vm->halted = 0;
+    vm->pc = 0;
+    vm->steps = 0;
+    memcpy(vm->reg, vm->initial, sizeof(vm->reg));
+    vm->random = vm->seed;
+    vm->loop_depth = 0;
+    vm->time_us = 0;
+    vm->waiting = 0;
+    vm->to_q16[COLOR_RED] = COLOR_Q16(start_color.RED);
+    vm->to_q16[COLOR_GREEN] = COLOR_Q16(start_color.GREEN);
+    vm->to_q16[COLOR_BLUE] = COLOR_Q16(start_color.BLUE);
+}
+
+static int32_t clamp(int32_t value, int32_t min, int32_t max) { return value < min ? min : value > max ? max : value; }
+
+static uint16_t operand_time(const uint8_t *operands) { return (uint16_t)operands[0] << 8 | operands[1]; }
+
+// output moves from current color to `to` until time_us + duration
+static void vm_wait(struct vm *vm, const int32_t to_q16[COLOR_CHANNELS], uint16_t duration_ms, uint8_t easing) {
+    memcpy(vm->from_q16, vm->to_q16, sizeof(vm->from_q16));
+    memcpy(vm->to_q16, to_q16, sizeof(vm->to_q16));
+    if (duration_ms) {
+        vm->waiting = 1;
+        vm->easing = easing;
+        vm->wait_end_us = vm->time_us + (uint64_t)duration_ms * 1000;
+    }
+}
+
+static void vm_step(struct vm *vm) {
+    if (vm->pc >= vm->length) {
+        vm->halted = 1;
+        return;
+    }
+    uint8_t op = vm->code[vm->pc];
+    const uint8_t *operands = &vm->code[vm->pc + 1];
+    int32_t *reg = vm->reg;
+    vm->pc += 1 + operand_sizes[op];
+
+    switch (op) {
+    case VM_END:
+        vm->halted = 1;
+        break;
+    case VM_COLOR:
+        for (int channel = 0; channel < COLOR_CHANNELS; channel++) {
+            reg[channel] = operands[channel];
+        }
+        break;
+    case VM_SHOW: {
+        int32_t to_q16[COLOR_CHANNELS];
+        for (int channel = 0; channel < COLOR_CHANNELS; channel++) {
+            to_q16[channel] = COLOR_Q16(clamp(reg[channel], 0, 255));
+        }
+        vm_wait(vm, to_q16, operand_time(operands), operands[2]);
+        break;
+    }
+    case VM_WAIT:
+        vm_wait(vm, vm->to_q16, operand_time(operands), VM_EASE_LINEAR);
+        break;
+    case VM_LOOP:
+        vm->loop_pc[vm->loop_depth] = vm->pc;
+        vm->loop_left[vm->loop_depth++] = operands[0];
+        break;
+    case VM_NEXT: {
+        uint8_t loop = vm->loop_depth - 1;
+        if (vm->loop_left[loop] == 0 || --vm->loop_left[loop] > 0)
+            vm->pc = vm->loop_pc[loop];
+        else
+            vm->loop_depth--;
+        break;
+    }
+    case VM_SET:
+        reg[operands[0]] = operands[1];
+        break;
+    case VM_RANDOM:
+        vm->random = vm->random * 1103515245 + 12345;
+        reg[operands[0]] = (vm->random >> 16) % (operands[1] + 1);
+        break;
+    // registers are kept in 16 bits, so nothing can overflow
+    case VM_ADD:
+        reg[operands[0]] = clamp(reg[operands[0]] + reg[operands[1]], -32768, 32767);
+        break;
+    case VM_SUB:
+        reg[operands[0]] = clamp(reg[operands[0]] - reg[operands[1]], -32768, 32767);
+        break;
+    case VM_SCALE:
+        reg[operands[0]] = reg[operands[0]] * reg[operands[1]] / 255;
+        break;
+    }
+}
+
+static int64_t ease(uint8_t easing, int64_t progress_q16) {
+    switch (easing) {
+    case VM_EASE_IN:
+        return (progress_q16 * progress_q16) >> 16;
+    case VM_EASE_OUT:
+        return 65536 - (((65536 - progress_q16) * (65536 - progress_q16)) >> 16);
+    case VM_EASE_IN_OUT: // smoothstep
+        return (((progress_q16 * progress_q16) >> 16) * (3 * 65536 - 2 * progress_q16)) >> 16;
+    }
+    return progress_q16;
+}
+
+static uint8_t render_program(const struct engine_animation *animation, uint64_t elapsed_us,
+                              int32_t color_q16[COLOR_CHANNELS]) {
+    struct vm *vm = (struct vm *)animation->params;
+    if (!vm->started || elapsed_us < vm->time_us)
+        vm_reset(vm, animation->start_color);
+
+    while (!vm->halted) {
+        if (vm->waiting) {
+            if (elapsed_us < vm->wait_end_us)
+                break;
+            vm->time_us = vm->wait_end_us;
+            vm->waiting = 0;
+            vm->steps = 0;
+        }
+        if (++vm->steps > VM_MAX_STEPS) {
+            logger(ANIM, "Program ran %d instructions without SHOW or WAIT, stopping it.", VM_MAX_STEPS);
+            vm->halted = 1;
+            break;
+        }
+        vm_step(vm);
+    }
+
+    if (vm->waiting) {
+        int64_t progress_q16 = ((elapsed_us - vm->time_us) << 16) / (vm->wait_end_us - vm->time_us);
+        progress_q16 = ease(vm->easing, progress_q16);
+        for (int channel = 0; channel < COLOR_CHANNELS; channel++) {
+            color_q16[channel] =
+                vm->from_q16[channel] +
+                (int32_t)(((int64_t)(vm->to_q16[channel] - vm->from_q16[channel]) * progress_q16) >> 16);
+        }
+        return 1;
+    }
+    memcpy(color_q16, vm->to_q16, sizeof(vm->to_q16));
+    return !vm->halted;
+}
+
+int vm_start_animation(uint32_t strips, const uint8_t *program, uint8_t length, struct Color color, uint8_t speed) {
+    if (length == 0 || vm_check(program, length) != 0)
+        return -1;
+
+    pthread_mutex_lock(&vm_mutex);
+    struct vm *vm = NULL;
+    for (int i = 0; i < MAX_STRIPS + 1 && vm == NULL; i++) {
+        if (!engine_animation_in_use(&vms[i]))
+            vm = &vms[i];
+    }
+    memset(vm, 0, sizeof(*vm));
+    memcpy(vm->code, program, length);
+    vm->length = length;
+    vm->initial[COLOR_RED] = color.RED;
+    vm->initial[COLOR_GREEN] = color.GREEN;
+    vm->initial[COLOR_BLUE] = color.BLUE;
+    vm->initial[3] = speed;
+    vm->seed = speed + 1;
+
+    struct engine_animation animation = {.render = render_program, .params = vm, .color = color, .speed = speed};
+    engine_start_animation(strips, &animation);
+    pthread_mutex_unlock(&vm_mutex);
+    return 0;
+}
@@ -0,0 +1,41 @@
+#ifndef VM_H
+#define VM_H
+
+#include "../utils/utils.h"
+#include "engine.h"
+#include <stdint.h>
+
+// Animation programs uploaded by clients with ANIM_RUN_PROGRAM and run by the render engine.
+// Program is executed against the animation time, not the wall clock, so it looks the same at any tick rate:
+// instructions are free, only SHOW and WAIT take time. Random numbers come from a generator seeded by `speed`.
+// Programs are checked on upload (known opcodes, complete operands, balanced loops) and can't touch anything
+// but their own registers. More than VM_MAX_STEPS instructions in a row without taking time stop the program.
+#define VM_MAX_PROGRAM 255 // bytes, program length is sent in Duration field
+#define VM_MAX_STEPS 256
+#define VM_MAX_LOOPS 4 // nesting of loops
+#define VM_REGISTERS 8 // 0-2 is color shown by SHOW (red, green, blue), 3-7 are free
+
+// opcodes and their operands, times are 16-bit big-endian milliseconds
+#define VM_END 0x00    //                    stop, last color stays
+#define VM_COLOR 0x01  // red green blue     color registers = red green blue
+#define VM_SHOW 0x02   // time(2) easing     change output to color registers in `time`, 0 means at once
+#define VM_WAIT 0x03   // time(2)            keep output for `time`
+#define VM_LOOP 0x04   // count              repeat until matching NEXT `count` times, 0 means forever
+#define VM_NEXT 0x05   //
+#define VM_SET 0x06    // reg value          reg = value
+#define VM_RANDOM 0x07 // reg max            reg = random number from 0 to max
+#define VM_ADD 0x08    // reg src            reg += src register
+#define VM_SUB 0x09    // reg src            reg -= src register
+#define VM_SCALE 0x0A  // reg src            reg = reg * src register / 255
+#define VM_OPCODES 0x0B
+
+#define VM_EASE_LINEAR 0
+#define VM_EASE_IN 1
+#define VM_EASE_OUT 2
+#define VM_EASE_IN_OUT 3
+
+// checks program and starts it on strips, `color` and `speed` are initial values of registers 0-3.
+// Returns -1 if program is invalid.
+int vm_start_animation(uint32_t strips, const uint8_t *program, uint8_t length, struct Color color, uint8_t speed);
+
+#endif // VM_H
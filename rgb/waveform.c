@@ -0,0 +1,107 @@
+#include "waveform.h"
+#include "../globals/globals.h"
+#include "../utils/utils.h"
+#include <string.h>
+
+uint32_t waveform_period_us() { return 1000000 / (PWM_FREQUENCY > 0 ? PWM_FREQUENCY : WAVEFORM_DEFAULT_FREQUENCY); }
+
+// one PWM period: all lit pins go high at its start, then every pin goes low after its on-time
+static int frame_pulses(const unsigned *pins, uint8_t pin_count, const uint32_t *duty, uint32_t period_us,
+                        gpioPulse_t *pulses) {
+    uint32_t on_us[WAVEFORM_MAX_PINS];
+    uint32_t time_us = 0;
+    int count = 1;
+
+    pulses[0] = (gpioPulse_t){0, 0, period_us};
+    for (int i = 0; i < pin_count; i++) {
+        on_us[i] = (uint64_t)duty[i] * period_us / PWM_RANGE;
+        if (on_us[i] > period_us)
+            on_us[i] = period_us;
+        if (on_us[i] > 0)
+            pulses[0].gpioOn |= 1u << pins[i];
+        else
+            pulses[0].gpioOff |= 1u << pins[i];
+    }
+
+    while (1) {
+        uint32_t next_us = period_us;
+        uint32_t mask = 0;
+        for (int i = 0; i < pin_count; i++) {
+            if (on_us[i] > time_us && on_us[i] < next_us)
+                next_us = on_us[i];
+        }
+        if (next_us == period_us)
+            break;
+        for (int i = 0; i < pin_count; i++) {
+            if (on_us[i] == next_us)
+                mask |= 1u << pins[i];
+        }
+        pulses[count - 1].usDelay = next_us - time_us;
+        pulses[count++] = (gpioPulse_t){0, mask, period_us - next_us};
+        time_us = next_us;
+    }
+    return count;
+}
+
+// `frames` holds `pin_count` duty cycles (0..PWM_RANGE) per frame. Returns 0 when the chain is playing.
+int waveform_play(const struct waveform_ops *ops, const unsigned *pins, uint8_t pin_count, const uint32_t *frames,
+                  uint32_t frame_count, uint32_t frame_us) {
+    gpioPulse_t pulses[WAVEFORM_MAX_PINS + 1];
+    uint8_t chain[WAVEFORM_MAX_CHAIN];
+    uint32_t period_us = waveform_period_us();
+    uint32_t repeats = frame_us / period_us ? frame_us / period_us : 1;
+    int length = 0;
+
+    if (pin_count > WAVEFORM_MAX_PINS)
+        return -1;
+    for (int i = 0; i < pin_count; i++) {
+        if (pins[i] >= WAVEFORM_MAX_PINS) {
+            logger(GPIO, "Waveforms can only drive GPIO 0-31, pin %u is out of range.", pins[i]);
+            return -1;
+        }
+    }
+
+    ops->clear();
+    chain[length++] = 255; // loop start
+    chain[length++] = 0;
+    for (uint32_t frame = 0; frame < frame_count;) {
+        const uint32_t *duty = frames + frame * pin_count;
+        uint32_t frame_repeats = repeats;
+        // consecutive equal frames share one wave
+        while (++frame < frame_count && memcmp(frames + frame * pin_count, duty, pin_count * sizeof(*duty)) == 0)
+            frame_repeats += repeats;
+
+        int count = frame_pulses(pins, pin_count, duty, period_us, pulses);
+        if (ops->add_generic(count, pulses) < 0)
+            goto fail;
+        int wave_id = ops->create();
+        if (wave_id < 0)
+            goto fail;
+
+        while (frame_repeats > 0) {
+            uint32_t loops = frame_repeats > 65535 ? 65535 : frame_repeats;
+            if (length + 7 + 2 > WAVEFORM_MAX_CHAIN) // keep room for the final loop forever
+                goto fail;
+            if (loops == 1) {
+                chain[length++] = wave_id;
+            } else {
+                uint8_t block[7] = {255, 0, wave_id, 255, 1, loops & 0xFF, loops >> 8};
+                memcpy(chain + length, block, sizeof(block));
+                length += sizeof(block);
+            }
+            frame_repeats -= loops;
+        }
+    }
+    chain[length++] = 255; // loop forever
+    chain[length++] = 3;
+
+    if (ops->chain((char *)chain, length) != 0)
+        goto fail;
+    logger_debug(GPIO, "Playing waveform: %u frames of %u us, %d chain bytes.", frame_count, frame_us, length);
+    return 0;
+
+fail:
+    logger(GPIO, "Waveform of %u frames does not fit into pigpio limits, rendering in software.", frame_count);
+    ops->clear();
+    return -1;
+}
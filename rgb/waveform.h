@@ -0,0 +1,27 @@
+#ifndef WAVEFORM_H
+#define WAVEFORM_H
+
+#include "pigpio.h"
+#include <stdint.h>
+
+// Hardware animation playback through pigpio DMA waveforms.
+// Every frame of an animation becomes one wave holding a single software PWM period of all pins,
+// and the wave chain repeats it for the length of the frame and loops the whole animation forever.
+#define WAVEFORM_MAX_FRAMES 80         // every frame takes up to 7 bytes of the 600 bytes pigpio allows for a chain
+#define WAVEFORM_MAX_CHAIN 600
+#define WAVEFORM_MAX_PINS 32           // waves can only drive GPIO 0-31
+#define WAVEFORM_DEFAULT_FREQUENCY 800 // same as default pigpio PWM frequency
+
+// pigpio and pigpiod have the same wave functions, differing only in `pi` argument
+struct waveform_ops {
+    int (*clear)();
+    int (*add_generic)(unsigned count, gpioPulse_t *pulses);
+    int (*create)();
+    int (*chain)(char *chain, unsigned length);
+};
+
+uint32_t waveform_period_us();
+int waveform_play(const struct waveform_ops *ops, const unsigned *pins, uint8_t pin_count, const uint32_t *frames,
+                  uint32_t frame_count, uint32_t frame_us);
+
+#endif // WAVEFORM_H
@@ -45,7 +45,7 @@ static enum MHD_Result answer_to_connection(void *cls, struct MHD_Connection *co
     uint8_t duration = atoi(DURATION_str);
 
     logger_debug(HTTP, "HTTP: Received colors: R=%d, G=%d, B=%d, Duration=%d s\n", red, green, blue, duration);
-    set_color_duration(pi, (struct Color){red, green, blue}, duration);
+    set_color_duration(pi, STRIPS_ALL, (struct Color){red, green, blue}, duration);
     int ret;
     struct MHD_Response *response;
     response = MHD_create_response_from_buffer(strlen("OK"), (void *)"OK", MHD_RESPMEM_PERSISTENT);
@@ -65,8 +65,7 @@ void *http_server_thread(void *arg) {
 
     logger(HTTP, "Started HTTP Server on port %d", PORT);
 
-    while (!stop_server)
-        ;
+    wait_for_server_stop();
 
     MHD_stop_daemon(daemon);
     return NULL;
@@ -1,10 +1,14 @@
 #include "server.h"
 #include "../globals/globals.h"
 #include "../parser/parser.h"
-#include "../pigpio/pigpiod_if2.h"
 #include "../rgb/gpio.h"
+#include "../rgb/scenes.h"
+#include "../rgb/state.h"
+#include "../rgb/scheduler.h"
+#include "../rgb/vm.h"
 #include "../utils/utils.h"
 #include <arpa/inet.h>
+#include <errno.h>
 #include <openssl/hmac.h>
 #include <pthread.h>
 #include <signal.h>
@@ -61,17 +65,23 @@ void remove_client_fd(int client_fd) {
     pthread_mutex_unlock(&clients_mutex);
 }
 
-void stop_animation() {
-    logger_debug(TCP, "Stop animation function called.");
-    // pthread_mutex_lock(&animation_mutex);
-    if (is_animating) {
-        is_animating = 0;
-        if (animation_thread) {
-            pthread_join(animation_thread, NULL);
-            animation_thread = 0;
-        }
+int server_wake_pipe[2] = {-1, -1};
+pthread_mutex_t server_stop_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t server_stop_cond = PTHREAD_COND_INITIALIZER;
+
+void wake_server() {
+    // called from signal handler, write() is async-signal-safe
+    if (server_wake_pipe[1] >= 0) {
+        char byte = 0;
+        write(server_wake_pipe[1], &byte, 1);
     }
-    // pthread_mutex_unlock(&animation_mutex);
+}
+
+void wait_for_server_stop() {
+    pthread_mutex_lock(&server_stop_mutex);
+    while (!stop_server)
+        pthread_cond_wait(&server_stop_cond, &server_stop_mutex);
+    pthread_mutex_unlock(&server_stop_mutex);
 }
 
 void *handle_client(void *client_sock) {
@@ -81,125 +91,168 @@ void *handle_client(void *client_sock) {
     add_client_fd(client_fd);
 
     unsigned char buffer[BUFFER_SIZE];
-    memset(buffer, 0, BUFFER_SIZE);
-
-    fd_set read_fds;
-    struct timeval timeout;
 
     while (!stop_server) {
-        // Set up the fd_set and timeout before each select call
-        FD_ZERO(&read_fds);
-        FD_SET(client_fd, &read_fds);
-
-        timeout.tv_sec = 1; // Timeout after 1 second of no activity
-        timeout.tv_usec = 0;
-
-        int activity = select(client_fd + 1, &read_fds, NULL, NULL, &timeout);
-
-        if (activity < 0) {
-            perror("select");
+        // blocking recv: idle clients cost nothing until they send something.
+        // Packets of older versions are shorter, so the version byte tells how much of the packet is left
+        memset(buffer, 0, BUFFER_SIZE);
+        int bytes_received = recv(client_fd, buffer, VERSION_OFFSET + 1, MSG_WAITALL);
+        if (bytes_received < 0) {
+            perror("recv");
+            break;
+        } else if (bytes_received < VERSION_OFFSET + 1) {
             break;
-        } else if (activity == 0) {
-            // Timeout occurred, no data within timeout period
-            continue;
         }
-
-        // Check if there’s data to read
-        if (FD_ISSET(client_fd, &read_fds)) {
-            int bytes_received = recv(client_fd, buffer, BUFFER_SIZE, 0);
-            if (bytes_received < 0) {
+        struct section_sizes sizes = get_section_sizes(buffer[VERSION_OFFSET]);
+        int packet_size = sizes.header_size + 32 + sizes.payload_size;
+        int rest = recv(client_fd, buffer + bytes_received, packet_size - bytes_received, MSG_WAITALL);
+        if (rest != packet_size - bytes_received) {
+            if (rest < 0)
                 perror("recv");
-                break;
-            } else if (bytes_received == 0) {
+            break;
+        }
+        bytes_received = packet_size;
+
+        logger_debug(TCP, "Received: %d bytes.", bytes_received);
+        // some v5 packets are followed by data: program of ANIM_RUN_PROGRAM, its length is in Duration field,
+        // command of SYS_SCHEDULE and scene ID of scene OPs
+        unsigned char data[VM_MAX_PROGRAM];
+        uint8_t data_size = 0;
+        if (bytes_received == BUFFER_SIZE && buffer[VERSION_OFFSET] >= 5) {
+            if (buffer[HEADER_SIZE - 1] == ANIM_RUN_PROGRAM)
+                data_size = buffer[PAYLOAD_OFFSET + 3];
+            else if (buffer[HEADER_SIZE - 1] == SYS_SCHEDULE)
+                data_size = SCHEDULE_DATA_SIZE;
+            else if (buffer[HEADER_SIZE - 1] == SCENE_SAVE)
+                data_size = SCENE_SAVE_DATA_SIZE;
+            else if (buffer[HEADER_SIZE - 1] == SCENE_DELETE || buffer[HEADER_SIZE - 1] == SCENE_RECALL)
+                data_size = SCENE_ID_DATA_SIZE;
+            if (data_size && recv(client_fd, data, data_size, MSG_WAITALL) != data_size) {
+                logger(TCP, "Failed to receive %d bytes of data following the packet.", data_size);
                 break;
             }
+        }
+        struct parse_result result = parse_message(buffer, data, data_size);
 
-            logger_debug(TCP, "Received: %d bytes.", bytes_received);
-            struct parse_result result = parse_message(buffer);
-
-            if (is_suspended && result.OP != SYS_TOGGLE_SUSPEND) {
-                logger(TCP, "Received package, but PiLED is in *suspended* mode! Ignoring.");
-                continue;
-            }
+        if (is_suspended && result.OP != SYS_TOGGLE_SUSPEND) {
+            logger(TCP, "Received package, but PiLED is in *suspended* mode! Ignoring.");
+            continue;
+        }
 
-            logger_debug(TCP, "Result of parsing: %d", result.result);
-            if (result.result == 0) {
-                logger_debug(TCP, "Successfully parsed and checked packet, processing. v%d", result.version);
-                switch (result.version) {
-                case 4:
-                case 3: {
-                    logger_debug(TCP, "v%d, OP is: %d", result.version, result.OP);
-                    switch (result.OP) {
-                    case LED_SET_COLOR: {
-                        logger(TCP, "Requested LED_SET_COLOR with %d %d %d on %d seconds, setting.", result.RED,
-                               result.GREEN, result.BLUE, result.duration);
-                        set_color_duration(pi, (struct Color){result.RED, result.GREEN, result.BLUE}, result.duration);
-                        break;
-                    }
-                    case LED_GET_CURRENT_COLOR: {
-                        logger(TCP, "Requested LED_GET_CURRENT_COLOR, sending...");
-                        send_info_about_color();
-                        break;
-                    }
-                    case ANIM_SET_FADE: {
-                        logger(TCP, "Requested ANIM_SET_FADE.");
-                        stop_animation();
-                        struct fade_animation_args *args = malloc(sizeof(struct fade_animation_args));
-                        args->pi = pi;
-                        args->speed = result.speed;
-                        pthread_mutex_lock(&animation_mutex);
-                        if (pthread_create(&animation_thread, NULL, start_fade_animation, (void *)args) != 0) {
-                            perror("Failed to create thread");
-                            free(args);
-                        } else {
-                            logger(TCP, "Started fade animation thread!");
-                        }
-                        pthread_mutex_unlock(&animation_mutex);
-                        break;
-                    }
-                    case ANIM_SET_PULSE: {
-                        logger(TCP, "Requested ANIM_SET_PULSE");
-                        stop_animation();
-                        struct pulse_animation_args *args = malloc(sizeof(struct pulse_animation_args));
-                        args->pi = pi;
-                        args->color = (struct Color){result.RED, result.GREEN, result.BLUE};
-                        args->duration = result.duration;
-                        pthread_mutex_lock(&animation_mutex);
-                        if (pthread_create(&animation_thread, NULL, start_pulse_animation, (void *)args) != 0) {
-                            perror("Failed to create thread");
-                            free(args);
-                        } else {
-                            logger(TCP, "Started pulse animation thread!");
-                        }
-                        pthread_mutex_unlock(&animation_mutex);
-                        break;
-                    }
-                    case SYS_TOGGLE_SUSPEND: {
-                        logger(TCP, "Requested SYS_TOGGLE_SUSPEND.");
-                        stop_animation();
-                        is_suspended = !is_suspended;
-                        set_color_duration(pi,
-                                           (struct Color){is_suspended ? 0 : result.RED,
-                                                          is_suspended ? 0 : result.GREEN,
-                                                          is_suspended ? 0 : result.BLUE},
-                                           result.duration);
-                        break;
-                    }
-                    }
+        logger_debug(TCP, "Result of parsing: %d", result.result);
+        if (result.result == 0) {
+            logger_debug(TCP, "Successfully parsed and checked packet, processing. v%d", result.version);
+            switch (result.version) {
+            case 5:
+            case 4:
+            case 3: {
+                logger_debug(TCP, "v%d, OP is: %d, target is: %d", result.version, result.OP, result.target);
+                uint32_t strips = target_strips(result.target);
+                if (!strips) {
+                    logger(TCP, "Requested unknown target %d, ignoring.", result.target);
+                    break;
+                }
+                switch (result.OP) {
+                case LED_SET_COLOR: {
+                    logger(TCP, "Requested LED_SET_COLOR with %d %d %d on %d seconds, setting.", result.RED,
+                           result.GREEN, result.BLUE, result.duration);
+                    set_color_duration(pi, strips, (struct Color){result.RED, result.GREEN, result.BLUE},
+                                       result.duration);
+                    break;
+                }
+                case LED_GET_CURRENT_COLOR: {
+                    logger(TCP, "Requested LED_GET_CURRENT_COLOR, sending...");
+                    send_info_about_color();
+                    break;
+                }
+                case LED_SET_OVERLAY: {
+                    logger(TCP, "Requested LED_SET_OVERLAY with %d %d %d for %d seconds.", result.RED, result.GREEN,
+                           result.BLUE, result.duration);
+                    set_overlay(pi, strips, (struct Color){result.RED, result.GREEN, result.BLUE}, result.speed,
+                                result.duration);
+                    break;
+                }
+                case SYS_TOGGLE_SUSPEND: {
+                    logger(TCP, "Requested SYS_TOGGLE_SUSPEND.");
+                    // suspend always applies to all outputs
+                    stop_animation(STRIPS_ALL);
+                    clear_overlays(STRIPS_ALL);
+                    is_suspended = !is_suspended;
+                    state_record_suspend(is_suspended);
+                    set_color_duration(pi, STRIPS_ALL,
+                                       (struct Color){is_suspended ? 0 : result.RED,
+                                                      is_suspended ? 0 : result.GREEN,
+                                                      is_suspended ? 0 : result.BLUE},
+                                       result.duration);
+                    break;
+                }
+                case ANIM_RUN_PROGRAM: {
+                    logger(TCP, "Requested ANIM_RUN_PROGRAM, %d bytes.", data_size);
+                    start_program(pi, strips, data, data_size, (struct Color){result.RED, result.GREEN, result.BLUE},
+                                  result.speed);
+                    break;
+                }
+                case SYS_SCHEDULE: {
+                    logger(TCP, "Requested SYS_SCHEDULE.");
+                    if (scheduler_add_packet(data, strips, (struct Color){result.RED, result.GREEN, result.BLUE},
+                                             result.speed, result.duration) != 0)
+                        logger(TCP, "Command can't be scheduled, ignoring it.");
+                    break;
+                }
+                case SCENE_SAVE: {
+                    logger(TCP, "Requested SCENE_SAVE of OP %d to scene %d.", data[1], data[0]);
+                    struct Color color = {result.RED, result.GREEN, result.BLUE};
+                    if (scene_save(data[0], (const char *)&data[2], strips, data[1], color, result.speed,
+                                   result.duration) != 0)
+                        logger(TCP, "Scene can't be saved, ignoring it.");
+                    break;
+                }
+                case SCENE_DELETE: {
+                    logger(TCP, "Requested SCENE_DELETE of scene %d.", data[0]);
+                    if (scene_delete(data[0]) != 0)
+                        logger(TCP, "Scene %d doesn't exist, ignoring it.", data[0]);
                     break;
                 }
-                case 2: {
-                    logger(TCP, "v2, setting with duration");
-                    set_color_duration(pi, (struct Color){result.RED, result.GREEN, result.BLUE}, result.duration);
+                case SCENE_RECALL: {
+                    logger(TCP, "Requested SCENE_RECALL of scene %d.", data[0]);
+                    if (scene_recall(data[0]) != 0)
+                        logger(TCP, "Scene %d doesn't exist, ignoring it.", data[0]);
+                    break;
+                }
+                case ANIM_AUDIO: {
+                    logger(TCP, "Requested ANIM_AUDIO with %d %d %d, gain %d.", result.RED, result.GREEN, result.BLUE,
+                           result.speed);
+                    start_audio(pi, strips, (struct Color){result.RED, result.GREEN, result.BLUE}, result.speed);
                     break;
                 }
-                case 1:
                 default: {
-                    logger(TCP, "v1, setting without duration");
-                    set_color_duration(pi, (struct Color){result.RED, result.GREEN, result.BLUE}, 0);
+                    struct Color color = {result.RED, result.GREEN, result.BLUE};
+                    const struct effect *effect = effect_by_op(result.OP);
+                    const struct piled_plugin *plugin = plugin_by_op(result.OP);
+                    if (effect != NULL) {
+                        logger(TCP, "Requested %s effect.", effect->name);
+                        start_effect(pi, strips, effect, color, result.speed, result.duration);
+                    } else if (plugin != NULL) {
+                        logger(TCP, "Requested \"%s\" plugin effect.", plugin->name);
+                        start_plugin(pi, strips, plugin, color, result.speed, result.duration);
+                    }
                     break;
                 }
                 }
+                break;
+            }
+            case 2: {
+                logger(TCP, "v2, setting with duration");
+                set_color_duration(pi, STRIPS_ALL, (struct Color){result.RED, result.GREEN, result.BLUE},
+                                   result.duration);
+                break;
+            }
+            case 1:
+            default: {
+                logger(TCP, "v1, setting without duration");
+                set_color_duration(pi, STRIPS_ALL, (struct Color){result.RED, result.GREEN, result.BLUE}, 0);
+                break;
+            }
             }
         }
     }
@@ -246,19 +299,26 @@ int start_server(int pi, int port) {
 
     logger(TCP, "Server listening on port %d", port);
 
+    if (pipe(server_wake_pipe) < 0) {
+        perror("pipe");
+        close(server_fd);
+        return -1;
+    }
+
     fd_set read_fds;
-    struct timeval timeout;
+    int max_fd = server_fd > server_wake_pipe[0] ? server_fd : server_wake_pipe[0];
 
     while (!stop_server) {
         FD_ZERO(&read_fds);
         FD_SET(server_fd, &read_fds);
+        FD_SET(server_wake_pipe[0], &read_fds);
 
-        timeout.tv_sec = 1;
-        timeout.tv_usec = 0;
+        // no timeout: we are woken up either by new client or by wake_server() on shutdown
+        int activity = select(max_fd + 1, &read_fds, NULL, NULL, NULL);
 
-        int activity = select(server_fd + 1, &read_fds, NULL, NULL, &timeout);
-
-        if (activity < 0 && !stop_server) {
+        if (activity < 0) {
+            if (errno == EINTR)
+                continue;
             perror("select");
             break;
         }
@@ -291,12 +351,19 @@ int start_server(int pi, int port) {
 
     // Close the server socket
     close(server_fd);
+    close(server_wake_pipe[0]);
+    close(server_wake_pipe[1]);
+    server_wake_pipe[0] = server_wake_pipe[1] = -1;
+
+    pthread_mutex_lock(&server_stop_mutex);
+    stop_server = 1;
+    pthread_cond_broadcast(&server_stop_cond);
+    pthread_mutex_unlock(&server_stop_mutex);
     return 0;
 }
 
 void send_info_about_color() {
-    struct Color color = {get_PWM_dutycycle(pi, RED_PIN), get_PWM_dutycycle(pi, GREEN_PIN),
-                          get_PWM_dutycycle(pi, BLUE_PIN)};
+    struct Color color = get_current_color();
     logger_debug(TCP, "Sending info about current color: %d %d %d", color.RED, color.GREEN, color.BLUE);
     // generating HEADER
     uint8_t HEADER[18];
@@ -7,7 +7,8 @@ extern volatile sig_atomic_t stop_server, is_suspended;
 
 void add_client_fd(int client_fd);
 void remove_client_fd(int client_fd);
-void stop_animation();
+void wake_server();
+void wait_for_server_stop();
 void *handle_client(void *client_sock);
 int start_server(int pi, int port);
 void send_info_about_color();
@@ -32,7 +32,7 @@ int callback_websocket(struct lws *wsi, enum lws_callback_reasons reason, void *
         if (token)
             duration = atoi(token);
 
-        set_color_duration(pi, (struct Color){red, green, blue}, duration);
+        set_color_duration(pi, STRIPS_ALL, (struct Color){red, green, blue}, duration);
     }
     default:
         break;
@@ -0,0 +1,55 @@
+#include "../globals/globals.h"
+#include "../rgb/color.h"
+#include "../rgb/output.h"
+#include <stdio.h>
+
+// Temporal dithering on the mock backend: a duty cycle between two PWM steps must average out to the
+// LUT value over a window of whole dithering periods.
+
+#define TEST_PIN 17
+#define TEST_TICKS 160 // 10 periods of 2^COLOR_DITHER_BITS ticks
+
+int main() {
+    // red 40 at gamma 2.2 is 4.3125 PWM steps of 255
+    GAMMA = 2.2;
+    PWM_RANGE = 255;
+    color_pipeline_init();
+    if (output_mock.init() != 0 || output_mock.setup_pin(TEST_PIN) != 0) {
+        fprintf(stderr, "mock backend failed to init\n");
+        return 1;
+    }
+
+    uint32_t error = 0;
+    uint32_t duty_q8 = color_to_duty_q8(COLOR_RED, COLOR_Q16(40));
+    uint32_t first = output_mock_frames_count();
+    for (int tick = 0; tick < TEST_TICKS; tick++) {
+        output_mock.set_duty(TEST_PIN, color_dither(&error, duty_q8));
+        output_mock.commit();
+    }
+
+    uint32_t sum = 0;
+    int failed = 0;
+    for (uint32_t index = first; index < first + TEST_TICKS; index++) {
+        struct output_mock_frame frame;
+        if (output_mock_get_frame(index, &frame) != 0) {
+            fprintf(stderr, "frame %u was not recorded\n", index);
+            return 1;
+        }
+        // only the two neighbouring steps may be written
+        if (frame.duty[TEST_PIN] != 4 && frame.duty[TEST_PIN] != 5) {
+            fprintf(stderr, "frame %u: duty %u is not 4 or 5\n", index, frame.duty[TEST_PIN]);
+            failed = 1;
+        }
+        sum += frame.duty[TEST_PIN];
+    }
+    output_mock.shutdown();
+
+    double average = (double)sum / TEST_TICKS;
+    double target = (double)(duty_q8 >> (8 - COLOR_DITHER_BITS)) / (1 << COLOR_DITHER_BITS);
+    printf("average duty over %d ticks %.4f, target %.4f\n", TEST_TICKS, average, target);
+    if (average != 4.3125 || average != target) {
+        fprintf(stderr, "average duty does not match the target\n");
+        failed = 1;
+    }
+    return failed;
+}
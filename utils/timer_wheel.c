@@ -0,0 +1,129 @@
+#include "timer_wheel.h"
+#include <string.h>
+
+#define SLOT_MASK (TIMER_WHEEL_SLOTS - 1)
+#define LEVEL_SHIFT(level) (TIMER_WHEEL_BITS * (level))
+#define WHEEL_SPAN ((uint64_t)1 << LEVEL_SHIFT(TIMER_WHEEL_LEVELS)) // ticks covered by all levels
+
+void timer_wheel_init(struct timer_wheel *wheel, uint64_t now) {
+    memset(wheel->slots, 0, sizeof(wheel->slots));
+    wheel->now = now;
+}
+
+// timer goes to the lowest level whose span covers it, `expires` may be `now` only while cascading
+static void insert(struct timer_wheel *wheel, struct timer *timer) {
+    uint64_t delta = timer->expires - wheel->now;
+    uint64_t expires = timer->expires;
+    int level = 0;
+    while (level < TIMER_WHEEL_LEVELS - 1 && delta >= (uint64_t)1 << LEVEL_SHIFT(level + 1))
+        level++;
+    if (delta >= WHEEL_SPAN)
+        expires = wheel->now + WHEEL_SPAN - 1; // too far ahead, waits for the last slot and is cascaded again
+    struct timer **slot = &wheel->slots[level][(expires >> LEVEL_SHIFT(level)) & SLOT_MASK];
+    timer->next = *slot;
+    *slot = timer;
+}
+
+void timer_wheel_add(struct timer_wheel *wheel, struct timer *timer) {
+    if (timer->expires <= wheel->now)
+        timer->expires = wheel->now + 1;
+    insert(wheel, timer);
+}
+
+static void cascade(struct timer_wheel *wheel, int level) {
+    struct timer **slot = &wheel->slots[level][(wheel->now >> LEVEL_SHIFT(level)) & SLOT_MASK];
+    struct timer *timer = *slot;
+    *slot = NULL;
+    while (timer != NULL) {
+        struct timer *next = timer->next;
+        insert(wheel, timer);
+        timer = next;
+    }
+}
+
+struct timer *timer_list_sort(struct timer *list) {
+    struct timer *sorted = NULL;
+    while (list != NULL) {
+        struct timer *timer = list;
+        list = list->next;
+        struct timer **link = &sorted;
+        while (*link != NULL && (*link)->expires <= timer->expires)
+            link = &(*link)->next;
+        timer->next = *link;
+        *link = timer;
+    }
+    return sorted;
+}
+
+// Clock jumped past everything the lowest level covers, e.g. a Pi without RTC starting at the epoch or at the
+// fake-hwclock time until NTP moves it days or years ahead. Stepping there tick by tick would take seconds, so all
+// timers are taken out at once, the due ones are returned and the rest go back relative to the new `now`.
+static struct timer *jump(struct timer_wheel *wheel, uint64_t now) {
+    struct timer *pending = NULL;
+    for (int level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+        for (int index = 0; index < TIMER_WHEEL_SLOTS; index++) {
+            struct timer *timer = wheel->slots[level][index];
+            wheel->slots[level][index] = NULL;
+            while (timer != NULL) {
+                struct timer *next = timer->next;
+                timer->next = pending;
+                pending = timer;
+                timer = next;
+            }
+        }
+    }
+
+    wheel->now = now;
+    struct timer *expired = NULL;
+    while (pending != NULL) {
+        struct timer *timer = pending;
+        pending = timer->next;
+        if (timer->expires <= now) {
+            timer->next = expired;
+            expired = timer;
+        } else {
+            insert(wheel, timer);
+        }
+    }
+    return timer_list_sort(expired);
+}
+
+struct timer *timer_wheel_advance(struct timer_wheel *wheel, uint64_t now) {
+    if (now > wheel->now && now - wheel->now >= TIMER_WHEEL_SLOTS)
+        return jump(wheel, now);
+
+    // short gaps are stepped, slots are appended in tick order so timers come out in due order
+    struct timer *expired = NULL;
+    struct timer **tail = &expired;
+    while (wheel->now < now) {
+        wheel->now++;
+        // upper levels first, timers due right now end up in the lowest level before it expires
+        for (int level = TIMER_WHEEL_LEVELS - 1; level > 0; level--) {
+            if ((wheel->now & (((uint64_t)1 << LEVEL_SHIFT(level)) - 1)) == 0)
+                cascade(wheel, level);
+        }
+        // all timers of a lowest level slot are due on this tick
+        struct timer **slot = &wheel->slots[0][wheel->now & SLOT_MASK];
+        *tail = *slot;
+        *slot = NULL;
+        while (*tail != NULL)
+            tail = &(*tail)->next;
+    }
+    return expired;
+}
+
+uint64_t timer_wheel_next(const struct timer_wheel *wheel) {
+    uint64_t next = TIMER_WHEEL_NEVER;
+    for (int level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+        uint64_t base = wheel->now >> LEVEL_SHIFT(level);
+        for (uint64_t block = base + 1; block <= base + TIMER_WHEEL_SLOTS; block++) {
+            if (wheel->slots[level][block & SLOT_MASK] != NULL) {
+                uint64_t tick = block << LEVEL_SHIFT(level);
+                if (tick < next)
+                    next = tick;
+                break;
+            }
+        }
+    }
+    return next;
+}
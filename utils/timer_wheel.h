@@ -0,0 +1,36 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <stdint.h>
+
+// Hierarchical timer wheel: TIMER_WHEEL_LEVELS wheels of TIMER_WHEEL_SLOTS slots, every level turns
+// TIMER_WHEEL_SLOTS times slower than the one below. Timers are kept in intrusive lists, so adding a timer and
+// expiring a slot are O(1); timers of upper levels are moved one level down (cascaded) when their slot comes.
+// Time is counted in ticks, their length is up to the user.
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_LEVELS 4 // timers up to 2^24 ticks ahead, later ones wait in the top level
+#define TIMER_WHEEL_NEVER UINT64_MAX
+
+struct timer {
+    struct timer *next;
+    uint64_t expires; // tick, timers added in the past expire on the next tick
+};
+
+struct timer_wheel {
+    uint64_t now; // all timers up to this tick have expired
+    struct timer *slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+};
+
+void timer_wheel_init(struct timer_wheel *wheel, uint64_t now);
+void timer_wheel_add(struct timer_wheel *wheel, struct timer *timer);
+// moves wheel to `now` and returns timers expired on the way, linked by `next` in order of expiry. Time never goes
+// back; a jump longer than TIMER_WHEEL_SLOTS ticks costs one pass over the wheel instead of a step per tick.
+struct timer *timer_wheel_advance(struct timer_wheel *wheel, uint64_t now);
+// sorts list linked by `next` by expiry, timers due on the same tick keep their order
+struct timer *timer_list_sort(struct timer *list);
+// tick wheel has to be advanced to next: expiry of the next timer if it's in the lowest level, otherwise the
+// earliest cascade. TIMER_WHEEL_NEVER if the wheel is empty.
+uint64_t timer_wheel_next(const struct timer_wheel *wheel);
+
+#endif // TIMER_WHEEL_H
@@ -2,6 +2,7 @@
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
 
 void handle_error(const char *msg) {
     perror(msg);
@@ -42,6 +43,14 @@ void logger(enum Modules module, const char *format, ...) {
         printf("[%sParser%s]: ", PARSER_COLOR, NO_COLOR);
         break;
     }
+    case SCHED: {
+        printf("[%sScheduler%s]: ", SCHED_COLOR, NO_COLOR);
+        break;
+    }
+    case SCENES: {
+        printf("[%sScenes%s]: ", SCENES_COLOR, NO_COLOR);
+        break;
+    }
     }
     va_list args;
     va_start(args, format);
@@ -87,6 +96,14 @@ void logger_debug(enum Modules module, const char *format, ...) {
         printf("[%sParser%s]: ", PARSER_COLOR, NO_COLOR);
         break;
     }
+    case SCHED: {
+        printf("[%sScheduler%s]: ", SCHED_COLOR, NO_COLOR);
+        break;
+    }
+    case SCENES: {
+        printf("[%sScenes%s]: ", SCENES_COLOR, NO_COLOR);
+        break;
+    }
     }
 
     va_list args;
@@ -97,4 +114,10 @@ void logger_debug(enum Modules module, const char *format, ...) {
     printf("\n");
     fflush(stdout);
 #endif
-}
\ No newline at end of file
+}
+
+uint64_t get_time_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}